@@ -14,6 +14,10 @@ BankState::BankState()
     cmd_timing_[static_cast<int>(CommandType::ACTIVATE)] = 0;
     cmd_timing_[static_cast<int>(CommandType::PRECHARGE)] = 0;
     cmd_timing_[static_cast<int>(CommandType::REFRESH)] = 0;
+    cmd_timing_[static_cast<int>(CommandType::REFRESH_SAME_BANK)] = 0;
+    cmd_timing_[static_cast<int>(CommandType::RFM)] = 0;
+    cmd_timing_[static_cast<int>(CommandType::PD_ENTER)] = 0;
+    cmd_timing_[static_cast<int>(CommandType::PD_EXIT)] = 0;
     cmd_timing_[static_cast<int>(CommandType::SREF_ENTER)] = 0;
     cmd_timing_[static_cast<int>(CommandType::SREF_EXIT)] = 0;
 }
@@ -32,6 +36,9 @@ Command BankState::GetReadyCommand(const Command& cmd, uint64_t clk) const {
                     break;
                 case CommandType::REFRESH:
                 case CommandType::REFRESH_BANK:
+                case CommandType::REFRESH_SAME_BANK:
+                case CommandType::RFM:
+                case CommandType::PD_ENTER:
                 case CommandType::SREF_ENTER:
                     required_type = cmd.cmd_type;
                     break;
@@ -53,8 +60,15 @@ Command BankState::GetReadyCommand(const Command& cmd, uint64_t clk) const {
                         required_type = CommandType::PRECHARGE;
                     }
                     break;
+                // active power down keeps the row open
+                case CommandType::PD_ENTER:
+                    required_type = cmd.cmd_type;
+                    break;
+                case CommandType::PRECHARGE:
                 case CommandType::REFRESH:
                 case CommandType::REFRESH_BANK:
+                case CommandType::REFRESH_SAME_BANK:
+                case CommandType::RFM:
                 case CommandType::SREF_ENTER:
                     required_type = CommandType::PRECHARGE;
                     break;
@@ -79,6 +93,9 @@ Command BankState::GetReadyCommand(const Command& cmd, uint64_t clk) const {
             }
             break;
         case State::PD:
+            // everything has to wait for the rank to power up
+            required_type = CommandType::PD_EXIT;
+            break;
         case State::SIZE:
             std::cerr << "In unknown state" << std::endl;
             AbruptExit(__FILE__, __LINE__);
@@ -108,9 +125,15 @@ void BankState::UpdateState(const Command& cmd) {
                     open_row_ = -1;
                     row_hit_count_ = 0;
                     break;
+                case CommandType::PD_ENTER:
+                    state_ = State::PD;
+                    break;
                 case CommandType::ACTIVATE:
                 case CommandType::REFRESH:
                 case CommandType::REFRESH_BANK:
+                case CommandType::REFRESH_SAME_BANK:
+                case CommandType::RFM:
+                case CommandType::PD_EXIT:
                 case CommandType::SREF_ENTER:
                 case CommandType::SREF_EXIT:
                 default:
@@ -121,11 +144,16 @@ void BankState::UpdateState(const Command& cmd) {
             switch (cmd.cmd_type) {
                 case CommandType::REFRESH:
                 case CommandType::REFRESH_BANK:
+                case CommandType::REFRESH_SAME_BANK:
+                case CommandType::RFM:
                     break;
                 case CommandType::ACTIVATE:
                     state_ = State::OPEN;
                     open_row_ = cmd.Row();
                     break;
+                case CommandType::PD_ENTER:
+                    state_ = State::PD;
+                    break;
                 case CommandType::SREF_ENTER:
                     state_ = State::SREF;
                     break;
@@ -134,6 +162,7 @@ void BankState::UpdateState(const Command& cmd) {
                 case CommandType::READ_PRECHARGE:
                 case CommandType::WRITE_PRECHARGE:
                 case CommandType::PRECHARGE:
+                case CommandType::PD_EXIT:
                 case CommandType::SREF_EXIT:
                 default:
                     std::cout << cmd << std::endl;
@@ -153,11 +182,25 @@ void BankState::UpdateState(const Command& cmd) {
                 case CommandType::PRECHARGE:
                 case CommandType::REFRESH:
                 case CommandType::REFRESH_BANK:
+                case CommandType::REFRESH_SAME_BANK:
+                case CommandType::RFM:
+                case CommandType::PD_ENTER:
+                case CommandType::PD_EXIT:
                 case CommandType::SREF_ENTER:
                 default:
                     AbruptExit(__FILE__, __LINE__);
             }
             break;
+        case State::PD:
+            switch (cmd.cmd_type) {
+                // back to where the bank was before entering power down
+                case CommandType::PD_EXIT:
+                    state_ = open_row_ == -1 ? State::CLOSED : State::OPEN;
+                    break;
+                default:
+                    AbruptExit(__FILE__, __LINE__);
+            }
+            break;
         default:
             AbruptExit(__FILE__, __LINE__);
     }
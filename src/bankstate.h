@@ -19,7 +19,10 @@ class BankState {
     // Update the existing timing constraints for the command
     void UpdateTiming(const CommandType cmd_type, uint64_t time);
 
-    bool IsRowOpen() const { return state_ == State::OPEN; }
+    // a row stays open in active power down
+    bool IsRowOpen() const {
+        return state_ == State::OPEN || (state_ == State::PD && open_row_ != -1);
+    }
     int OpenRow() const { return open_row_; }
     int RowHitCount() const { return row_hit_count_; }
 
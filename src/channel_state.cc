@@ -1,11 +1,23 @@
 #include "channel_state.h"
 
 namespace dramsim3 {
-ChannelState::ChannelState(const Config& config, const Timing& timing)
-    : rank_idle_cycles(config.ranks, 0),
-      config_(config),
+
+// residency stat of each RankPower state
+static const std::string kResidencyStats[] = {
+    "rank_active_cycles", "all_bank_idle_cycles", "act_pd_cycles",
+    "pre_pd_cycles", "sref_cycles"};
+
+ChannelState::ChannelState(const Config& config, const Timing& timing,
+                           SimpleStats& simple_stats)
+    : config_(config),
       timing_(timing),
+      simple_stats_(simple_stats),
+      row_hammer_(config, simple_stats),
       rank_is_sref_(config.ranks, false),
+      rank_is_pd_(config.ranks, false),
+      rank_power_(config.ranks, RankPower::IDLE),
+      rank_power_since_(config.ranks, 0),
+      rank_idle_since_(config.ranks, 0),
       four_aw_(config_.ranks, std::vector<uint64_t>()),
       thirty_two_aw_(config_.ranks, std::vector<uint64_t>()) {
     bank_states_.reserve(config_.ranks);
@@ -32,6 +44,38 @@ bool ChannelState::IsAllBankIdleInRank(int rank) const {
     return true;
 }
 
+void ChannelState::UpdateRankPower(int rank, uint64_t clk) {
+    bool all_idle = IsAllBankIdleInRank(rank);
+    RankPower power;
+    if (rank_is_sref_[rank]) {
+        power = RankPower::SREF;
+    } else if (rank_is_pd_[rank]) {
+        power = all_idle ? RankPower::PRE_PD : RankPower::ACT_PD;
+    } else {
+        power = all_idle ? RankPower::IDLE : RankPower::ACTIVE;
+    }
+    auto prev = rank_power_[rank];
+    if (power == prev) {
+        return;
+    }
+    simple_stats_.IncrementVecBy(kResidencyStats[static_cast<int>(prev)],
+                                 rank, clk - rank_power_since_[rank]);
+    rank_power_since_[rank] = clk;
+    if (prev == RankPower::ACTIVE || prev == RankPower::ACT_PD) {
+        rank_idle_since_[rank] = clk;
+    }
+    rank_power_[rank] = power;
+}
+
+void ChannelState::UpdateResidencyStats(uint64_t clk) {
+    for (int i = 0; i < config_.ranks; i++) {
+        simple_stats_.IncrementVecBy(
+            kResidencyStats[static_cast<int>(rank_power_[i])], i,
+            clk - rank_power_since_[i]);
+        rank_power_since_[i] = clk;
+    }
+}
+
 bool ChannelState::IsRWPendingOnRef(const Command& cmd) const {
     int rank = cmd.Rank();
     int bankgroup = cmd.Bankgroup();
@@ -48,7 +92,8 @@ void ChannelState::BankNeedRefresh(int rank, int bankgroup, int bank,
         refresh_q_.emplace_back(CommandType::REFRESH_BANK, addr, -1);
     } else {
         for (auto it = refresh_q_.begin(); it != refresh_q_.end(); it++) {
-            if (it->Rank() == rank && it->Bankgroup() == bankgroup &&
+            if (it->cmd_type == CommandType::REFRESH_BANK &&
+                it->Rank() == rank && it->Bankgroup() == bankgroup &&
                 it->Bank() == bank) {
                 refresh_q_.erase(it);
                 break;
@@ -58,13 +103,46 @@ void ChannelState::BankNeedRefresh(int rank, int bankgroup, int bank,
     return;
 }
 
+void ChannelState::BankNeedRFM(int rank, int bankgroup, int bank, int row,
+                               bool need) {
+    if (need) {
+        Address addr = Address(-1, rank, bankgroup, bank, row, -1);
+        refresh_q_.emplace_back(CommandType::RFM, addr, -1);
+    } else {
+        for (auto it = refresh_q_.begin(); it != refresh_q_.end(); it++) {
+            if (it->cmd_type == CommandType::RFM && it->Rank() == rank &&
+                it->Bankgroup() == bankgroup && it->Bank() == bank) {
+                refresh_q_.erase(it);
+                break;
+            }
+        }
+    }
+    return;
+}
+
+void ChannelState::SameBankNeedRefresh(int rank, int bank, bool need) {
+    if (need) {
+        Address addr = Address(-1, rank, -1, bank, -1, -1);
+        refresh_q_.emplace_back(CommandType::REFRESH_SAME_BANK, addr, -1);
+    } else {
+        for (auto it = refresh_q_.begin(); it != refresh_q_.end(); it++) {
+            if (it->cmd_type == CommandType::REFRESH_SAME_BANK &&
+                it->Rank() == rank && it->Bank() == bank) {
+                refresh_q_.erase(it);
+                break;
+            }
+        }
+    }
+    return;
+}
+
 void ChannelState::RankNeedRefresh(int rank, bool need) {
     if (need) {
         Address addr = Address(-1, rank, -1, -1, -1, -1);
         refresh_q_.emplace_back(CommandType::REFRESH, addr, -1);
     } else {
         for (auto it = refresh_q_.begin(); it != refresh_q_.end(); it++) {
-            if (it->Rank() == rank) {
+            if (it->cmd_type == CommandType::REFRESH && it->Rank() == rank) {
                 refresh_q_.erase(it);
                 break;
             }
@@ -75,10 +153,15 @@ void ChannelState::RankNeedRefresh(int rank, bool need) {
 
 Command ChannelState::GetReadyCommand(const Command& cmd, uint64_t clk) const {
     Command ready_cmd = Command();
-    if (cmd.IsRankCMD()) {
+    if (cmd.IsRankCMD() || cmd.IsSameBankCMD()) {
         int num_ready = 0;
+        int num_banks =
+            cmd.IsSameBankCMD() ? config_.bankgroups : config_.banks;
         for (auto j = 0; j < config_.bankgroups; j++) {
             for (auto k = 0; k < config_.banks_per_group; k++) {
+                if (cmd.IsSameBankCMD() && k != cmd.Bank()) {
+                    continue;
+                }
                 ready_cmd =
                     bank_states_[cmd.Rank()][j][k].GetReadyCommand(cmd, clk);
                 if (!ready_cmd.IsValid()) {  // Not ready
@@ -94,7 +177,7 @@ Command ChannelState::GetReadyCommand(const Command& cmd, uint64_t clk) const {
             }
         }
         // All bank ready
-        if (num_ready == config_.banks) {
+        if (num_ready == num_banks) {
             return ready_cmd;
         } else {
             return Command();
@@ -122,15 +205,41 @@ void ChannelState::UpdateState(const Command& cmd) {
             }
         }
         if (cmd.IsRefresh()) {
+            row_hammer_.Refresh(cmd);
             RankNeedRefresh(cmd.Rank(), false);
+        } else if (cmd.cmd_type == CommandType::PD_ENTER) {
+            rank_is_pd_[cmd.Rank()] = true;
+        } else if (cmd.cmd_type == CommandType::PD_EXIT) {
+            rank_is_pd_[cmd.Rank()] = false;
         } else if (cmd.cmd_type == CommandType::SREF_ENTER) {
             rank_is_sref_[cmd.Rank()] = true;
         } else if (cmd.cmd_type == CommandType::SREF_EXIT) {
             rank_is_sref_[cmd.Rank()] = false;
         }
+    } else if (cmd.IsSameBankCMD()) {
+        for (auto j = 0; j < config_.bankgroups; j++) {
+            bank_states_[cmd.Rank()][j][cmd.Bank()].UpdateState(cmd);
+        }
+        row_hammer_.Refresh(cmd);
+        SameBankNeedRefresh(cmd.Rank(), cmd.Bank(), false);
     } else {
         bank_states_[cmd.Rank()][cmd.Bankgroup()][cmd.Bank()].UpdateState(cmd);
-        if (cmd.IsRefresh()) {
+        if (cmd.cmd_type == CommandType::ACTIVATE) {
+            row_hammer_.Activate(cmd);
+        } else if (cmd.cmd_type == CommandType::PRECHARGE ||
+                   cmd.cmd_type == CommandType::READ_PRECHARGE ||
+                   cmd.cmd_type == CommandType::WRITE_PRECHARGE) {
+            // refresh the victims of the row just closed if necessary
+            int row = row_hammer_.Precharge(cmd);
+            if (row >= 0) {
+                BankNeedRFM(cmd.Rank(), cmd.Bankgroup(), cmd.Bank(), row,
+                            true);
+            }
+        } else if (cmd.cmd_type == CommandType::RFM) {
+            row_hammer_.TargetedRefresh(cmd);
+            BankNeedRFM(cmd.Rank(), cmd.Bankgroup(), cmd.Bank(), -1, false);
+        } else if (cmd.IsRefresh()) {
+            row_hammer_.Refresh(cmd);
             BankNeedRefresh(cmd.Rank(), cmd.Bankgroup(), cmd.Bank(), false);
         }
     }
@@ -147,6 +256,7 @@ void ChannelState::UpdateTiming(const Command& cmd, uint64_t clk) {
         case CommandType::WRITE_PRECHARGE:
         case CommandType::PRECHARGE:
         case CommandType::REFRESH_BANK:
+        case CommandType::RFM:
             // TODO - simulator speed? - Speciazlize which of the below
             // functions to call depending on the command type  Same Bank
             UpdateSameBankTiming(
@@ -172,7 +282,12 @@ void ChannelState::UpdateTiming(const Command& cmd, uint64_t clk) {
                 cmd.addr, timing_.other_ranks[static_cast<int>(cmd.cmd_type)],
                 clk);
             break;
+        case CommandType::REFRESH_SAME_BANK:
+            UpdateSameBankSetTiming(cmd.addr, clk);
+            break;
         case CommandType::REFRESH:
+        case CommandType::PD_ENTER:
+        case CommandType::PD_EXIT:
         case CommandType::SREF_ENTER:
         case CommandType::SREF_EXIT:
             UpdateSameRankTiming(
@@ -262,9 +377,27 @@ void ChannelState::UpdateSameRankTiming(
     return;
 }
 
+void ChannelState::UpdateSameBankSetTiming(const Address& addr,
+                                           uint64_t clk) {
+    int idx = static_cast<int>(CommandType::REFRESH_SAME_BANK);
+    for (auto j = 0; j < config_.bankgroups; j++) {
+        for (auto k = 0; k < config_.banks_per_group; k++) {
+            const auto& cmd_timing_list =
+                k == addr.bank ? timing_.same_bank[idx]
+                               : timing_.other_banks_same_bankgroup[idx];
+            for (auto cmd_timing : cmd_timing_list) {
+                bank_states_[addr.rank][j][k].UpdateTiming(
+                    cmd_timing.first, clk + cmd_timing.second);
+            }
+        }
+    }
+    return;
+}
+
 void ChannelState::UpdateTimingAndStates(const Command& cmd, uint64_t clk) {
     UpdateState(cmd);
     UpdateTiming(cmd, clk);
+    UpdateRankPower(cmd.Rank(), clk);
     return;
 }
 
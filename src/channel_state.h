@@ -5,13 +5,16 @@
 #include "bankstate.h"
 #include "common.h"
 #include "configuration.h"
+#include "row_hammer.h"
+#include "simple_stats.h"
 #include "timing.h"
 
 namespace dramsim3 {
 
 class ChannelState {
    public:
-    ChannelState(const Config& config, const Timing& timing);
+    ChannelState(const Config& config, const Timing& timing,
+                 SimpleStats& simple_stats);
     Command GetReadyCommand(const Command& cmd, uint64_t clk) const;
     void UpdateState(const Command& cmd);
     void UpdateTiming(const Command& cmd, uint64_t clk);
@@ -23,11 +26,14 @@ class ChannelState {
     }
     bool IsAllBankIdleInRank(int rank) const;
     bool IsRankSelfRefreshing(int rank) const { return rank_is_sref_[rank]; }
+    bool IsRankPoweredDown(int rank) const { return rank_is_pd_[rank]; }
     bool IsRefreshWaiting() const { return !refresh_q_.empty(); }
     bool IsRWPendingOnRef(const Command& cmd) const;
     const Command& PendingRefCommand() const {return refresh_q_.front(); }
     void BankNeedRefresh(int rank, int bankgroup, int bank, bool need);
     void RankNeedRefresh(int rank, bool need);
+    void SameBankNeedRefresh(int rank, int bank, bool need);
+    void BankNeedRFM(int rank, int bankgroup, int bank, int row, bool need);
     int OpenRow(int rank, int bankgroup, int bank) const {
         return bank_states_[rank][bankgroup][bank].OpenRow();
     }
@@ -35,13 +41,32 @@ class ChannelState {
         return bank_states_[rank][bankgroup][bank].RowHitCount();
     };
 
-    std::vector<int> rank_idle_cycles;
+    // cycles since the rank last had a row open, counting the current one
+    uint64_t RankIdleCycles(int rank, uint64_t clk) const {
+        auto power = rank_power_[rank];
+        if (power == RankPower::ACTIVE || power == RankPower::ACT_PD) {
+            return 0;
+        }
+        return clk - rank_idle_since_[rank] + 1;
+    }
+    // add the cycles since the last update to the residency stats
+    void UpdateResidencyStats(uint64_t clk);
 
    private:
+    // rank power states only change with commands, so their residency is
+    // kept as intervals instead of being counted every cycle
+    enum class RankPower { ACTIVE, IDLE, ACT_PD, PRE_PD, SREF, SIZE };
+
     const Config& config_;
     const Timing& timing_;
+    SimpleStats& simple_stats_;
+    RowHammer row_hammer_;
 
     std::vector<bool> rank_is_sref_;
+    std::vector<bool> rank_is_pd_;
+    std::vector<RankPower> rank_power_;
+    std::vector<uint64_t> rank_power_since_;
+    std::vector<uint64_t> rank_idle_since_;
     std::vector<std::vector<std::vector<BankState> > > bank_states_;
     std::vector<Command> refresh_q_;
 
@@ -49,6 +74,7 @@ class ChannelState {
     std::vector<std::vector<uint64_t> > thirty_two_aw_;
     bool IsFAWReady(int rank, uint64_t curr_time) const;
     bool Is32AWReady(int rank, uint64_t curr_time) const;
+    void UpdateRankPower(int rank, uint64_t clk);
     // Update timing of the bank the command corresponds to
     void UpdateSameBankTiming(
         const Address& addr,
@@ -74,6 +100,10 @@ class ChannelState {
         const std::vector<std::pair<CommandType, int> >& cmd_timing_list,
         uint64_t clk);
 
+    // Update timing of the same bank in every bankgroup and the rest of the
+    // rank (for same bank refresh)
+    void UpdateSameBankSetTiming(const Address& addr, uint64_t clk);
+
     // Update timing of the entire rank (for rank level commands)
     void UpdateSameRankTiming(
         const Address& addr,
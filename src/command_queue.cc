@@ -33,7 +33,7 @@ CommandQueue::CommandQueue(int channel_id, const Config& config,
     }
 }
 
-Command CommandQueue::GetCommandToIssue() {
+Command CommandQueue::GetCommandToIssue(uint32_t qos_mask, CommandBus bus) {
     for (int i = 0; i < num_queues_; i++) {
         auto& queue = GetNextQueue();
         // if we're refresing, skip the command queues that are involved
@@ -42,7 +42,7 @@ Command CommandQueue::GetCommandToIssue() {
                 continue;
             }
         }
-        auto cmd = GetFirstReadyInQueue(queue);
+        auto cmd = GetFirstReadyInQueue(queue, qos_mask, bus);
         if (cmd.IsValid()) {
             if (cmd.IsReadWrite()) {
                 EraseRWCommand(cmd);
@@ -58,7 +58,7 @@ Command CommandQueue::FinishRefresh() {
     // that already had ACT on the way but by doing that we
     // significantly pushes back the timing for a refresh
     // so we simply implement an ASAP approach
-    auto ref = channel_state_.PendingRefCommand();
+    const auto& ref = channel_state_.PendingRefCommand();
     if (!is_in_ref_) {
         GetRefQIndices(ref);
         is_in_ref_ = true;
@@ -74,9 +74,36 @@ Command CommandQueue::FinishRefresh() {
     return cmd;
 }
 
+Command CommandQueue::GetAggressivePrecharge() {
+    // close open rows that no longer have any hits queued up so that the
+    // next access to the bank only pays tRCD instead of tRP + tRCD,
+    // the timing (tRAS/tWR/tRTP) is still checked by the channel state
+    for (int i = 0; i < config_.ranks; i++) {
+        if (channel_state_.IsRankSelfRefreshing(i) ||
+            channel_state_.IsRankPoweredDown(i)) {
+            continue;
+        }
+        for (int j = 0; j < config_.bankgroups; j++) {
+            for (int k = 0; k < config_.banks_per_group; k++) {
+                if (!channel_state_.IsRowOpen(i, j, k) ||
+                    HasPendingRowHits(i, j, k)) {
+                    continue;
+                }
+                auto addr = Address(-1, i, j, k, -1, -1);
+                auto pre = Command(CommandType::PRECHARGE, addr, -1);
+                auto cmd = channel_state_.GetReadyCommand(pre, clk_);
+                if (cmd.IsValid()) {
+                    return cmd;
+                }
+            }
+        }
+    }
+    return Command();
+}
+
 bool CommandQueue::ArbitratePrecharge(const CMDIterator& cmd_it,
                                       const CMDQueue& queue) const {
-    auto cmd = *cmd_it;
+    const auto& cmd = *cmd_it;
 
     for (auto prev_itr = queue.begin(); prev_itr != cmd_it; prev_itr++) {
         if (prev_itr->Rank() == cmd.Rank() &&
@@ -115,7 +142,7 @@ bool CommandQueue::WillAcceptCommand(int rank, int bankgroup, int bank) const {
 }
 
 bool CommandQueue::QueueEmpty() const {
-    for (const auto q : queues_) {
+    for (const auto& q : queues_) {
         if (!q.empty()) {
             return false;
         }
@@ -123,6 +150,30 @@ bool CommandQueue::QueueEmpty() const {
     return true;
 }
 
+bool CommandQueue::RankQueueEmpty(int rank) const {
+    if (queue_structure_ == QueueStructure::PER_RANK) {
+        return queues_[rank].empty();
+    }
+    for (int i = rank * config_.banks; i < (rank + 1) * config_.banks; i++) {
+        if (!queues_[i].empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CommandQueue::BankQueueEmpty(int rank, int bankgroup, int bank) const {
+    const auto& queue = queues_[GetQueueIndex(rank, bankgroup, bank)];
+    if (queue_structure_ == QueueStructure::PER_BANK) {
+        return queue.empty();
+    }
+    for (const auto& cmd : queue) {
+        if (cmd.Bankgroup() == bankgroup && cmd.Bank() == bank) {
+            return false;
+        }
+    }
+    return true;
+}
 
 bool CommandQueue::AddCommand(Command cmd) {
     auto& queue = GetQueue(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
@@ -154,6 +205,10 @@ void CommandQueue::GetRefQIndices(const Command& ref) {
         } else {
             ref_q_indices_.insert(ref.Rank());
         }
+    } else if (ref.IsSameBankCMD()) {
+        for (int j = 0; j < config_.bankgroups; j++) {
+            ref_q_indices_.insert(GetQueueIndex(ref.Rank(), j, ref.Bank()));
+        }
     } else {  // refb
         int idx = GetQueueIndex(ref.Rank(), ref.Bankgroup(), ref.Bank());
         ref_q_indices_.insert(idx);
@@ -175,12 +230,21 @@ CMDQueue& CommandQueue::GetQueue(int rank, int bankgroup, int bank) {
     return queues_[index];
 }
 
-Command CommandQueue::GetFirstReadyInQueue(CMDQueue& queue) const {
+Command CommandQueue::GetFirstReadyInQueue(CMDQueue& queue,
+                                           uint32_t qos_mask,
+                                           CommandBus bus) const {
     for (auto cmd_it = queue.begin(); cmd_it != queue.end(); cmd_it++) {
+        if (!(qos_mask & (1u << cmd_it->qos_class))) {
+            continue;
+        }
         Command cmd = channel_state_.GetReadyCommand(*cmd_it, clk_);
         if (!cmd.IsValid()) {
             continue;
         }
+        if ((bus == CommandBus::ROW && cmd.IsReadWrite()) ||
+            (bus == CommandBus::COLUMN && !cmd.IsReadWrite())) {
+            continue;
+        }
         if (cmd.cmd_type == CommandType::PRECHARGE) {
             if (!ArbitratePrecharge(cmd_it, queue)) {
                 continue;
@@ -210,6 +274,19 @@ void CommandQueue::EraseRWCommand(const Command& cmd) {
     exit(1);
 }
 
+bool CommandQueue::HasPendingRowHits(int rank, int bankgroup,
+                                     int bank) const {
+    int open_row = channel_state_.OpenRow(rank, bankgroup, bank);
+    const auto& queue = queues_[GetQueueIndex(rank, bankgroup, bank)];
+    for (auto it = queue.begin(); it != queue.end(); it++) {
+        if (it->Row() == open_row && it->Bank() == bank &&
+            it->Bankgroup() == bankgroup && it->Rank() == rank) {
+            return true;
+        }
+    }
+    return false;
+}
+
 int CommandQueue::QueueUsage() const {
     int usage = 0;
     for (auto i = queues_.begin(); i != queues_.end(); i++) {
@@ -14,17 +14,25 @@ namespace dramsim3 {
 using CMDIterator = std::vector<Command>::iterator;
 using CMDQueue = std::vector<Command>;
 enum class QueueStructure { PER_RANK, PER_BANK, SIZE };
+// row commands (ACT/PRE/REF) and column commands (RD/WR)
+enum class CommandBus { ANY, ROW, COLUMN };
 
 class CommandQueue {
    public:
     CommandQueue(int channel_id, const Config& config,
                  const ChannelState& channel_state, SimpleStats& simple_stats);
-    Command GetCommandToIssue();
+    // only consider commands whose QoS class is set in qos_mask and that
+    // go over the given command bus
+    Command GetCommandToIssue(uint32_t qos_mask = ~0u,
+                              CommandBus bus = CommandBus::ANY);
     Command FinishRefresh();
+    Command GetAggressivePrecharge();
     void ClockTick() { clk_ += 1; };
     bool WillAcceptCommand(int rank, int bankgroup, int bank) const;
     bool AddCommand(Command cmd);
     bool QueueEmpty() const;
+    bool RankQueueEmpty(int rank) const;
+    bool BankQueueEmpty(int rank, int bankgroup, int bank) const;
     int QueueUsage() const;
     std::vector<bool> rank_q_empty;
 
@@ -33,7 +41,9 @@ class CommandQueue {
                             const CMDQueue& queue) const;
     bool HasRWDependency(const CMDIterator& cmd_it,
                          const CMDQueue& queue) const;
-    Command GetFirstReadyInQueue(CMDQueue& queue) const;
+    bool HasPendingRowHits(int rank, int bankgroup, int bank) const;
+    Command GetFirstReadyInQueue(CMDQueue& queue, uint32_t qos_mask,
+                                 CommandBus bus) const;
     int GetQueueIndex(int rank, int bankgroup, int bank) const;
     CMDQueue& GetQueue(int rank, int bankgroup, int bank);
     CMDQueue& GetNextQueue();
@@ -6,8 +6,8 @@
 
 namespace dramsim3 {
 
-std::ostream& operator<<(std::ostream& os, const Command& cmd) {
-    std::vector<std::string> command_string = {
+std::string CommandTypeString(CommandType cmd_type) {
+    static const std::vector<std::string> command_string = {
         "read",
         "read_p",
         "write",
@@ -15,12 +15,20 @@ std::ostream& operator<<(std::ostream& os, const Command& cmd) {
         "activate",
         "precharge",
         "refresh_bank",  // verilog model doesn't distinguish bank/rank refresh
+        "refresh_same_bank",
         "refresh",
+        "rfm",
+        "power_down_enter",
+        "power_down_exit",
         "self_refresh_enter",
         "self_refresh_exit",
         "WRONG"};
+    return command_string[static_cast<int>(cmd_type)];
+}
+
+std::ostream& operator<<(std::ostream& os, const Command& cmd) {
     os << fmt::format("{:<20} {:>3} {:>3} {:>3} {:>3} {:>#8x} {:>#8x}",
-                      command_string[static_cast<int>(cmd.cmd_type)],
+                      CommandTypeString(cmd.cmd_type),
                       cmd.Channel(), cmd.Rank(), cmd.Bankgroup(), cmd.Bank(),
                       cmd.Row(), cmd.Column());
     return os;
@@ -3,33 +3,30 @@
 
 #include <stdint.h>
 #include <iostream>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 namespace dramsim3 {
 
+// 16 bytes so that it packs into commands and transactions, -1 means the
+// field does not apply (e.g. the bank of a rank level command)
 struct Address {
     Address()
-        : channel(-1), rank(-1), bankgroup(-1), bank(-1), row(-1), column(-1) {}
+        : row(-1), column(-1), channel(-1), rank(-1), bankgroup(-1), bank(-1) {}
     Address(int channel, int rank, int bankgroup, int bank, int row, int column)
-        : channel(channel),
-          rank(rank),
-          bankgroup(bankgroup),
-          bank(bank),
-          row(row),
-          column(column) {}
-    Address(const Address& addr)
-        : channel(addr.channel),
-          rank(addr.rank),
-          bankgroup(addr.bankgroup),
-          bank(addr.bank),
-          row(addr.row),
-          column(addr.column) {}
-    int channel;
-    int rank;
-    int bankgroup;
-    int bank;
-    int row;
-    int column;
+        : row(row),
+          column(static_cast<int16_t>(column)),
+          channel(static_cast<int16_t>(channel)),
+          rank(static_cast<int16_t>(rank)),
+          bankgroup(static_cast<int16_t>(bankgroup)),
+          bank(static_cast<int16_t>(bank)) {}
+    int32_t row;
+    int16_t column;
+    int16_t channel;
+    int16_t rank;
+    int16_t bankgroup;
+    int16_t bank;
 };
 
 inline uint32_t ModuloWidth(uint64_t addr, uint32_t bit_width, uint32_t pos) {
@@ -51,7 +48,7 @@ int LogBase2(int power_of_two);
 void AbruptExit(const std::string& file, int line);
 bool DirExist(std::string dir);
 
-enum class CommandType {
+enum class CommandType : uint8_t {
     READ,
     READ_PRECHARGE,
     WRITE,
@@ -59,22 +56,32 @@ enum class CommandType {
     ACTIVATE,
     PRECHARGE,
     REFRESH_BANK,
+    REFRESH_SAME_BANK,
     REFRESH,
+    RFM,
+    PD_ENTER,
+    PD_EXIT,
     SREF_ENTER,
     SREF_EXIT,
     SIZE
 };
 
+// lower case name as used in the command traces, e.g. "activate"
+std::string CommandTypeString(CommandType cmd_type);
+
+// commands are copied in and out of the queues all the time, so they are
+// kept trivially copyable and within 32 bytes
 struct Command {
-    Command() : cmd_type(CommandType::SIZE), hex_addr(0) {}
+    Command() : hex_addr(0), cmd_type(CommandType::SIZE), qos_class(0) {}
     Command(CommandType cmd_type, const Address& addr, uint64_t hex_addr)
-        : cmd_type(cmd_type), addr(addr), hex_addr(hex_addr) {}
-    // Command(const Command& cmd) {}
+        : hex_addr(hex_addr), addr(addr), cmd_type(cmd_type), qos_class(0) {}
 
     bool IsValid() const { return cmd_type != CommandType::SIZE; }
     bool IsRefresh() const {
         return cmd_type == CommandType::REFRESH ||
-               cmd_type == CommandType::REFRESH_BANK;
+               cmd_type == CommandType::REFRESH_BANK ||
+               cmd_type == CommandType::REFRESH_SAME_BANK ||
+               cmd_type == CommandType::RFM;
     }
     bool IsRead() const {
         return cmd_type == CommandType::READ ||
@@ -85,14 +92,21 @@ struct Command {
                cmd_type == CommandType ::WRITE_PRECHARGE;
     }
     bool IsReadWrite() const { return IsRead() || IsWrite(); }
+    // DDR5 REFsb goes to the same bank of every bankgroup in a rank
+    bool IsSameBankCMD() const {
+        return cmd_type == CommandType::REFRESH_SAME_BANK;
+    }
     bool IsRankCMD() const {
         return cmd_type == CommandType::REFRESH ||
+               cmd_type == CommandType::PD_ENTER ||
+               cmd_type == CommandType::PD_EXIT ||
                cmd_type == CommandType::SREF_ENTER ||
                cmd_type == CommandType::SREF_EXIT;
     }
-    CommandType cmd_type;
-    Address addr;
     uint64_t hex_addr;
+    Address addr;
+    CommandType cmd_type;
+    uint8_t qos_class;
 
     int Channel() const { return addr.channel; }
     int Rank() const { return addr.rank; }
@@ -105,28 +119,38 @@ struct Command {
 };
 
 struct Transaction {
-    Transaction() {}
-    Transaction(uint64_t addr, bool is_write, bool priority = false)
+    Transaction()
+        : addr(0),
+          added_cycle(0),
+          complete_cycle(0),
+          is_write(false),
+          priority(false),
+          qos_class(0) {}
+    Transaction(uint64_t addr, bool is_write, bool priority = false,
+                int qos_class = 0)
         : addr(addr),
           added_cycle(0),
           complete_cycle(0),
           is_write(is_write),
-          priority(priority) {}
-    Transaction(const Transaction& tran)
-        : addr(tran.addr),
-          added_cycle(tran.added_cycle),
-          complete_cycle(tran.complete_cycle),
-          is_write(tran.is_write),
-          priority(tran.priority) {}
+          priority(priority),
+          qos_class(qos_class) {}
     uint64_t addr;
     uint64_t added_cycle;
     uint64_t complete_cycle;
+    // decoded once when the transaction reaches the controller
+    Address dram_addr;
     bool is_write;
     bool priority;
+    int qos_class;
 
     friend std::ostream& operator<<(std::ostream& os, const Transaction& trans);
     friend std::istream& operator>>(std::istream& is, Transaction& trans);
 };
 
+static_assert(sizeof(Address) == 16, "Address should pack into 16 bytes");
+static_assert(std::is_trivially_copyable<Command>::value &&
+                  std::is_trivially_copyable<Transaction>::value,
+              "Commands and transactions are copied around by value");
+
 }  // namespace dramsim3
 #endif
@@ -1,7 +1,9 @@
 #include "configuration.h"
 
+#include <algorithm>
 #include <iostream>
 #include <bitset>
+#include <limits>
 #include <vector>
 
 #ifdef THERMAL
@@ -26,6 +28,9 @@ Config::Config(std::string config_file, std::string out_dir)
     InitTimingParams();
     InitPowerParams();
     InitOtherParams();
+    InitTraceParams();
+    InitQoSParams();
+    InitRowHammerParams();
 #ifdef THERMAL
     InitThermalParams();
 #endif  // THERMAL
@@ -34,13 +39,24 @@ Config::Config(std::string config_file, std::string out_dir)
 
 Address Config::AddressMapping(uint64_t hex_addr) const {
     hex_addr >>= shift_bits;
-    int channel = (hex_addr >> ch_pos) & ch_mask;
-    int rank = (hex_addr >> ra_pos) & ra_mask;
-    int bg = (hex_addr >> bg_pos) & bg_mask;
-    int ba = (hex_addr >> ba_pos) & ba_mask;
-    int ro = (hex_addr >> ro_pos) & ro_mask;
-    int co = (hex_addr >> co_pos) & co_mask;
-    return Address(channel, rank, bg, ba, ro, co);
+    int fields[static_cast<int>(AddressField::SIZE)] = {0};
+    for (const auto& op : map_ops) {
+        fields[op.field] ^=
+            static_cast<int>(((hex_addr >> op.shift) & op.mask) << op.dst);
+    }
+    return Address(fields[0], fields[1], fields[2], fields[3], fields[4],
+                   fields[5]);
+}
+
+int Config::AddressMapping(uint64_t hex_addr, AddressField field) const {
+    hex_addr >>= shift_bits;
+    int idx = static_cast<int>(field);
+    int value = 0;
+    for (int i = map_field_start[idx]; i < map_field_start[idx + 1]; i++) {
+        const auto& op = map_ops[i];
+        value ^= static_cast<int>(((hex_addr >> op.shift) & op.mask) << op.dst);
+    }
+    return value;
 }
 
 void Config::CalculateSize() {
@@ -79,10 +95,12 @@ void Config::CalculateSize() {
 DRAMProtocol Config::GetDRAMProtocol(std::string protocol_str) {
     std::map<std::string, DRAMProtocol> protocol_pairs = {
         {"DDR3", DRAMProtocol::DDR3},     {"DDR4", DRAMProtocol::DDR4},
+        {"DDR5", DRAMProtocol::DDR5},
         {"GDDR5", DRAMProtocol::GDDR5},   {"GDDR5X", DRAMProtocol::GDDR5X},  {"GDDR6", DRAMProtocol::GDDR6},
         {"LPDDR", DRAMProtocol::LPDDR},   {"LPDDR3", DRAMProtocol::LPDDR3},
-        {"LPDDR4", DRAMProtocol::LPDDR4}, {"HBM", DRAMProtocol::HBM},
-        {"HBM2", DRAMProtocol::HBM2},     {"HMC", DRAMProtocol::HMC}};
+        {"LPDDR4", DRAMProtocol::LPDDR4}, {"LPDDR5", DRAMProtocol::LPDDR5},
+        {"HBM", DRAMProtocol::HBM},       {"HBM2", DRAMProtocol::HBM2},
+        {"HBM3", DRAMProtocol::HBM3},     {"HMC", DRAMProtocol::HMC}};
 
     if (protocol_pairs.find(protocol_str) == protocol_pairs.end()) {
         std::cout << "Unkwown/Unsupported DRAM Protocol: " << protocol_str
@@ -98,6 +116,47 @@ int Config::GetInteger(const std::string& sec, const std::string& opt,
     return static_cast<int>(reader_->GetInteger(sec, opt, default_val));
 }
 
+std::vector<bool> Config::GetIndexMask(const std::string& sec,
+                                       const std::string& opt,
+                                       int len) const {
+    // comma separated indices to select, all of them when left empty
+    std::string values = reader_->Get(sec, opt, "");
+    if (values.empty()) {
+        return std::vector<bool>(len, true);
+    }
+    std::vector<bool> mask(len, false);
+    for (const auto& val : StringSplit(values, ',')) {
+        int i = std::stoi(val);
+        if (i < 0 || i >= len) {
+            std::cerr << sec << "." << opt << " index " << i
+                      << " out of range" << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+        mask[i] = true;
+    }
+    return mask;
+}
+
+std::vector<double> Config::GetRealList(const std::string& sec,
+                                        const std::string& opt, int len,
+                                        double default_val) const {
+    // comma separated values, one for each of the len entries
+    std::string values = reader_->Get(sec, opt, "");
+    if (values.empty()) {
+        return std::vector<double>(len, default_val);
+    }
+    std::vector<double> list;
+    for (const auto& val : StringSplit(values, ',')) {
+        list.push_back(std::stod(val));
+    }
+    if (static_cast<int>(list.size()) != len) {
+        std::cerr << sec << "." << opt << " needs " << len << " values"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    return list;
+}
+
 void Config::InitDRAMParams() {
     const auto& reader = *reader_;
     protocol =
@@ -117,21 +176,65 @@ void Config::InitDRAMParams() {
     device_width = GetInteger("dram_structure", "device_width", 8);
     BL = GetInteger("dram_structure", "BL", 8);
     num_dies = GetInteger("dram_structure", "num_dies", 1);
-    // HBM specific parameters
-    enable_hbm_dual_cmd =
-        reader.GetBoolean("dram_structure", "hbm_dual_cmd", true);
-    enable_hbm_dual_cmd &= IsHBM();  // Make sure only HBM enables this
+    // the system section describes DIMMs (or HBM channels), split them into
+    // subchannels (or pseudo channels)
+    if (IsHBM()) {
+        subchannels = GetInteger("dram_structure", "pseudo_channels",
+                                 protocol == DRAMProtocol::HBM3 ? 2 : 1);
+    } else {
+        subchannels =
+            GetInteger("dram_structure", "subchannels", IsDDR5() ? 2 : 1);
+    }
+    if (subchannels < 1 || bus_width % subchannels != 0 ||
+        channel_size % subchannels != 0) {
+        std::cerr << "Cannot split a " << bus_width << " bit channel into "
+                  << subchannels << " subchannels" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    channels *= subchannels;
+    bus_width /= subchannels;
+    channel_size /= subchannels;
+    // only HBM has separate row/column buses by default, hbm_dual_cmd is
+    // the old name of the option
+    enable_dual_cmd = reader.GetBoolean(
+        "dram_structure", "dual_cmd",
+        IsHBM() && reader.GetBoolean("dram_structure", "hbm_dual_cmd", true));
+    wck_ratio = GetInteger("dram_structure", "wck_ratio", 1);
+    if (wck_ratio < 1 || (BL / 2) % wck_ratio != 0) {
+        std::cerr << "BL " << BL << " does not fit wck_ratio " << wck_ratio
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
     // HMC specific parameters
     num_links = GetInteger("hmc", "num_links", 4);
     link_width = GetInteger("hmc", "link_width", 16);
     link_speed = GetInteger("hmc", "link_speed", 15000);  //MHz
     block_size = GetInteger("hmc", "block_size", 64);
     xbar_queue_depth = GetInteger("hmc", "xbar_queue_depth", 16);
+    std::string link_select_str =
+        reader.Get("hmc", "link_select", "round_robin");
+    if (link_select_str == "round_robin") {
+        link_select = HMCLinkSelect::ROUND_ROBIN;
+    } else if (link_select_str == "address") {
+        link_select = HMCLinkSelect::ADDRESS;
+    } else if (link_select_str == "least_loaded") {
+        link_select = HMCLinkSelect::LEAST_LOADED;
+    } else {
+        std::cerr << "Unknown HMC link select " << link_select_str
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    xbar_bandwidth = GetInteger("hmc", "xbar_bandwidth", 2);
+    num_quads = GetInteger("hmc", "num_quads", 4);
     if (IsHMC()) {
         // the BL for HMC is determined by max block_size, which is a multiple
         // of 32B, each "device" transfer 32b per half cycle therefore BL is 8
         // for 32B block size
         BL = block_size * 8 / device_width;
+        if (num_links < 1 || xbar_bandwidth < 1 || num_quads < 1) {
+            std::cerr << "Invalid HMC xbar parameters" << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
     }
     // set burst cycle according to protocol
     // We use burst_cycle for timing and use BL for capacity calculation
@@ -146,7 +249,8 @@ void Config::InitDRAMParams() {
         burst_cycle = (BL == 0) ? 0 : BL / 16;
         BL = (BL == 0 ) ? 8 : BL;
     } else {
-        burst_cycle = (BL == 0) ? 0 : BL / 2;
+        // double data rate on the data clock
+        burst_cycle = (BL == 0) ? 0 : BL / 2 / wck_ratio;
         BL = (BL == 0) ? (IsHBM() ? 4 : 8) : BL;
     }
     // every protocol has a different definition of "column",
@@ -194,6 +298,45 @@ void Config::InitOtherParams() {
     return;
 }
 
+void Config::InitTraceParams() {
+    const auto& reader = *reader_;
+    trace_commands = reader.GetBoolean("trace", "commands", false);
+    trace_transactions = reader.GetBoolean("trace", "transactions", false);
+    trace_file_name = output_prefix + ".trace";
+    trace_start_cycle = reader.GetInteger("trace", "start_cycle", 0);
+    trace_end_cycle = reader.GetInteger("trace", "end_cycle", 0);
+    if (trace_end_cycle == 0) {  // trace till the end
+        trace_end_cycle = std::numeric_limits<uint64_t>::max();
+    }
+    trace_channels = GetIndexMask("trace", "channels", channels);
+    trace_ranks = GetIndexMask("trace", "ranks", ranks);
+
+    // command names as they appear in the trace, e.g. "activate,precharge"
+    int num_types = static_cast<int>(CommandType::SIZE);
+    std::string types = reader.Get("trace", "command_types", "");
+    trace_cmd_types = std::vector<bool>(num_types, types.empty());
+    for (const auto& name : StringSplit(types, ',')) {
+        int i = 0;
+        while (i < num_types &&
+               CommandTypeString(static_cast<CommandType>(i)) != name) {
+            i++;
+        }
+        if (i == num_types) {
+            std::cerr << "Unknown command type to trace: " << name
+                      << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+        trace_cmd_types[i] = true;
+    }
+
+    trace_buffer_records = GetInteger("trace", "buffer_records", 1 << 16);
+    if (trace_buffer_records < 1) {
+        std::cerr << "trace.buffer_records has to be positive" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    return;
+}
+
 void Config::InitPowerParams() {
     const auto& reader = *reader_;
     // Power-related parameters
@@ -201,7 +344,7 @@ void Config::InitPowerParams() {
     double IDD0 = reader.GetReal("power", "IDD0", 48);
     double IDD2P = reader.GetReal("power", "IDD2P", 25);
     double IDD2N = reader.GetReal("power", "IDD2N", 34);
-    // double IDD3P = reader.GetReal("power", "IDD3P", 37);
+    double IDD3P = reader.GetReal("power", "IDD3P", 37);
     double IDD3N = reader.GetReal("power", "IDD3N", 43);
     double IDD4W = reader.GetReal("power", "IDD4W", 123);
     double IDD4R = reader.GetReal("power", "IDD4R", 135);
@@ -220,9 +363,17 @@ void Config::InitPowerParams() {
     write_energy_inc = VDD * (IDD4W - IDD3N) * burst_cycle * devices;
     ref_energy_inc = VDD * (IDD5AB - IDD3N) * tRFC * devices;
     refb_energy_inc = VDD * (IDD5PB - IDD3N) * tRFCb * devices;
+    // REFsb refreshes one bank in every bankgroup
+    refsb_energy_inc =
+        VDD * (IDD5PB - IDD3N) * tRFCsb * devices * bankgroups;
+    // RFM refreshes victim rows back to back, i.e. tRFM / tRC activations
+    rfm_energy_inc = act_energy_inc * tRFM / tRC;
+    // PARA/TRR activate and precharge the two neighbors of the aggressor
+    trr_energy_inc = 2 * act_energy_inc;
     // the following are added per cycle
     act_stb_energy_inc = VDD * IDD3N * devices;
     pre_stb_energy_inc = VDD * IDD2N * devices;
+    act_pd_energy_inc = VDD * IDD3P * devices;
     pre_pd_energy_inc = VDD * IDD2P * devices;
     sref_energy_inc = VDD * IDD6x * devices;
     return;
@@ -242,6 +393,14 @@ void Config::InitSystemParams() {
     enable_dca = reader.GetBoolean("system", "enable_dca", false); 
     low_thres = reader.GetReal("system", "low_thres", 0.5);
     high_thres = reader.GetReal("system", "high_thres", 0.85);
+    // cycles for a read to be served out of the write buffer
+    write_forward_latency = GetInteger("system", "write_forward_latency", 1);
+    if (write_forward_latency < 0) {
+        std::cerr << "write_forward_latency cannot be negative" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    // merge writes to different bytes of the same burst in the write buffer
+    write_coalescing = reader.GetBoolean("system", "write_coalescing", false);
     
     std::string ref_policy =
         reader.Get("system", "refresh_policy", "RANK_LEVEL_STAGGERED");
@@ -251,19 +410,81 @@ void Config::InitSystemParams() {
         refresh_policy = RefreshPolicy::RANK_LEVEL_STAGGERED;
     } else if (ref_policy == "BANK_LEVEL_STAGGERED") {
         refresh_policy = RefreshPolicy::BANK_LEVEL_STAGGERED;
+    } else if (ref_policy == "SAME_BANK_STAGGERED") {
+        refresh_policy = RefreshPolicy::SAME_BANK_STAGGERED;
     } else {
         AbruptExit(__FILE__, __LINE__);
     }
+    fgr_mode = GetInteger("system", "fgr_mode", 1);
+    refresh_max_postpone = GetInteger("system", "refresh_max_postpone", 0);
+    refresh_max_pull_in = GetInteger("system", "refresh_max_pull_in", 0);
+    if (refresh_max_postpone < 0 || refresh_max_postpone > 8 ||
+        refresh_max_pull_in < 0 || refresh_max_pull_in > 8) {
+        std::cerr << "Can only postpone or pull in up to 8 refreshes"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
 
     enable_self_refresh =
         reader.GetBoolean("system", "enable_self_refresh", false);
     sref_threshold = GetInteger("system", "sref_threshold", 1000);
+    enable_power_down = reader.GetBoolean("system", "enable_power_down", false);
+    powerdown_threshold = GetInteger("system", "powerdown_threshold", 100);
     aggressive_precharging_enabled =
         reader.GetBoolean("system", "aggressive_precharging_enabled", false);
 
     return;
 }
 
+void Config::InitQoSParams() {
+    qos_classes = GetInteger("qos", "num_classes", 1);
+    if (qos_classes < 1 || qos_classes > 32) {
+        std::cerr << "qos.num_classes must be between 1 and 32" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    qos_window = GetInteger("qos", "window", 1000);
+    qos_weights = GetRealList("qos", "weights", qos_classes, 1.0);
+    for (auto weight : qos_weights) {
+        if (weight <= 0) {
+            std::cerr << "qos.weights must be positive" << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+    }
+    qos_min_bandwidth = GetRealList("qos", "min_bandwidth", qos_classes, 0.0);
+    auto targets = GetRealList("qos", "latency_targets", qos_classes, 0.0);
+    qos_latency_targets.assign(targets.begin(), targets.end());
+    return;
+}
+
+void Config::InitRowHammerParams() {
+    const auto& reader = *reader_;
+    std::string mitigation = reader.Get("row_hammer", "mitigation", "NONE");
+    if (mitigation == "NONE") {
+        row_hammer_mitigation = RowHammerMitigation::NONE;
+    } else if (mitigation == "PARA") {
+        row_hammer_mitigation = RowHammerMitigation::PARA;
+    } else if (mitigation == "TRR") {
+        row_hammer_mitigation = RowHammerMitigation::TRR;
+    } else if (mitigation == "RFM") {
+        row_hammer_mitigation = RowHammerMitigation::RFM;
+    } else {
+        std::cerr << "Unknown row hammer mitigation " << mitigation
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    hammer_threshold = GetInteger("row_hammer", "hammer_threshold", 0);
+    para_probability = reader.GetReal("row_hammer", "para_probability", 0.001);
+    trr_threshold = GetInteger("row_hammer", "trr_threshold", 1024);
+    trr_table_size = GetInteger("row_hammer", "trr_table_size", 16);
+    rfm_raaimt = GetInteger("row_hammer", "rfm_raaimt", 32);
+    if (para_probability < 0 || para_probability > 1 || trr_threshold < 1 ||
+        trr_table_size < 1 || rfm_raaimt < 1) {
+        std::cerr << "Invalid row hammer parameters" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    return;
+}
+
 #ifdef THERMAL
 void Config::InitThermalParams() {
     std::cout << "InitThermalParams" << std::endl;
@@ -298,14 +519,55 @@ void Config::InitThermalParams() {
 #ifdef DEBUG_OUTPUT
         std::cout << "No Need to Tile Rows\n";
 #endif  // DEBUG_OUTPUT
-        loc_mapping = reader.Get("thermal", "loc_mapping", "");
-        bank_order = GetInteger("thermal", "bank_order", 1);
-        bank_layer_order = GetInteger("thermal", "bank_layer_order", 0);
-        num_row_refresh =
-            static_cast<int>(ceil(rows / (64 * 1e6 / (tREFI * tCK))));
-        chip_dim_x = reader.GetReal("thermal", "chip_dim_x", 0.01);
-        chip_dim_y = reader.GetReal("thermal", "chip_dim_y", 0.01);
-        amb_temp = reader.GetReal("thermal", "amb_temp", 40);
+    }
+    loc_mapping = reader.Get("thermal", "loc_mapping", "");
+    bank_order = GetInteger("thermal", "bank_order", 1);
+    bank_layer_order = GetInteger("thermal", "bank_layer_order", 0);
+    num_row_refresh =
+        static_cast<int>(ceil(rows / (64 * 1e6 / (tREFI * tCK))));
+    chip_dim_x = reader.GetReal("thermal", "chip_dim_x", 0.01);
+    chip_dim_y = reader.GetReal("thermal", "chip_dim_y", 0.01);
+    amb_temp = reader.GetReal("thermal", "amb_temp", 40);
+    temp_aware_refresh =
+        reader.GetBoolean("thermal", "temp_aware_refresh", false);
+    temp_refresh_threshold =
+        reader.GetReal("thermal", "temp_refresh_threshold", 85.0);
+    temp_refresh_scale = GetInteger("thermal", "temp_refresh_scale", 2);
+    if (temp_refresh_scale < 1) {
+        std::cerr << "temp_refresh_scale has to be at least 1" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    async_solve = reader.GetBoolean("thermal", "async_solve", false);
+    thermal_threads = GetInteger("thermal", "threads", 1);
+#ifdef THERMAL_SUPERLU
+    std::string solver = reader.Get("thermal", "solver", "superlu");
+#else
+    std::string solver = reader.Get("thermal", "solver", "pcg");
+#endif  // THERMAL_SUPERLU
+    if (solver == "superlu") {
+#ifndef THERMAL_SUPERLU
+        std::cerr << "Built without SuperLU, use the pcg thermal solver"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+#endif  // THERMAL_SUPERLU
+        thermal_solver = ThermalSolver::SUPERLU;
+    } else if (solver == "pcg") {
+        thermal_solver = ThermalSolver::PCG;
+    } else {
+        std::cerr << "Unknown thermal solver " << solver << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    pcg_tolerance = reader.GetReal("thermal", "pcg_tolerance", 1e-10);
+    if (pcg_tolerance <= 0) {
+        std::cerr << "pcg_tolerance has to be positive" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    // every HBM die holds two channels, pseudo channels sit on the die of
+    // their channel
+    if (IsHBM() && channels / subchannels > 2 * num_dies) {
+        std::cerr << channels / subchannels << " HBM channels do not fit on "
+                  << num_dies << " dies" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
     }
     return;
 }
@@ -322,6 +584,7 @@ void Config::InitTimingParams() {
     CWL = GetInteger("timing", "CWL", 12);
     tCCD_L = GetInteger("timing", "tCCD_L", 6);
     tCCD_S = GetInteger("timing", "tCCD_S", 4);
+    tCCD_L_WR = GetInteger("timing", "tCCD_L_WR", tCCD_L);
     tRTRS = GetInteger("timing", "tRTRS", 2);
     tRTP = GetInteger("timing", "tRTP", 5);
     tWTR_L = GetInteger("timing", "tWTR_L", 5);
@@ -333,12 +596,19 @@ void Config::InitTimingParams() {
     tRAS = GetInteger("timing", "tRAS", 24);
     tRCD = GetInteger("timing", "tRCD", 10);
     tRFC = GetInteger("timing", "tRFC", 74);
+    tRFC2 = GetInteger("timing", "tRFC2", tRFC);
+    tRFC4 = GetInteger("timing", "tRFC4", tRFC2);
     tRC = tRAS + tRP;
     tCKE = GetInteger("timing", "tCKE", 6);
     tCKESR = GetInteger("timing", "tCKESR", 12);
     tXS = GetInteger("timing", "tXS", 432);
     tXP = GetInteger("timing", "tXP", 8);
     tRFCb = GetInteger("timing", "tRFCb", 20);
+    tPBR2PBR = GetInteger("timing", "tPBR2PBR", tRFCb);
+    tRFCsb = GetInteger("timing", "tRFCsb", tRFCb);
+    tREFSBRD = GetInteger("timing", "tREFSBRD", tRRD_L);
+    // by default enough to refresh both neighbors of a row
+    tRFM = GetInteger("timing", "tRFM", 2 * tRC);
     tREFI = GetInteger("timing", "tREFI", 7800);
     tREFIb = GetInteger("timing", "tREFIb", 1950);
     tFAW = GetInteger("timing", "tFAW", 50);
@@ -355,6 +625,25 @@ void Config::InitTimingParams() {
 
     ideal_memory_latency = GetInteger("timing", "ideal_memory_latency", 10);
 
+    // in FGR modes refreshes come 2x/4x as often but each takes less time
+    if (fgr_mode != 1) {
+        // DDR5 only has the 2x mode left
+        if (!((IsDDR4() && (fgr_mode == 2 || fgr_mode == 4)) ||
+              (IsDDR5() && fgr_mode == 2))) {
+            std::cerr << "FGR mode " << fgr_mode << " not supported"
+                      << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+        tRFC = fgr_mode == 2 ? tRFC2 : tRFC4;
+        tREFI /= fgr_mode;
+    }
+
+    if (refresh_policy == RefreshPolicy::SAME_BANK_STAGGERED && !IsDDR5()) {
+        std::cerr << "Same bank refresh is only supported by DDR5"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+
     // calculated timing
     RL = AL + CL;
     WL = AL + CWL;
@@ -368,29 +657,71 @@ void Config::SetAddressMapping() {
     // multiple bytes because of bus width, and burst length
     request_size_bytes = bus_width / 8 * BL;
     shift_bits = LogBase2(request_size_bytes);
-    int col_low_bits = LogBase2(BL);
-    int actual_col_bits = LogBase2(columns) - col_low_bits;
+    SetAddressMapping(address_mapping);
+
+    // the contiguous mapping can be overridden bit by bit in the
+    // [address_mapping] section, every field bit is the XOR of a set of
+    // address bits, e.g. ba = 16:15^19:18 (MSB first)
+    std::vector<std::string> names = {"ch", "ra", "bg", "ba", "ro", "co"};
+    bool use_bit_lists = false;
+    for (const auto& name : names) {
+        if (!reader_->Get("address_mapping", name, "").empty()) {
+            use_bit_lists = true;
+        }
+    }
+    if (use_bit_lists) {
+        auto widths = AddressFieldWidths();
+        std::vector<std::vector<uint64_t> > field_bits(names.size());
+        for (size_t i = 0; i < names.size(); i++) {
+            std::string bits = reader_->Get("address_mapping", names[i], "");
+            if (!ParseBitList(bits, field_bits[i])) {
+                std::cerr << "Invalid bit list address_mapping." << names[i]
+                          << " = " << bits << std::endl;
+                AbruptExit(__FILE__, __LINE__);
+            }
+            if (static_cast<int>(field_bits[i].size()) != widths[i]) {
+                std::cerr << "address_mapping." << names[i] << " needs "
+                          << widths[i] << " bits" << std::endl;
+                AbruptExit(__FILE__, __LINE__);
+            }
+        }
+        if (!CompileAddressMapping(field_bits)) {
+            std::cerr << "Address mapping is not one-to-one" << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+    }
 
-    // has to strictly follow the order of chan, rank, bg, bank, row, col
-    std::map<std::string, int> field_widths;
-    field_widths["ch"] = LogBase2(channels);
-    field_widths["ra"] = LogBase2(ranks);
-    field_widths["bg"] = LogBase2(bankgroups);
-    field_widths["ba"] = LogBase2(banks_per_group);
-    field_widths["ro"] = LogBase2(rows);
-    field_widths["co"] = actual_col_bits;
-
-    if (address_mapping.size() != 12) {
+    for (size_t i = 0; i < names.size(); i++) {
+        uint64_t mask = 0;
+        for (int j = map_field_start[i]; j < map_field_start[i + 1]; j++) {
+            mask |= map_ops[j].mask << map_ops[j].shift;
+        }
+        std::cout << names[i] << "_mask: " << std::bitset<48>(mask << shift_bits)
+                  << std::endl;
+    }
+}
+
+void Config::SetAddressMapping(const std::string& mapping) {
+    if (mapping.size() != 12) {
         std::cerr << "Unknown address mapping (6 fields each 2 chars required)"
                   << std::endl;
         AbruptExit(__FILE__, __LINE__);
     }
+    address_mapping = mapping;
+
+    // has to strictly follow the order of chan, rank, bg, bank, row, col
+    std::vector<std::string> names = {"ch", "ra", "bg", "ba", "ro", "co"};
+    auto widths = AddressFieldWidths();
+    std::map<std::string, int> field_widths;
+    for (size_t i = 0; i < names.size(); i++) {
+        field_widths[names[i]] = widths[i];
+    }
 
     // // get address mapping position fields from config
     // // each field must be 2 chars
     std::vector<std::string> fields;
-    for (size_t i = 0; i < address_mapping.size(); i += 2) {
-        std::string token = address_mapping.substr(i, 2);
+    for (size_t i = 0; i < mapping.size(); i += 2) {
+        std::string token = mapping.substr(i, 2);
         fields.push_back(token);
     }
 
@@ -420,12 +751,125 @@ void Config::SetAddressMapping() {
     ba_mask = (1 << field_widths.at("ba")) - 1;
     ro_mask = (1 << field_widths.at("ro")) - 1;
     co_mask = (1 << field_widths.at("co")) - 1;
-    std::cout << "ch_mask: " << std::bitset<48>(ch_mask << (shift_bits + ch_pos)) << std::endl;
-    std::cout << "ra_mask: " << std::bitset<48>(ra_mask << (shift_bits + ra_pos)) << std::endl;
-    std::cout << "bg_mask: " << std::bitset<48>(bg_mask << (shift_bits + bg_pos)) << std::endl;
-    std::cout << "ba_mask: " << std::bitset<48>(ba_mask << (shift_bits + ba_pos)) << std::endl;
-    std::cout << "ro_mask: " << std::bitset<48>(ro_mask << (shift_bits + ro_pos)) << std::endl;
-    std::cout << "co_mask: " << std::bitset<48>(co_mask << (shift_bits + co_pos)) << std::endl;
+
+    std::vector<std::vector<uint64_t> > field_bits(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        for (int b = 0; b < widths[i]; b++) {
+            field_bits[i].push_back(1ull << (field_pos.at(names[i]) + b));
+        }
+    }
+    CompileAddressMapping(field_bits);
+}
+
+std::vector<int> Config::AddressFieldWidths() const {
+    // in the order of AddressField
+    int col_low_bits = LogBase2(BL);
+    return {LogBase2(channels),        LogBase2(ranks),
+            LogBase2(bankgroups),      LogBase2(banks_per_group),
+            LogBase2(rows),            LogBase2(columns) - col_low_bits};
+}
+
+// reads a bit number, all of s has to be digits
+static bool ParseBit(const std::string& s, int& bit) {
+    if (s.empty() || s.size() > 2 ||
+        s.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    bit = std::stoi(s);
+    return true;
+}
+
+bool Config::ParseBitList(const std::string& bits,
+                          std::vector<uint64_t>& field_bits) const {
+    // terms are separated by '-' from MSB to LSB, each term is a bit or a
+    // hi:lo range, optionally XORed with other ranges of the same length
+    std::vector<uint64_t> msb_first;
+    for (const auto& term : StringSplit(bits, '-')) {
+        std::vector<uint64_t> term_bits;
+        for (const auto& range : StringSplit(term, '^')) {
+            auto colon = range.find(':');
+            int start, end;
+            if (!ParseBit(range.substr(0, colon), start)) {
+                return false;
+            }
+            if (colon == std::string::npos) {
+                end = start;
+            } else if (!ParseBit(range.substr(colon + 1), end)) {
+                return false;
+            }
+            int step = start > end ? -1 : 1;
+            std::vector<uint64_t> range_bits;
+            for (int b = start; b != end + step; b += step) {
+                if (b < shift_bits || b >= 64) {
+                    return false;
+                }
+                range_bits.push_back(1ull << (b - shift_bits));
+            }
+            if (term_bits.empty()) {
+                term_bits = range_bits;
+            } else if (term_bits.size() != range_bits.size()) {
+                return false;
+            } else {
+                for (size_t j = 0; j < term_bits.size(); j++) {
+                    term_bits[j] ^= range_bits[j];
+                }
+            }
+        }
+        msb_first.insert(msb_first.end(), term_bits.begin(), term_bits.end());
+    }
+    field_bits.assign(msb_first.rbegin(), msb_first.rend());
+    return true;
+}
+
+bool Config::CompileAddressMapping(
+    const std::vector<std::vector<uint64_t> >& field_bits) {
+    // the mapping has to be one-to-one, i.e. the field bits have to be
+    // linearly independent over GF(2)
+    std::vector<uint64_t> basis;
+    for (const auto& bits : field_bits) {
+        for (auto mask : bits) {
+            for (auto b : basis) {
+                mask = std::min(mask, mask ^ b);
+            }
+            if (mask == 0) {
+                return false;
+            }
+            basis.push_back(mask);
+            std::sort(basis.rbegin(), basis.rend());
+        }
+    }
+
+    // (source bit, field bit) pairs with the same distance that are
+    // consecutive collapse into one shift and mask step
+    map_ops.clear();
+    map_field_start.assign(1, 0);
+    for (size_t i = 0; i < field_bits.size(); i++) {
+        std::vector<std::pair<int, int> > pairs;
+        for (size_t d = 0; d < field_bits[i].size(); d++) {
+            for (int src = 0; src < 64; src++) {
+                if ((field_bits[i][d] >> src) & 1) {
+                    pairs.emplace_back(src - static_cast<int>(d), static_cast<int>(d));
+                }
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+        for (size_t j = 0; j < pairs.size();) {
+            size_t k = j + 1;
+            while (k < pairs.size() && pairs[k].first == pairs[j].first &&
+                   pairs[k].second == pairs[k - 1].second + 1) {
+                k++;
+            }
+            AddressMapOp op;
+            op.field = static_cast<int>(i);
+            op.dst = pairs[j].second;
+            op.shift = pairs[j].first + op.dst;
+            op.mask = (1ull << (k - j)) - 1;
+            map_ops.push_back(op);
+            j = k;
+        }
+        map_field_start.push_back(static_cast<int>(map_ops.size()));
+    }
+    return true;
 }
 
 }  // namespace dramsim3
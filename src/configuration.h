@@ -3,6 +3,7 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 #include "common.h"
 
 #include "INIReader.h"
@@ -12,14 +13,17 @@ namespace dramsim3 {
 enum class DRAMProtocol {
     DDR3,
     DDR4,
+    DDR5,
     GDDR5,
     GDDR5X,
     GDDR6,
     LPDDR,
     LPDDR3,
     LPDDR4,
+    LPDDR5,
     HBM,
     HBM2,
+    HBM3,
     HMC,
     SIZE
 };
@@ -28,13 +32,49 @@ enum class RefreshPolicy {
     RANK_LEVEL_SIMULTANEOUS,  // impractical due to high power requirement
     RANK_LEVEL_STAGGERED,
     BANK_LEVEL_STAGGERED,
+    SAME_BANK_STAGGERED,  // DDR5 REFsb, same bank in all bankgroups
     SIZE 
 };
 
+enum class RowHammerMitigation {
+    NONE,
+    PARA,  // probabilistic adjacent row activation
+    TRR,   // counter based target row refresh
+    RFM,   // DDR5 refresh management
+    SIZE
+};
+
+// direct LU solves or preconditioned conjugate gradient, see thermal_solver.c
+enum class ThermalSolver { SUPERLU, PCG };
+
+enum class HMCLinkSelect { ROUND_ROBIN, ADDRESS, LEAST_LOADED };
+
+enum class AddressField { CHANNEL, RANK, BANKGROUP, BANK, ROW, COLUMN, SIZE };
+
+// one step of the address mapping program: a slice of the (request aligned)
+// address is masked and XORed into a field, contiguous fields take a single
+// step and every extra hash term adds one
+struct AddressMapOp {
+    int field;
+    int shift;
+    uint64_t mask;
+    int dst;
+};
+
 class Config {
    public:
     Config(std::string config_file, std::string out_dir);
     Address AddressMapping(uint64_t hex_addr) const;
+    int AddressMapping(uint64_t hex_addr, AddressField field) const;
+    // switch to another contiguous mapping, e.g. to evaluate candidates
+    void SetAddressMapping(const std::string& mapping);
+    // parses an [address_mapping] bit list into the address bits (above
+    // shift_bits) XORed into each field bit, LSB first, false if malformed
+    bool ParseBitList(const std::string& bits,
+                      std::vector<uint64_t>& field_bits) const;
+    // switch to a bit list mapping, false if it is not one-to-one
+    bool CompileAddressMapping(
+        const std::vector<std::vector<uint64_t> >& field_bits);
     // DRAM physical structure
     DRAMProtocol protocol;
     int channel_size;
@@ -49,11 +89,20 @@ class Config {
     int bus_width;
     int devices_per_rank;
     int BL;
+    // DDR5 DIMMs have two independent subchannels and HBM channels can be
+    // split into pseudo channels, each one is simulated as a channel
+    int subchannels;
+    // LPDDR5 WCK and HBM3 WDQS run the data bus faster than the command clock
+    int wck_ratio;
 
-    // Address mapping numbers
+    // Address mapping numbers, the pos/mask pairs describe the contiguous
+    // address_mapping string, map_ops is what is actually evaluated
     int shift_bits;
     int ch_pos, ra_pos, bg_pos, ba_pos, ro_pos, co_pos;
     uint64_t ch_mask, ra_mask, bg_mask, ba_mask, ro_mask, co_mask;
+    std::vector<AddressMapOp> map_ops;
+    // ops of field i are map_ops[map_field_start[i], map_field_start[i + 1])
+    std::vector<int> map_field_start;
 
     // Generic DRAM timing parameters
     double tCK;
@@ -65,6 +114,7 @@ class Config {
     int WL;
     int tCCD_L;
     int tCCD_S;
+    int tCCD_L_WR;  // DDR5 write to write same bankgroup
     int tRTRS;
     int tRTP;
     int tWTR_L;
@@ -76,6 +126,8 @@ class Config {
     int tRAS;
     int tRCD;
     int tRFC;
+    int tRFC2;  // DDR4 fine granularity refresh 2x and 4x modes
+    int tRFC4;
     int tRC;
     // tCKSRE and tCKSRX are only useful for changing clock freq after entering
     // SRE mode we are not doing that, so tCKESR is sufficient
@@ -84,6 +136,10 @@ class Config {
     int tXS;
     int tXP;
     int tRFCb;
+    int tPBR2PBR;  // per bank refresh to per bank refresh of another bank
+    int tRFM;      // refresh of the victim rows of a bank
+    int tRFCsb;    // DDR5 same bank refresh to ACT of the refreshed banks
+    int tREFSBRD;  // DDR5 same bank refresh to ACT/REFsb of other banks
     int tREFI;
     int tREFIb;
     int tFAW;
@@ -92,7 +148,7 @@ class Config {
     int read_delay;
     int write_delay;
 
-    // LPDDR4 and GDDR5
+    // LPDDR4/5, DDR5 and GDDR5
     int tPPD;
     // GDDR5
     int t32AW;
@@ -106,8 +162,12 @@ class Config {
     double write_energy_inc;
     double ref_energy_inc;
     double refb_energy_inc;
+    double rfm_energy_inc;
+    double trr_energy_inc;
+    double refsb_energy_inc;
     double act_stb_energy_inc;
     double pre_stb_energy_inc;
+    double act_pd_energy_inc;
     double pre_pd_energy_inc;
     double sref_energy_inc;
 
@@ -119,23 +179,53 @@ class Config {
     int num_vaults;
     int block_size;  // block size in bytes
     int xbar_queue_depth;
+    HMCLinkSelect link_select;
+    int xbar_bandwidth;  // flits per logic cycle per xbar port
+    int num_quads;
 
     // System
     std::string address_mapping;
     std::string queue_structure;
     std::string row_buf_policy;
     RefreshPolicy refresh_policy;
+    int fgr_mode;  // DDR4 fine granularity refresh: 1x, 2x or 4x
+    // JEDEC allows up to 8 refreshes to be postponed or pulled in
+    int refresh_max_postpone;
+    int refresh_max_pull_in;
     int cmd_queue_size;
     bool unified_queue;
     int trans_queue_size;
     bool enable_dca;
     double low_thres;
     double high_thres;
+    int write_forward_latency;
+    bool write_coalescing;
     bool enable_self_refresh;
     int sref_threshold;
+    // power down a rank after this many cycles without a command to it
+    bool enable_power_down;
+    int powerdown_threshold;
     bool aggressive_precharging_enabled;
-    bool enable_hbm_dual_cmd;
+    // separate row and column command buses, e.g. HBM, so that an ACT/PRE
+    // can be issued in the same cycle as a READ/WRITE
+    bool enable_dual_cmd;
+
+    // QoS classes, class 0 is the default for untagged requests
+    int qos_classes;
+    int qos_window;  // cycles over which bandwidth guarantees are measured
+    std::vector<double> qos_weights;
+    std::vector<double> qos_min_bandwidth;  // GB/s per channel
+    std::vector<int> qos_latency_targets;   // cycles, 0 for no target
 
+    // Row hammer
+    RowHammerMitigation row_hammer_mitigation;
+    // activations of a row within a refresh window that flip bits in its
+    // neighbors, only used for stats, 0 to not track rows at all
+    int hammer_threshold;
+    double para_probability;  // chance to refresh the neighbors on each ACT
+    int trr_threshold;
+    int trr_table_size;  // counters per bank
+    int rfm_raaimt;      // rolling accumulated ACTs that trigger an RFM
 
     int epoch_period;
     int output_level;
@@ -145,6 +235,17 @@ class Config {
     std::string json_epoch_name;
     std::string txt_stats_name;
 
+    // runtime tracing into a binary file, see tracer.h
+    bool trace_commands;
+    bool trace_transactions;
+    std::string trace_file_name;
+    uint64_t trace_start_cycle;
+    uint64_t trace_end_cycle;
+    std::vector<bool> trace_channels;
+    std::vector<bool> trace_ranks;
+    std::vector<bool> trace_cmd_types;
+    int trace_buffer_records;  // records per buffer handed to the writer
+
     // Computed parameters
     int request_size_bytes;
 
@@ -155,11 +256,19 @@ class Config {
     }
     bool IsHBM() const {
         return (protocol == DRAMProtocol::HBM ||
-                protocol == DRAMProtocol::HBM2);
+                protocol == DRAMProtocol::HBM2 ||
+                protocol == DRAMProtocol::HBM3);
+    }
+    bool IsLPDDR() const {
+        return (protocol == DRAMProtocol::LPDDR ||
+                protocol == DRAMProtocol::LPDDR3 ||
+                protocol == DRAMProtocol::LPDDR4 ||
+                protocol == DRAMProtocol::LPDDR5);
     }
     bool IsHMC() const { return (protocol == DRAMProtocol::HMC); }
     // yzy: add another function
     bool IsDDR4() const { return (protocol == DRAMProtocol::DDR4); }
+    bool IsDDR5() const { return (protocol == DRAMProtocol::DDR5); }
 
     int ideal_memory_latency;
 
@@ -182,6 +291,16 @@ class Config {
     int row_tile;
     int tile_row_num;
     double bank_asr;  // the aspect ratio of a bank: #row_bits / #col_bits
+    // refresh ranks above the extended temperature threshold more often
+    bool temp_aware_refresh;
+    double temp_refresh_threshold;  // [C]
+    int temp_refresh_scale;
+    // solve the epoch temperatures while the simulation goes on, they are
+    // reported (and used by temp_aware_refresh) one epoch later
+    bool async_solve;
+    int thermal_threads;  // threads solving the cases of an epoch
+    ThermalSolver thermal_solver;
+    double pcg_tolerance;  // relative residual the pcg solver stops at
 #endif  // THERMAL
 
    private:
@@ -190,15 +309,24 @@ class Config {
     DRAMProtocol GetDRAMProtocol(std::string protocol_str);
     int GetInteger(const std::string& sec, const std::string& opt,
                    int default_val) const;
+    std::vector<double> GetRealList(const std::string& sec,
+                                    const std::string& opt, int len,
+                                    double default_val) const;
+    std::vector<bool> GetIndexMask(const std::string& sec,
+                                   const std::string& opt, int len) const;
     void InitDRAMParams();
     void InitOtherParams();
     void InitPowerParams();
+    void InitQoSParams();
+    void InitRowHammerParams();
     void InitSystemParams();
+    void InitTraceParams();
 #ifdef THERMAL
     void InitThermalParams();
 #endif  // THERMAL
     void InitTimingParams();
     void SetAddressMapping();
+    std::vector<int> AddressFieldWidths() const;
 };
 
 }  // namespace dramsim3
@@ -1,4 +1,5 @@
 #include "controller.h"
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <limits>
@@ -7,17 +8,20 @@ namespace dramsim3 {
 
 #ifdef THERMAL
 Controller::Controller(int channel, const Config &config, const Timing &timing,
-                       ThermalCalculator &thermal_calc)
+                       Tracer &tracer, ThermalCalculator &thermal_calc)
 #else
-Controller::Controller(int channel, const Config &config, const Timing &timing)
+Controller::Controller(int channel, const Config &config, const Timing &timing,
+                       Tracer &tracer)
 #endif  // THERMAL
     : channel_id_(channel),
       clk_(0),
       config_(config),
       simple_stats_(config_, channel_id_),
-      channel_state_(config, timing),
+      channel_state_(config, timing, simple_stats_),
       cmd_queue_(channel_id_, config, channel_state_, simple_stats_),
-      refresh_(config, channel_state_),
+      refresh_(config, channel_state_, cmd_queue_, simple_stats_),
+      qos_(config, simple_stats_),
+      tracer_(tracer),
 #ifdef THERMAL
       thermal_calc_(thermal_calc),
 #endif  // THERMAL
@@ -25,10 +29,15 @@ Controller::Controller(int channel, const Config &config, const Timing &timing)
       enable_dca_(config.enable_dca),
       low_thres_(config.low_thres),
       high_thres_(config.high_thres),
+      write_forward_latency_(config.write_forward_latency),
+      write_coalescing_(config.write_coalescing),
       row_buf_policy_(config.row_buf_policy == "CLOSE_PAGE"
                           ? RowBufPolicy::CLOSE_PAGE
                           : RowBufPolicy::OPEN_PAGE),
+      aggressive_precharging_(config.aggressive_precharging_enabled),
       last_trans_clk_(0),
+      last_stats_clk_(0),
+      rank_last_cmd_clk_(config.ranks, 0),
       write_draining_(0) {
     if (is_unified_queue_) {
         unified_queue_.reserve(config_.trans_queue_size);
@@ -36,13 +45,6 @@ Controller::Controller(int channel, const Config &config, const Timing &timing)
         read_queue_.reserve(config_.trans_queue_size);
         write_buffer_.reserve(config_.trans_queue_size);
     }
-
-#ifdef CMD_TRACE
-    std::string trace_file_name = config_.output_prefix + "ch_" +
-                                  std::to_string(channel_id_) + "cmd.trace";
-    std::cout << "Command Trace write to " << trace_file_name << std::endl;
-    cmd_trace_.open(trace_file_name, std::ofstream::out);
-#endif  // CMD_TRACE
 }
 
 std::pair<uint64_t, int> Controller::ReturnDoneTrans(uint64_t clk) {
@@ -55,6 +57,9 @@ std::pair<uint64_t, int> Controller::ReturnDoneTrans(uint64_t clk) {
                 simple_stats_.Increment("num_reads_done");
                 simple_stats_.AddValue("read_latency", clk_ - it->added_cycle);
             }
+            if (qos_.IsEnabled()) {
+                qos_.TransDone(*it, clk_);
+            }
             auto pair = std::make_pair(it->addr, it->is_write);
             it = return_queue_.erase(it);
             return pair;
@@ -75,6 +80,11 @@ void Controller::ClockTick() {
         cmd = cmd_queue_.FinishRefresh();
     }
 
+    // classes behind their latency or bandwidth targets go first
+    if (!cmd.IsValid() && qos_.UrgentMask() != 0) {
+        cmd = cmd_queue_.GetCommandToIssue(qos_.UrgentMask());
+    }
+
     // cannot find a refresh related command or there's no refresh
     if (!cmd.IsValid()) {
         cmd = cmd_queue_.GetCommandToIssue();
@@ -84,64 +94,59 @@ void Controller::ClockTick() {
         IssueCommand(cmd);
         cmd_issued = true;
 
-        if (config_.enable_hbm_dual_cmd) {
-            auto second_cmd = cmd_queue_.GetCommandToIssue();
+        // the other command bus is still free in this cycle
+        if (config_.enable_dual_cmd) {
+            auto bus = cmd.IsReadWrite() ? CommandBus::ROW : CommandBus::COLUMN;
+            auto second_cmd = cmd_queue_.GetCommandToIssue(~0u, bus);
             if (second_cmd.IsValid()) {
-                if (second_cmd.IsReadWrite() != cmd.IsReadWrite()) {
-                    IssueCommand(second_cmd);
-                    simple_stats_.Increment("hbm_dual_cmds");
-                } else {
-#ifdef DEBUG_GEM5
-                    std::cout << channel_id_ << ", hbm_dual_cmd fail, addr = " << std::hex << second_cmd.hex_addr << std::endl;
-#endif
-                    exit(1);
-                }
+                IssueCommand(second_cmd);
+                simple_stats_.Increment("dual_cmds");
+                simple_stats_.Increment("hbm_dual_cmds");
             }
         }
     }
 
-    // power updates pt 1
-    for (int i = 0; i < config_.ranks; i++) {
-        if (channel_state_.IsRankSelfRefreshing(i)) {
-            simple_stats_.IncrementVec("sref_cycles", i);
-        } else {
-            bool all_idle = channel_state_.IsAllBankIdleInRank(i);
-            if (all_idle) {
-                simple_stats_.IncrementVec("all_bank_idle_cycles", i);
-                channel_state_.rank_idle_cycles[i] += 1;
-            } else {
-                simple_stats_.IncrementVec("rank_active_cycles", i);
-                // reset
-                channel_state_.rank_idle_cycles[i] = 0;
-            }
+    // close rows without pending hits while the command bus is idle
+    if (!cmd_issued && aggressive_precharging_ &&
+        row_buf_policy_ == RowBufPolicy::OPEN_PAGE) {
+        cmd = cmd_queue_.GetAggressivePrecharge();
+        if (cmd.IsValid() && !HasPendingRowHit(cmd)) {
+            IssueCommand(cmd);
+            cmd_issued = true;
+            simple_stats_.Increment("num_aggressive_pres");
         }
     }
 
+    // power updates pt 1: rank state residency is tracked by channel_state_
+    // as the commands change it and added to the stats on output
+
     // power updates pt 2: move idle ranks into self-refresh mode to save power
     if (config_.enable_self_refresh && !cmd_issued) {
         for (auto i = 0; i < config_.ranks; i++) {
             if (channel_state_.IsRankSelfRefreshing(i)) {
                 // wake up!
-                if (!cmd_queue_.rank_q_empty[i]) {
+                if (!cmd_queue_.RankQueueEmpty(i)) {
                     auto addr = Address();
                     addr.rank = i;
                     auto cmd = Command(CommandType::SREF_EXIT, addr, -1);
                     cmd = channel_state_.GetReadyCommand(cmd, clk_);
                     if (cmd.IsValid()) {
                         IssueCommand(cmd);
+                        cmd_issued = true;
                         break;
                     }
                 }
             } else {
-                if (cmd_queue_.rank_q_empty[i] &&
-                    channel_state_.rank_idle_cycles[i] >=
-                        config_.sref_threshold) {
+                if (cmd_queue_.RankQueueEmpty(i) &&
+                    channel_state_.RankIdleCycles(i, clk_) >=
+                        static_cast<uint64_t>(config_.sref_threshold)) {
                     auto addr = Address();
                     addr.rank = i;
                     auto cmd = Command(CommandType::SREF_ENTER, addr, -1);
                     cmd = channel_state_.GetReadyCommand(cmd, clk_);
                     if (cmd.IsValid()) {
                         IssueCommand(cmd);
+                        cmd_issued = true;
                         break;
                     }
                 }
@@ -149,10 +154,38 @@ void Controller::ClockTick() {
         }
     }
 
+    // power updates pt 3: power down ranks that have not seen a command
+    // for a while, the command queue wakes them up with PD_EXIT on demand
+    if (config_.enable_power_down && !cmd_issued &&
+        !channel_state_.IsRefreshWaiting()) {
+        for (auto i = 0; i < config_.ranks; i++) {
+            if (channel_state_.IsRankSelfRefreshing(i) ||
+                channel_state_.IsRankPoweredDown(i) ||
+                !cmd_queue_.RankQueueEmpty(i) ||
+                clk_ - rank_last_cmd_clk_[i] <
+                    static_cast<uint64_t>(config_.powerdown_threshold)) {
+                continue;
+            }
+            // leave the rank to self-refresh if it is due
+            if (config_.enable_self_refresh &&
+                channel_state_.RankIdleCycles(i, clk_) >=
+                    static_cast<uint64_t>(config_.sref_threshold)) {
+                continue;
+            }
+            auto addr = Address();
+            addr.rank = i;
+            auto cmd = Command(CommandType::PD_ENTER, addr, -1);
+            cmd = channel_state_.GetReadyCommand(cmd, clk_);
+            if (cmd.IsValid()) {
+                IssueCommand(cmd);
+                break;
+            }
+        }
+    }
+
     ScheduleTransaction();
     clk_++;
     cmd_queue_.ClockTick();
-    simple_stats_.Increment("num_cycles");
     return;
 }
 
@@ -167,34 +200,70 @@ bool Controller::WillAcceptTransaction(uint64_t hex_addr, bool is_write) const {
 }
 
 bool Controller::AddTransaction(Transaction trans) {
+    if (trans.qos_class < 0 || trans.qos_class >= config_.qos_classes) {
+        std::cerr << "Invalid QoS class " << trans.qos_class << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
     trans.added_cycle = clk_;
+    // JEDEC systems decode on the way in to find the channel, HMC vaults
+    // hand over undecoded transactions
+    if (trans.dram_addr.channel == -1) {
+        trans.dram_addr = config_.AddressMapping(trans.addr);
+    }
+    if (tracer_.IsEnabled()) {
+        tracer_.RecordTransaction(trans, channel_id_, clk_);
+    }
     simple_stats_.AddValue("interarrival_latency", clk_ - last_trans_clk_);
     last_trans_clk_ = clk_;
 
     if (trans.is_write) {
-        if (pending_wr_q_.count(trans.addr) == 0) {  // can not merge writes
-            pending_wr_q_.insert(std::make_pair(trans.addr, trans));
+        auto wr_it = pending_wr_q_.find(WriteBufferKey(trans.addr));
+        if (wr_it == pending_wr_q_.end()) {  // can not merge writes
+            pending_wr_q_.insert(
+                std::make_pair(WriteBufferKey(trans.addr), trans));
+            if (qos_.IsEnabled()) {
+                qos_.TransQueued(trans);
+            }
             if (is_unified_queue_) {
                 unified_queue_.push_back(trans);
             } else {
                 write_buffer_.push_back(trans);
             }
+        } else if (wr_it->second.addr == trans.addr) {
+            // overwrites the buffered data, nothing new goes to DRAM
+            simple_stats_.Increment("num_dropped_writes");
+        } else {
+            // different bytes of the same burst, merged into one write
+            simple_stats_.Increment("num_coalesced_writes");
         }
         trans.complete_cycle = clk_ + 1;
         return_queue_.push_back(trans);
         return true;
     } else {  // read
         // if in write buffer, use the write buffer value
-        if (pending_wr_q_.count(trans.addr) > 0) {
-            trans.complete_cycle = clk_ + 1;
-            return_queue_.push_back(trans);
-            return true;
+        auto wr_it = pending_wr_q_.find(WriteBufferKey(trans.addr));
+        if (wr_it != pending_wr_q_.end()) {
+            if (wr_it->second.addr == trans.addr) {
+                simple_stats_.Increment("num_write_buf_hits");
+                trans.complete_cycle = clk_ + write_forward_latency_;
+                return_queue_.push_back(trans);
+                return true;
+            }
+            // only part of the burst is buffered, the rest has to come
+            // from DRAM so the read goes through the normal path
+            simple_stats_.Increment("num_write_buf_partial_hits");
         }
         pending_rd_q_.insert(std::make_pair(trans.addr, trans));
+        if (qos_.IsEnabled()) {
+            qos_.ReadPending(trans);
+        }
 #ifdef DEBUG_GEM5
         std::cout << channel_id_ << ", insert to pending_rd_q, addr = %x" << std::hex << trans.addr << std::endl;
 #endif
         if (pending_rd_q_.count(trans.addr) == 1) {
+            if (qos_.IsEnabled()) {
+                qos_.TransQueued(trans);
+            }
             if (is_unified_queue_) {
                 unified_queue_.push_back(trans);
             } else {
@@ -222,56 +291,81 @@ void Controller::ScheduleTransaction() {
             write_draining_ = write_buffer_.size();
         }
     }
+    // reads that missed their QoS latency target cut the write drain short
+    // unless the write buffer is full
+    if (write_draining_ > 0 && qos_.HasLateReads() &&
+        write_buffer_.size() < write_buffer_.capacity()) {
+        write_draining_ = 0;
+    }
 
     std::vector<Transaction> &queue =
         is_unified_queue_ ? unified_queue_
                           : write_draining_ > 0 ? write_buffer_ : read_queue_;
-    for (auto it = queue.begin(); it != queue.end(); it++) {
-        if (!enable_dca_ || it->priority) {
-            auto cmd = TransToCommand(*it);
-            if (cmd_queue_.WillAcceptCommand(cmd.Rank(), cmd.Bankgroup(),
-                                             cmd.Bank())) {
-                if (!is_unified_queue_ && cmd.IsWrite()) {
-                    // Enforce R->W dependency
-                    if (pending_rd_q_.count(it->addr) > 0) {
-                        write_draining_ = 0;
-                        ScheduleReadTransaction();
-                        return;
-                    }
-                    write_draining_ -= 1;
-                }
-#ifdef DEBUG_GEM5
-                std::cout << channel_id_ << ", schedule addr = " << std::hex << it->addr << "isWrite = " << cmd.IsWrite() << std::endl;
-#endif
-                cmd_queue_.AddCommand(cmd);
-                queue.erase(it);
+    if (qos_.IsEnabled()) {
+        qos_.Update(is_unified_queue_ || write_draining_ == 0,
+                    is_unified_queue_ || write_draining_ > 0, clk_);
+        // DCA priority accesses go first within their class
+        for (auto qos_class : qos_.ClassOrder()) {
+            if ((enable_dca_ &&
+                 ScheduleTransactionFrom(queue, true, qos_class)) ||
+                ScheduleTransactionFrom(queue, false, qos_class)) {
                 return;
             }
         }
+        return;
     }
 
+    if (enable_dca_ && ScheduleTransactionFrom(queue, true, -1)) {
+        return;
+    }
     /** if there is no priority read access.. */
+    ScheduleTransactionFrom(queue, false, -1);
+}
+
+bool Controller::ScheduleTransactionFrom(std::vector<Transaction> &queue,
+                                         bool priority_only, int qos_class) {
+    // qos_class of -1 matches any class, returns true if the scheduling
+    // for this cycle is done
     for (auto it = queue.begin(); it != queue.end(); it++) {
+        if ((priority_only && !it->priority) ||
+            (qos_class >= 0 && it->qos_class != qos_class)) {
+            continue;
+        }
         auto cmd = TransToCommand(*it);
         if (cmd_queue_.WillAcceptCommand(cmd.Rank(), cmd.Bankgroup(),
                                          cmd.Bank())) {
             if (!is_unified_queue_ && cmd.IsWrite()) {
                 // Enforce R->W dependency
-                if (pending_rd_q_.count(it->addr) > 0) {
+                if (IsReadPending(it->addr)) {
                     write_draining_ = 0;
                     ScheduleReadTransaction();
-                    return;
+                    return true;
                 }
                 write_draining_ -= 1;
             }
 #ifdef DEBUG_GEM5
             std::cout << channel_id_ << ", schedule addr = " << std::hex << it->addr << "isWrite = " << cmd.IsWrite() << std::endl;
 #endif
+            if (qos_.IsEnabled()) {
+                qos_.TransScheduled(*it);
+            }
             cmd_queue_.AddCommand(cmd);
             queue.erase(it);
-            return;
+            return true;
         }
     }
+    return false;
+}
+
+bool Controller::IsReadPending(uint64_t hex_addr) const {
+    if (!write_coalescing_) {
+        return pending_rd_q_.count(hex_addr) > 0;
+    }
+    // a coalesced write covers the whole burst, so does any read that
+    // partially hit it
+    auto it = pending_rd_q_.lower_bound(BurstAddress(hex_addr));
+    return it != pending_rd_q_.end() &&
+           BurstAddress(it->first) == BurstAddress(hex_addr);
 }
 
 void Controller::ScheduleReadTransaction() {
@@ -282,6 +376,9 @@ void Controller::ScheduleReadTransaction() {
 #ifdef DEBUG_GEM5
             std::cout << channel_id_ << ", (ScheduleReadTransaction) schedule read transaction, addr = " << std::hex << it->addr << std::endl;
 #endif
+            if (qos_.IsEnabled()) {
+                qos_.TransScheduled(*it);
+            }
             cmd_queue_.AddCommand(cmd);
             read_queue_.erase(it);
             return;
@@ -293,9 +390,9 @@ void Controller::ScheduleReadTransaction() {
 }
 
 void Controller::IssueCommand(const Command &cmd) {
-#ifdef CMD_TRACE
-    cmd_trace_ << std::left << std::setw(18) << clk_ << " " << cmd << std::endl;
-#endif  // CMD_TRACE
+    if (tracer_.IsEnabled()) {
+        tracer_.RecordCommand(cmd, channel_id_, clk_);
+    }
 #ifdef THERMAL
     // add channel in, only needed by thermal module
     thermal_calc_.UpdateCMDPower(channel_id_, cmd, clk_);
@@ -318,6 +415,9 @@ void Controller::IssueCommand(const Command &cmd) {
             std::cout << channel_id_ << ", insert to return_queue_, addr = " << std::hex << cmd.hex_addr <<
                 " , delay = " << std::dec << config_.read_delay << std::endl;
 #endif
+            if (qos_.IsEnabled()) {
+                qos_.ReadIssued(it->second);
+            }
             return_queue_.push_back(it->second);
             pending_rd_q_.erase(it);
             num_reads -= 1;
@@ -327,7 +427,7 @@ void Controller::IssueCommand(const Command &cmd) {
         std::cout << channel_id_ << ", IssueCommand (Write), addr = " << std::hex << cmd.hex_addr << std::endl;
 #endif
         // there should be only 1 write to the same location at a time
-        auto it = pending_wr_q_.find(cmd.hex_addr);
+        auto it = pending_wr_q_.find(WriteBufferKey(cmd.hex_addr));
         if (it == pending_wr_q_.end()) {
             std::cerr << cmd.hex_addr << " not in write queue!" << std::endl;
             exit(1);
@@ -336,13 +436,31 @@ void Controller::IssueCommand(const Command &cmd) {
         simple_stats_.AddValue("write_latency", wr_lat);
         pending_wr_q_.erase(it);
     }
+    rank_last_cmd_clk_[cmd.Rank()] = clk_;
     // must update stats before states (for row hits)
     UpdateCommandStats(cmd);
     channel_state_.UpdateTimingAndStates(cmd, clk_);
 }
 
+bool Controller::HasPendingRowHit(const Command &cmd) const {
+    // transactions that have not made it into the command queue yet
+    // may still want the open row, whichever queue they wait in
+    int open_row = channel_state_.OpenRow(cmd.Rank(), cmd.Bankgroup(),
+                                          cmd.Bank());
+    auto hits_row = [&cmd, open_row](const Transaction &trans) {
+        const auto &addr = trans.dram_addr;
+        return addr.rank == cmd.Rank() && addr.bankgroup == cmd.Bankgroup() &&
+               addr.bank == cmd.Bank() && addr.row == open_row;
+    };
+    if (is_unified_queue_) {
+        return std::any_of(unified_queue_.begin(), unified_queue_.end(),
+                           hits_row);
+    }
+    return std::any_of(read_queue_.begin(), read_queue_.end(), hits_row) ||
+           std::any_of(write_buffer_.begin(), write_buffer_.end(), hits_row);
+}
+
 Command Controller::TransToCommand(const Transaction &trans) {
-    auto addr = config_.AddressMapping(trans.addr);
     CommandType cmd_type;
     if (row_buf_policy_ == RowBufPolicy::OPEN_PAGE) {
         cmd_type = trans.is_write ? CommandType::WRITE : CommandType::READ;
@@ -350,12 +468,27 @@ Command Controller::TransToCommand(const Transaction &trans) {
         cmd_type = trans.is_write ? CommandType::WRITE_PRECHARGE
                                   : CommandType::READ_PRECHARGE;
     }
-    return Command(cmd_type, addr, trans.addr);
+    auto cmd = Command(cmd_type, trans.dram_addr, trans.addr);
+    cmd.qos_class = trans.qos_class;
+    return cmd;
 }
 
 int Controller::QueueUsage() const { return cmd_queue_.QueueUsage(); }
 
+void Controller::UpdateCycleStats() {
+    // cycles are only added up when the stats are needed
+    simple_stats_.IncrementBy("num_cycles", clk_ - last_stats_clk_);
+    channel_state_.UpdateResidencyStats(clk_);
+    last_stats_clk_ = clk_;
+}
+
+void Controller::ResetStats() {
+    UpdateCycleStats();
+    simple_stats_.Reset();
+}
+
 void Controller::PrintEpochStats() {
+    UpdateCycleStats();
     simple_stats_.Increment("epoch_num");
     simple_stats_.PrintEpochStats();
 #ifdef THERMAL
@@ -367,7 +500,22 @@ void Controller::PrintEpochStats() {
     return;
 }
 
+#ifdef THERMAL
+void Controller::UpdateRefreshRate() {
+    // refresh rate follows the temperature of the last epoch
+    for (int r = 0; r < config_.ranks; r++) {
+        double temp = thermal_calc_.GetRankTemperature(channel_id_, r);
+        bool hot = temp > config_.temp_refresh_threshold;
+        refresh_.SetRefreshScale(r, hot ? config_.temp_refresh_scale : 1);
+        if (hot) {
+            simple_stats_.IncrementVec("hot_rank_epochs", r);
+        }
+    }
+}
+#endif  // THERMAL
+
 void Controller::PrintFinalStats() {
+    UpdateCycleStats();
     simple_stats_.PrintFinalStats();
 
 #ifdef THERMAL
@@ -409,6 +557,22 @@ void Controller::UpdateCommandStats(const Command &cmd) {
         case CommandType::REFRESH_BANK:
             simple_stats_.Increment("num_refb_cmds");
             break;
+        case CommandType::REFRESH_SAME_BANK:
+            simple_stats_.Increment("num_refsb_cmds");
+            break;
+        case CommandType::RFM:
+            // PARA and TRR borrow the RFM command for their neighbor refresh
+            simple_stats_.Increment(config_.row_hammer_mitigation ==
+                                            RowHammerMitigation::RFM
+                                        ? "num_rfm_cmds"
+                                        : "num_trr_cmds");
+            break;
+        case CommandType::PD_ENTER:
+            simple_stats_.Increment("num_pde_cmds");
+            break;
+        case CommandType::PD_EXIT:
+            simple_stats_.Increment("num_pdx_cmds");
+            break;
         case CommandType::SREF_ENTER:
             simple_stats_.Increment("num_srefe_cmds");
             break;
@@ -8,8 +8,10 @@
 #include "channel_state.h"
 #include "command_queue.h"
 #include "common.h"
+#include "qos.h"
 #include "refresh.h"
 #include "simple_stats.h"
+#include "tracer.h"
 
 #ifdef THERMAL
 #include "thermal.h"
@@ -23,9 +25,10 @@ class Controller {
    public:
 #ifdef THERMAL
     Controller(int channel, const Config &config, const Timing &timing,
-               ThermalCalculator &thermalcalc);
+               Tracer &tracer, ThermalCalculator &thermalcalc);
 #else
-    Controller(int channel, const Config &config, const Timing &timing);
+    Controller(int channel, const Config &config, const Timing &timing,
+               Tracer &tracer);
 #endif  // THERMAL
     void ClockTick();
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const;
@@ -34,7 +37,10 @@ class Controller {
     // Stats output
     void PrintEpochStats();
     void PrintFinalStats();
-    void ResetStats() { simple_stats_.Reset(); }
+    void ResetStats();
+#ifdef THERMAL
+    void UpdateRefreshRate();
+#endif  // THERMAL
     std::pair<uint64_t, int> ReturnDoneTrans(uint64_t clock);
 
     int channel_id_;
@@ -46,6 +52,8 @@ class Controller {
     ChannelState channel_state_;
     CommandQueue cmd_queue_;
     Refresh refresh_;
+    QoS qos_;
+    Tracer &tracer_;
 
 #ifdef THERMAL
     ThermalCalculator &thermal_calc_;
@@ -58,6 +66,8 @@ class Controller {
     std::vector<Transaction> write_buffer_;
 
     // transactions that are not completed, use map for convenience
+    // pending writes are the write buffer, with write coalescing they are
+    // indexed by the burst aligned address so writes to a burst merge
     std::multimap<uint64_t, Transaction> pending_rd_q_;
     std::multimap<uint64_t, Transaction> pending_wr_q_;
 
@@ -71,23 +81,43 @@ class Controller {
     double low_thres_;
     double high_thres_;
 
+    // latency of reads forwarded from the write buffer
+    int write_forward_latency_;
+    bool write_coalescing_;
+
     // row buffer policy
     RowBufPolicy row_buf_policy_;
 
-#ifdef CMD_TRACE
-    std::ofstream cmd_trace_;
-#endif  // CMD_TRACE
+    // precharge idle banks when the command bus is free
+    bool aggressive_precharging_;
 
     // used to calculate inter-arrival latency
     uint64_t last_trans_clk_;
 
+    // cycles up to here are in the stats
+    uint64_t last_stats_clk_;
+
+    // used by the power down idle timer
+    std::vector<uint64_t> rank_last_cmd_clk_;
+
     // transaction queueing
     int write_draining_;
     void ScheduleTransaction();
+    bool ScheduleTransactionFrom(std::vector<Transaction> &queue,
+                                 bool priority_only, int qos_class);
     void ScheduleReadTransaction();
     void IssueCommand(const Command &tmp_cmd);
     Command TransToCommand(const Transaction &trans);
+    uint64_t BurstAddress(uint64_t hex_addr) const {
+        return (hex_addr >> config_.shift_bits) << config_.shift_bits;
+    }
+    uint64_t WriteBufferKey(uint64_t hex_addr) const {
+        return write_coalescing_ ? BurstAddress(hex_addr) : hex_addr;
+    }
+    bool IsReadPending(uint64_t hex_addr) const;
+    bool HasPendingRowHit(const Command &cmd) const;
     void UpdateCommandStats(const Command &cmd);
+    void UpdateCycleStats();
 };
 }  // namespace dramsim3
 #endif
@@ -16,6 +16,7 @@ BaseDRAMSystem::BaseDRAMSystem(Config &config, const std::string &output_dir,
       last_req_clk_(0),
       config_(config),
       timing_(config_),
+      tracer_(config_),
       total_channels_(config.channels),
       total_ranks_(config.ranks),
       total_banks_(config.banks),
@@ -24,27 +25,19 @@ BaseDRAMSystem::BaseDRAMSystem(Config &config, const std::string &output_dir,
 #endif  // THERMAL
       clk_(0) {
     //total_channels_ += config_.channels;
-
-#ifdef ADDR_TRACE
-    std::string addr_trace_name = config_.output_prefix + "addr.trace";
-    address_trace_.open(addr_trace_name);
-#endif
 }
 
 int BaseDRAMSystem::GetChannel(uint64_t hex_addr) const {
-    hex_addr >>= config_.shift_bits;
-    return (hex_addr >> config_.ch_pos) & config_.ch_mask;
+    return config_.AddressMapping(hex_addr, AddressField::CHANNEL);
 }
 
 int BaseDRAMSystem::GetRank(uint64_t hex_addr) const {
-    hex_addr >>= config_.shift_bits;
-    return (hex_addr >> config_.ra_pos) & config_.ra_mask;
+    return config_.AddressMapping(hex_addr, AddressField::RANK);
 }
 
 int BaseDRAMSystem::GetBank(uint64_t hex_addr) const {
-    hex_addr >>= config_.shift_bits;
-    int bg = (hex_addr >> config_.bg_pos) & config_.bg_mask;
-    int ba = (hex_addr >> config_.ba_pos) & config_.ba_mask;
+    int bg = config_.AddressMapping(hex_addr, AddressField::BANKGROUP);
+    int ba = config_.AddressMapping(hex_addr, AddressField::BANK);
 
     return config_.banks_per_group * bg + ba;
 }
@@ -74,11 +67,18 @@ void BaseDRAMSystem::PrintEpochStats() {
     }
 #ifdef THERMAL
     thermal_calc_.PrintTransPT(clk_);
+    if (config_.temp_aware_refresh) {
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            ctrls_[i]->UpdateRefreshRate();
+        }
+    }
 #endif  // THERMAL
     return;
 }
 
 void BaseDRAMSystem::PrintStats() {
+    tracer_.Flush();
+
     // Finish epoch output, remove last comma and append ]
     std::ofstream epoch_out(config_.json_epoch_name, std::ios_base::in |
                                                          std::ios_base::out |
@@ -140,9 +140,9 @@ JedecDRAMSystem::JedecDRAMSystem(Config &config, const std::string &output_dir,
     ctrls_.reserve(config_.channels);
     for (auto i = 0; i < config_.channels; i++) {
 #ifdef THERMAL
-        ctrls_.push_back(new Controller(i, config_, timing_, thermal_calc_));
+        ctrls_.push_back(new Controller(i, config_, timing_, tracer_, thermal_calc_));
 #else
-        ctrls_.push_back(new Controller(i, config_, timing_));
+        ctrls_.push_back(new Controller(i, config_, timing_, tracer_));
 #endif  // THERMAL
     }
 }
@@ -160,19 +160,16 @@ bool JedecDRAMSystem::WillAcceptTransaction(uint64_t hex_addr,
 }
 
 bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write,
-        bool priority) {
-// Record trace - Record address trace for debugging or other purposes
-#ifdef ADDR_TRACE
-    address_trace_ << std::hex << hex_addr << std::dec << " "
-                   << (is_write ? "WRITE " : "READ ") << clk_ << std::endl;
-#endif
-
-    int channel = GetChannel(hex_addr);
+        bool priority, int qos_class) {
+    auto addr = config_.AddressMapping(hex_addr);
+    int channel = addr.channel;
     bool ok = ctrls_[channel]->WillAcceptTransaction(hex_addr, is_write);
 
     assert(ok);
     if (ok) {
-        Transaction trans = Transaction(hex_addr, is_write, priority);
+        Transaction trans =
+            Transaction(hex_addr, is_write, priority, qos_class);
+        trans.dram_addr = addr;
         ctrls_[channel]->AddTransaction(trans);
     }
     last_req_clk_ = clk_;
@@ -213,7 +210,7 @@ IdealDRAMSystem::IdealDRAMSystem(Config &config, const std::string &output_dir,
 IdealDRAMSystem::~IdealDRAMSystem() {}
 
 bool IdealDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write,
-                                     bool priority) {
+                                     bool priority, int qos_class) {
     auto trans = Transaction(hex_addr, is_write);
     trans.added_cycle = clk_;
     infinite_buffer_q_.push_back(trans);
@@ -9,6 +9,7 @@
 #include "configuration.h"
 #include "controller.h"
 #include "timing.h"
+#include "tracer.h"
 
 #ifdef THERMAL
 #include "thermal.h"
@@ -33,7 +34,7 @@ class BaseDRAMSystem {
     bool WillAcceptTransactionByChannel(int channel_id,
                                         bool is_write) const;
     virtual bool AddTransaction(uint64_t hex_addr, bool is_write,
-                                bool priority) = 0;
+                                bool priority = false, int qos_class = 0) = 0;
     virtual void ClockTick() = 0;
     int GetChannel(uint64_t hex_addr) const;
     int GetRank(uint64_t hex_addr) const;
@@ -49,6 +50,7 @@ class BaseDRAMSystem {
     uint64_t last_req_clk_;
     Config &config_;
     Timing timing_;
+    Tracer tracer_;
     int total_channels_; /** original DRAMsim3 has this as public, static */
     int total_ranks_;
     int total_banks_;
@@ -61,10 +63,6 @@ class BaseDRAMSystem {
 
     uint64_t clk_;
     std::vector<Controller*> ctrls_;
-
-#ifdef ADDR_TRACE
-    std::ofstream address_trace_;
-#endif  // ADDR_TRACE
 };
 
 // hmmm not sure this is the best naming...
@@ -75,7 +73,8 @@ class JedecDRAMSystem : public BaseDRAMSystem {
                     std::function<void(uint64_t)> write_callback);
     ~JedecDRAMSystem();
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const override;
-    bool AddTransaction(uint64_t hex_addr, bool is_write, bool priority) override;
+    bool AddTransaction(uint64_t hex_addr, bool is_write, bool priority = false,
+                        int qos_class = 0) override;
     void ClockTick() override;
 };
 
@@ -93,7 +92,7 @@ class IdealDRAMSystem : public BaseDRAMSystem {
         return true;
     };
     bool AddTransaction(uint64_t hex_addr, bool is_write,
-                        bool priority = false) override;
+                        bool priority = false, int qos_class = 0) override;
     void ClockTick() override;
 
    private:
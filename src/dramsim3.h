@@ -4,6 +4,8 @@
 #include <functional>
 #include <string>
 
+#include "hmc_types.h"
+
 namespace dramsim3 {
 
 // This should be the interface class that deals with CPU
@@ -32,7 +34,11 @@ class MemorySystem {
 
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const;
     bool WillAcceptTransactionByChannel(int channel_id, bool is_write) const;
-    bool AddTransaction(uint64_t hex_addr, bool is_write, bool priority);
+    bool AddTransaction(uint64_t hex_addr, bool is_write,
+                        bool priority = false, int qos_class = 0);
+    // HMC only, any request type including atomics and posted writes,
+    // atomics returning data complete through the read callback
+    bool AddHMCTransaction(uint64_t hex_addr, HMCReqType req_type);
 };
 
 MemorySystem* GetMemorySystem(const std::string &config_file, const std::string &output_dir,
@@ -2,12 +2,19 @@
 
 namespace dramsim3 {
 
-HMCRequest::HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault)
-    : type(req_type), mem_operand(hex_addr), vault(vault) {
+static bool IsAtomic(HMCReqType req_type) {
+    return req_type >= HMCReqType::ADD8 && req_type < HMCReqType::SIZE;
+}
+
+// whether the atomic writes its result back, the equality tests only read
+static bool AtomicWrites(HMCReqType req_type) {
+    return req_type != HMCReqType::EQ8 && req_type != HMCReqType::EQ16;
+}
+
+HMCRequest::HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault,
+                       int quad)
+    : type(req_type), mem_operand(hex_addr), quad(quad), vault(vault) {
     is_write = type >= HMCReqType::WR0 && type <= HMCReqType::P_WR256;
-    // given that vaults could be 16 (Gen1) or 32(Gen2), using % 4
-    // to partition vaults to quads
-    quad = vault % 4;
     switch (req_type) {
         case HMCReqType::RD0:
         case HMCReqType::WR0:
@@ -247,7 +254,9 @@ HMCMemorySystem::HMCMemorySystem(Config &config, const std::string &output_dir,
       logic_clk_(0),
       logic_ps_(0),
       dram_ps_(0),
-      next_link_(0) {
+      next_link_(0),
+      link_arbiter_(config.num_links),
+      quad_arbiter_(config.num_quads) {
     // sanity check, this constructor should only be intialized using HMC
     if (!config_.IsHMC()) {
         std::cerr << "Initialzed an HMC system without an HMC config file!"
@@ -261,9 +270,9 @@ HMCMemorySystem::HMCMemorySystem(Config &config, const std::string &output_dir,
     ctrls_.reserve(config_.channels);
     for (int i = 0; i < config_.channels; i++) {
 #ifdef THERMAL
-        ctrls_.push_back(new Controller(i, config_, timing_, thermal_calc_));
+        ctrls_.push_back(new Controller(i, config_, timing_, tracer_, thermal_calc_));
 #else
-        ctrls_.push_back(new Controller(i, config_, timing_));
+        ctrls_.push_back(new Controller(i, config_, timing_, tracer_));
 #endif  // THERMAL
     }
     // initialize vaults and crossbar
@@ -273,27 +282,26 @@ HMCMemorySystem::HMCMemorySystem(Config &config, const std::string &output_dir,
     // quadrant)
     queue_depth_ = static_cast<size_t>(config_.xbar_queue_depth);
     links_ = config_.num_links;
-    link_req_queues_.reserve(links_);
-    link_resp_queues_.reserve(links_);
+    quads_ = config_.num_quads;
+    xbar_bandwidth_ = config_.xbar_bandwidth;
     for (int i = 0; i < links_; i++) {
-        link_req_queues_.push_back(std::vector<HMCRequest *>());
-        link_resp_queues_.push_back(std::vector<HMCResponse *>());
+        link_req_queues_.emplace_back(queue_depth_);
+        link_resp_queues_.emplace_back(queue_depth_);
     }
 
-    // don't want to hard coding it but there are 4 quads so it's kind of fixed
-    quad_req_queues_.reserve(4);
-    quad_resp_queues_.reserve(4);
-    for (int i = 0; i < 4; i++) {
-        quad_req_queues_.push_back(std::vector<HMCRequest *>());
-        quad_resp_queues_.push_back(std::vector<HMCResponse *>());
+    // vaults are partitioned to quads by vault % num_quads, 4 quads for both
+    // Gen1 (16 vaults) and Gen2 (32 vaults)
+    for (int i = 0; i < quads_; i++) {
+        quad_req_queues_.emplace_back(queue_depth_);
+        quad_resp_queues_.emplace_back(queue_depth_);
     }
-
-    link_busy_.reserve(links_);
-    link_age_counter_.reserve(links_);
-    for (int i = 0; i < links_; i++) {
-        link_busy_.push_back(0);
-        link_age_counter_.push_back(0);
+    vault_pending_.resize(config_.channels);
+    for (int i = 0; i < config_.channels; i++) {
+        vault_writes_.emplace_back(queue_depth_);
     }
+
+    link_busy_.assign(links_, 0);
+    quad_busy_.assign(quads_, 0);
 }
 
 HMCMemorySystem::~HMCMemorySystem() {
@@ -327,8 +335,30 @@ inline void HMCMemorySystem::IterateNextLink() {
     return;
 }
 
+int HMCMemorySystem::SelectLink(uint64_t hex_addr) const {
+    if (config_.link_select == HMCLinkSelect::ADDRESS) {
+        // fold the block address so that every block always takes the same
+        // link and requests to it stay in order
+        uint64_t block = hex_addr >> config_.shift_bits;
+        block ^= (block >> 8) ^ (block >> 16) ^ (block >> 32);
+        return static_cast<int>(block % links_);
+    }
+    // least loaded, ties go to the next link in round robin order
+    int link = next_link_;
+    for (int i = 1; i < links_; i++) {
+        int pos = (next_link_ + i) % links_;
+        if (link_req_queues_[pos].size() < link_req_queues_[link].size()) {
+            link = pos;
+        }
+    }
+    return link;
+}
+
 bool HMCMemorySystem::WillAcceptTransaction(uint64_t hex_addr,
                                             bool is_write) const {
+    if (config_.link_select == HMCLinkSelect::ADDRESS) {
+        return link_req_queues_[SelectLink(hex_addr)].size() < queue_depth_;
+    }
     bool insertable = false;
     for (auto link_queue = link_req_queues_.begin();
          link_queue != link_req_queues_.end(); link_queue++) {
@@ -341,7 +371,7 @@ bool HMCMemorySystem::WillAcceptTransaction(uint64_t hex_addr,
 }
 
 bool HMCMemorySystem::AddTransaction(uint64_t hex_addr, bool is_write,
-                                     bool priority) {
+                                     bool priority, int qos_class) {
     // to be compatible with other protocol we have this interface
     // when using this intreface the size of each transaction will be block_size
     HMCReqType req_type;
@@ -390,25 +420,27 @@ bool HMCMemorySystem::AddTransaction(uint64_t hex_addr, bool is_write,
                 break;
         }
     }
+    return AddHMCTransaction(hex_addr, req_type);
+}
+
+bool HMCMemorySystem::AddHMCTransaction(uint64_t hex_addr,
+                                        HMCReqType req_type) {
     int vault = GetChannel(hex_addr);
-    HMCRequest *req = new HMCRequest(req_type, hex_addr, vault);
-    return InsertHMCReq(req);
+    return InsertHMCReq(HMCRequest(req_type, hex_addr, vault, vault % quads_));
 }
 
-bool HMCMemorySystem::InsertReqToLink(HMCRequest *req, int link) {
+bool HMCMemorySystem::InsertReqToLink(const HMCRequest &req, int link) {
     // These things need to happen when an HMC request is inserted to a link:
     // 1. check if link queue full
     // 2. set link field in the request packet
     // 3. create corresponding response
-    // 4. increment link_age_counter_ so that arbitrate logic works
+    // 4. let the link join arbitration if the request is at its head
     if (link_req_queues_[link].size() < queue_depth_) {
-        req->link = link;
         link_req_queues_[link].push_back(req);
-        HMCResponse *resp =
-            new HMCResponse(req->mem_operand, req->type, link, req->quad);
-        resp_lookup_table_.insert(
-            std::pair<uint64_t, HMCResponse *>(resp->resp_id, resp));
-        link_age_counter_[link] = 1;
+        link_req_queues_[link].back().link = link;
+        HMCResponse resp(req.mem_operand, req.type, link, req.quad);
+        vault_pending_[req.vault].push_back({resp, req.type, req.is_write});
+        link_arbiter_.Join(link);
         // stats_.interarrival_latency.AddValue(clk_ - last_req_clk_);
         last_req_clk_ = clk_;
         return true;
@@ -417,12 +449,19 @@ bool HMCMemorySystem::InsertReqToLink(HMCRequest *req, int link) {
     }
 }
 
-bool HMCMemorySystem::InsertHMCReq(HMCRequest *req) {
+bool HMCMemorySystem::InsertHMCReq(const HMCRequest &req) {
     // most CPU models does not support simultaneous insertions
     // if you want to actually simulate the multi-link feature
     // then you have to call this function multiple times in 1 cycle
     // TODO put a cap limit on how many times you can call this function per
     // cycle
+    if (config_.link_select != HMCLinkSelect::ROUND_ROBIN) {
+        if (!InsertReqToLink(req, SelectLink(req.mem_operand))) {
+            return false;
+        }
+        IterateNextLink();
+        return true;
+    }
     bool is_inserted = InsertReqToLink(req, next_link_);
     if (!is_inserted) {
         int start_link = next_link_;
@@ -443,17 +482,28 @@ bool HMCMemorySystem::InsertHMCReq(HMCRequest *req) {
 }
 
 void HMCMemorySystem::DrainRequests() {
+    // write back the results of atomic operations
+    for (size_t i = 0; i < vault_writes_.size(); i++) {
+        if (!vault_writes_[i].empty()) {
+            uint64_t hex_addr = vault_writes_[i].front();
+            if (ctrls_[i]->WillAcceptTransaction(hex_addr, true)) {
+                Transaction trans(hex_addr, true);
+                ctrls_[i]->AddTransaction(trans);
+                vault_writes_[i].pop_front();
+            }
+        }
+    }
+
     // drain quad request queue to vaults
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < quads_; i++) {
         if (!quad_req_queues_[i].empty() &&
             quad_resp_queues_[i].size() < queue_depth_) {
-            HMCRequest *req = quad_req_queues_[i].front();
-            if (req->exit_time <= logic_clk_) {
-                if (ctrls_[req->vault]->WillAcceptTransaction(req->mem_operand,
-                                                              req->is_write)) {
+            const HMCRequest &req = quad_req_queues_[i].front();
+            if (req.exit_time <= logic_clk_) {
+                if (ctrls_[req.vault]->WillAcceptTransaction(req.mem_operand,
+                                                             req.is_write)) {
                     InsertReqToDRAM(req);
-                    delete (req);
-                    quad_req_queues_[i].erase(quad_req_queues_[i].begin());
+                    quad_req_queues_[i].pop_front();
                 }
             }
         }
@@ -462,49 +512,47 @@ void HMCMemorySystem::DrainRequests() {
     // drain xbar
     for (auto &&i : quad_busy_) {
         if (i > 0) {
-            i -= 2;
+            i -= xbar_bandwidth_;
         }
     }
 
-    // drain requests from link to quad buffers
-    std::vector<int> age_queue = BuildAgeQueue(link_age_counter_);
-    while (!age_queue.empty()) {
-        int src_link = age_queue.front();
-        int dest_quad = link_req_queues_[src_link].front()->quad;
+    // drain requests from link to quad buffers, oldest first, links that get
+    // a new head packet rejoin at the back and wait for the next cycle
+    int last_link = link_arbiter_.Back();
+    for (int src_link = link_arbiter_.Front(), next; src_link >= 0;
+         src_link = next) {
+        next = link_arbiter_.Next(src_link);
+        int dest_quad = link_req_queues_[src_link].front().quad;
         if (quad_req_queues_[dest_quad].size() < queue_depth_ &&
             quad_busy_[dest_quad] <= 0) {
-            HMCRequest *req = link_req_queues_[src_link].front();
-            link_req_queues_[src_link].erase(
-                link_req_queues_[src_link].begin());
+            HMCRequest &req = link_req_queues_[src_link].front();
+            quad_busy_[dest_quad] = req.flits;
+            req.exit_time = logic_clk_ + req.flits;
             quad_req_queues_[dest_quad].push_back(req);
-            quad_busy_[dest_quad] = req->flits;
-            req->exit_time = logic_clk_ + req->flits;
-            if (link_req_queues_[src_link].empty()) {
-                link_age_counter_[src_link] = 0;
-            } else {
-                link_age_counter_[src_link] = 1;
+            link_req_queues_[src_link].pop_front();
+            link_arbiter_.Leave(src_link);
+            if (!link_req_queues_[src_link].empty()) {
+                link_arbiter_.Join(src_link);
             }
-        } else {  // stalled this cycle, update age counter
-            link_age_counter_[src_link]++;
+        }  // stalled links keep their place
+        if (src_link == last_link) {
+            break;
         }
-        age_queue.erase(age_queue.begin());
     }
-    age_queue.clear();
 }
 
 void HMCMemorySystem::DrainResponses() {
     // Link resp to CPU
     for (int i = 0; i < links_; i++) {
         if (!link_resp_queues_[i].empty()) {
-            HMCResponse *resp = link_resp_queues_[i].front();
-            if (resp->exit_time <= logic_clk_) {
-                if (resp->type == HMCRespType::RD_RS) {
-                    read_callback_(resp->resp_id);
+            const HMCResponse &resp = link_resp_queues_[i].front();
+            if (resp.exit_time <= logic_clk_) {
+                if (resp.type == HMCRespType::RD_RS) {
+                    read_callback_(resp.resp_id);
                 } else {
-                    write_callback_(resp->resp_id);
+                    write_callback_(resp.resp_id);
                 }
-                delete (resp);
-                link_resp_queues_[i].erase(link_resp_queues_[i].begin());
+                link_resp_queues_[i].pop_front();
             }
         }
     }
@@ -512,34 +560,32 @@ void HMCMemorySystem::DrainResponses() {
     // drain xbar
     for (auto &&i : link_busy_) {
         if (i > 0) {
-            i -= 2;
+            i -= xbar_bandwidth_;
         }
     }
 
     // drain responses from quad to link buffers
-    auto age_queue = BuildAgeQueue(quad_age_counter_);
-    while (!age_queue.empty()) {
-        int src_quad = age_queue.front();
-        int dest_link = quad_resp_queues_[src_quad].front()->link;
+    int last_quad = quad_arbiter_.Back();
+    for (int src_quad = quad_arbiter_.Front(), next; src_quad >= 0;
+         src_quad = next) {
+        next = quad_arbiter_.Next(src_quad);
+        int dest_link = quad_resp_queues_[src_quad].front().link;
         if (link_resp_queues_[dest_link].size() < queue_depth_ &&
             link_busy_[dest_link] <= 0) {
-            HMCResponse *resp = quad_resp_queues_[src_quad].front();
-            quad_resp_queues_[src_quad].erase(
-                quad_resp_queues_[src_quad].begin());
+            HMCResponse &resp = quad_resp_queues_[src_quad].front();
+            link_busy_[dest_link] = resp.flits;
+            resp.exit_time = logic_clk_ + resp.flits;
             link_resp_queues_[dest_link].push_back(resp);
-            link_busy_[dest_link] = resp->flits;
-            resp->exit_time = logic_clk_ + resp->flits;
-            if (quad_resp_queues_[src_quad].size() == 0) {
-                quad_age_counter_[src_quad] = 0;
-            } else {
-                quad_age_counter_[src_quad] = 1;
+            quad_resp_queues_[src_quad].pop_front();
+            quad_arbiter_.Leave(src_quad);
+            if (!quad_resp_queues_[src_quad].empty()) {
+                quad_arbiter_.Join(src_quad);
             }
-        } else {  // stalled this cycle, update age counter
-            quad_age_counter_[src_quad]++;
+        }  // stalled quads keep their place
+        if (src_quad == last_quad) {
+            break;
         }
-        age_queue.erase(age_queue.begin());
     }
-    age_queue.clear();
 }
 
 void HMCMemorySystem::DRAMClockTick() {
@@ -548,9 +594,9 @@ void HMCMemorySystem::DRAMClockTick() {
         while (true) {
             auto pair = ctrls_[i]->ReturnDoneTrans(clk_);
             if (pair.second == 1) {  // write
-                VaultCallback(pair.first);
+                VaultCallback(i, pair.first, true);
             } else if (pair.second == 0) {  // read
-                VaultCallback(pair.first);
+                VaultCallback(i, pair.first, false);
             } else {
                 break;
             }
@@ -587,51 +633,46 @@ void HMCMemorySystem::ClockTick() {
     return;
 }
 
-std::vector<int> HMCMemorySystem::BuildAgeQueue(std::vector<int> &age_counter) {
-    // return a vector of indices sorted in decending order
-    // meaning that the oldest age link/quad should be processed first
-    std::vector<int> age_queue;
-    int queue_len = age_counter.size();
-    age_queue.reserve(queue_len);
-    int start_pos = logic_clk_ % queue_len;  // round robin start pos
-    for (int i = 0; i < queue_len; i++) {
-        int pos = (i + start_pos) % queue_len;
-        if (age_counter[pos] > 0) {
-            bool is_inserted = false;
-            for (auto it = age_queue.begin(); it != age_queue.end(); it++) {
-                if (age_counter[pos] > *it) {
-                    age_queue.insert(it, pos);
-                    is_inserted = true;
-                    break;
-                }
-            }
-            if (!is_inserted) {
-                age_queue.push_back(pos);
-            }
-        }
-    }
-    return age_queue;
-}
-
-void HMCMemorySystem::InsertReqToDRAM(HMCRequest *req) {
-    Transaction trans(req->mem_operand, req->is_write);
-    ctrls_[req->vault]->AddTransaction(trans);
+void HMCMemorySystem::InsertReqToDRAM(const HMCRequest &req) {
+    Transaction trans(req.mem_operand, req.is_write);
+    ctrls_[req.vault]->AddTransaction(trans);
     return;
 }
 
-void HMCMemorySystem::VaultCallback(uint64_t req_id) {
-    // we will use hex addr as the req_id and use a multimap to lookup the
-    // requests the vaults cannot directly talk to the CPU so this callback will
-    // be passed to the vaults and is responsible to put the responses back to
-    // response queues
+void HMCMemorySystem::VaultCallback(int vault, uint64_t req_id,
+                                   bool is_write) {
+    // we will use hex addr as the req_id and look up the oldest response
+    // waiting on the vault, the vaults cannot directly talk to the CPU so this
+    // callback is responsible to put the responses back to response queues
+    auto &pending = vault_pending_[vault];
+    auto it = std::find_if(pending.begin(), pending.end(),
+                           [req_id, is_write](const VaultPending &p) {
+                               return p.resp.resp_id == req_id &&
+                                      p.is_write == is_write;
+                           });
+    if (it == pending.end()) {
+        std::cerr << "No request waiting for " << std::hex << req_id
+                  << std::dec << " in vault " << vault << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    HMCResponse resp = it->resp;
+    HMCReqType req_type = it->req_type;
+    pending.erase(it);
 
-    auto it = resp_lookup_table_.find(req_id);
-    HMCResponse *resp = it->second;
+    // the vault logic has the operands once the read is done, the result is
+    // written back while the response goes out
+    if (!is_write && IsAtomic(req_type) && AtomicWrites(req_type)) {
+        vault_writes_[vault].push_back(req_id);
+        HMCResponse none;
+        none.resp_id = req_id;
+        pending.push_back({none, req_type, true});
+    }
+    if (resp.type == HMCRespType::NONE) {
+        return;
+    }
     // all data from dram received, put packet in xbar and return
-    resp_lookup_table_.erase(it);
-    // put it in xbar
-    quad_resp_queues_[resp->quad].push_back(resp);
-    quad_age_counter_[resp->quad] = 1;
+    quad_resp_queues_[resp.quad].push_back(resp);
+    quad_arbiter_.Join(resp.quad);
     return;
 }
 
@@ -1,76 +1,15 @@
 #ifndef __HMC_H
 #define __HMC_H
 
+#include <algorithm>
 #include <functional>
-#include <map>
 #include <vector>
 
 #include "dram_system.h"
+#include "hmc_types.h"
 
 namespace dramsim3 {
 
-enum class HMCReqType {
-    RD0,
-    RD16,
-    RD32,
-    RD48,
-    RD64,
-    RD80,
-    RD96,
-    RD112,
-    RD128,
-    RD256,
-    WR0,
-    WR16,
-    WR32,
-    WR48,
-    WR64,
-    WR80,
-    WR96,
-    WR112,
-    WR128,
-    WR256,
-    P_WR16,
-    P_WR32,
-    P_WR48,
-    P_WR64,
-    P_WR80,
-    P_WR96,
-    P_WR112,
-    P_WR128,
-    P_WR256,
-    // TODO haven't properly implement the following atomic operations
-    ADD8,  // 2ADD8, cannot name it like that in c++...
-    ADD16,
-    P_2ADD8,  // 2 8Byte imm operands + 8 8Byte mem operands read then write
-    P_ADD16,
-    ADDS8R,  // 2ADD8, cannot name it like that...
-    ADDS16R,
-    INC8,  // read, return(the original), then write
-    P_INC8, // read, return(the original), then posted write
-    // boolean op on imm operand and mem operand, read update write
-    XOR16,  
-    OR16,
-    NOR16,
-    AND16,
-    NAND16,
-    // comparison instructions, not sure if there's write untill read done
-    CASGT8,
-    CASGT16,
-    CASLT8,
-    CASLT16,
-    CASEQ8,
-    CASZERO16,
-    // eq, only read
-    EQ8,
-    EQ16,
-    BWR,
-    P_BWR,  // bit write, 8B mask, 8B value, read update write
-    BWR8R,  // bit write with return
-    SWAP16,  // swap imm operand and mem operand, read then write
-    SIZE
-};
-
 enum class HMCRespType { NONE, RD_RS, WR_RS, ERR, SIZE };
 
 // for future use
@@ -78,7 +17,16 @@ enum class HMCLinkType { HOST_TO_DEV, DEV_TO_DEV, SIZE };
 
 class HMCRequest {
    public:
-    HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault);
+    HMCRequest()
+        : type(HMCReqType::SIZE),
+          mem_operand(0),
+          link(0),
+          quad(0),
+          vault(0),
+          flits(0),
+          is_write(false),
+          exit_time(0) {}
+    HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault, int quad);
     HMCReqType type;
     uint64_t mem_operand;
     int link;
@@ -92,6 +40,13 @@ class HMCRequest {
 
 class HMCResponse {
    public:
+    HMCResponse()
+        : resp_id(0),
+          type(HMCRespType::NONE),
+          link(0),
+          quad(0),
+          flits(0),
+          exit_time(0) {}
     HMCResponse(uint64_t id, HMCReqType reqtype, int dest_link, int src_quad);
     uint64_t resp_id;
     HMCRespType type;
@@ -102,6 +57,102 @@ class HMCResponse {
     uint64_t exit_time;
 };
 
+// FIFO over a preallocated array, packets are stored by value so they move
+// through the xbar without being allocated. The xbar buffers are bounded by
+// xbar_queue_depth, only the response buffers of quads can take more when
+// several vaults finish at once, then the array doubles.
+template <typename T>
+class RingQueue {
+   public:
+    RingQueue() : head_(0), size_(0) {}
+    explicit RingQueue(size_t capacity)
+        : data_(std::max<size_t>(capacity, 1)), head_(0), size_(0) {}
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    T& front() { return data_[head_]; }
+    const T& front() const { return data_[head_]; }
+    T& back() { return data_[(head_ + size_ - 1) % data_.size()]; }
+    void push_back(const T& value) {
+        if (size_ == data_.size()) {
+            Grow();
+        }
+        data_[(head_ + size_) % data_.size()] = value;
+        size_++;
+    }
+    void pop_front() {
+        head_ = (head_ + 1) % data_.size();
+        size_--;
+    }
+
+   private:
+    std::vector<T> data_;
+    size_t head_;
+    size_t size_;
+    void Grow() {
+        std::vector<T> data(data_.size() * 2);
+        for (size_t i = 0; i < size_; i++) {
+            data[i] = data_[(head_ + i) % data_.size()];
+        }
+        data_.swap(data);
+        head_ = 0;
+    }
+};
+
+// Oldest first arbitration among the input ports of one side of the xbar.
+// A port joins at the back when a packet reaches the head of its buffer and
+// keeps its place while stalled, so the list is always ordered by how long
+// the head packets have waited and nothing is sorted per cycle. Joining and
+// leaving are O(1) on an intrusive list over the port indices.
+class AgeArbiter {
+   public:
+    explicit AgeArbiter(int num_ports)
+        : prev_(num_ports, -1),
+          next_(num_ports, -1),
+          waiting_(num_ports, false),
+          head_(-1),
+          tail_(-1) {}
+    int Front() const { return head_; }
+    int Back() const { return tail_; }
+    int Next(int port) const { return next_[port]; }
+    void Join(int port) {
+        if (waiting_[port]) {
+            return;
+        }
+        waiting_[port] = true;
+        prev_[port] = tail_;
+        next_[port] = -1;
+        if (tail_ >= 0) {
+            next_[tail_] = port;
+        } else {
+            head_ = port;
+        }
+        tail_ = port;
+    }
+    void Leave(int port) {
+        if (!waiting_[port]) {
+            return;
+        }
+        waiting_[port] = false;
+        if (prev_[port] >= 0) {
+            next_[prev_[port]] = next_[port];
+        } else {
+            head_ = next_[port];
+        }
+        if (next_[port] >= 0) {
+            prev_[next_[port]] = prev_[port];
+        } else {
+            tail_ = prev_[port];
+        }
+    }
+
+   private:
+    std::vector<int> prev_;
+    std::vector<int> next_;
+    std::vector<bool> waiting_;
+    int head_;
+    int tail_;
+};
+
 class HMCMemorySystem : public BaseDRAMSystem {
    public:
     HMCMemorySystem(Config& config, const std::string& output_dir,
@@ -116,9 +167,14 @@ class HMCMemorySystem : public BaseDRAMSystem {
     // had to have 3 insert interfaces cuz HMC is so different...
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const override;
     bool AddTransaction(uint64_t hex_addr, bool is_write,
-                        bool priority) override;
-    bool InsertReqToLink(HMCRequest* req, int link);
-    bool InsertHMCReq(HMCRequest* req);
+                        bool priority = false, int qos_class = 0) override;
+    bool AddHMCTransaction(uint64_t hex_addr, HMCReqType req_type);
+    bool InsertReqToLink(const HMCRequest& req, int link);
+    bool InsertHMCReq(const HMCRequest& req);
+    // requests waiting in the input buffer of a link
+    size_t LinkQueueSize(int link) const {
+        return link_req_queues_[link].size();
+    }
 
    private:
     uint64_t logic_clk_, ps_per_dram_, ps_per_logic_, logic_ps_, dram_ps_;
@@ -127,35 +183,47 @@ class HMCMemorySystem : public BaseDRAMSystem {
     void DRAMClockTick();
     void DrainRequests();
     void DrainResponses();
-    void InsertReqToDRAM(HMCRequest* req);
-    void VaultCallback(uint64_t req_id);
-    std::vector<int> BuildAgeQueue(std::vector<int>& age_counter);
+    void InsertReqToDRAM(const HMCRequest& req);
+    void VaultCallback(int vault, uint64_t req_id, bool is_write);
     void XbarArbitrate();
+    int SelectLink(uint64_t hex_addr) const;
     inline void IterateNextLink();
 
     int next_link_;
     int links_;
+    int quads_;
     size_t queue_depth_;
 
     // number of flits xbar can process per logic cycle
-    const int xbar_bandwidth_ = 2;
-
-    // had to use a multimap because the controller callback return hex addr
-    // instead of unique id
-    std::multimap<uint64_t, HMCResponse*> resp_lookup_table_;
+    int xbar_bandwidth_;
+
+    // a response waiting for a DRAM transaction of its request, posted
+    // requests wait with a NONE response so that they still match their
+    // own transaction
+    struct VaultPending {
+        HMCResponse resp;
+        HMCReqType req_type;
+        bool is_write;  // completed by a write transaction
+    };
+    // the controllers return the hex addr instead of a unique id, so the
+    // responses waiting on each vault are kept in the order of the requests
+    // and the oldest one with the address and kind is completed
+    std::vector<std::vector<VaultPending>> vault_pending_;
+    // write back of atomic operations, waiting for room in the vault
+    std::vector<RingQueue<uint64_t>> vault_writes_;
     // these are essentially input/output buffers for xbars
-    std::vector<std::vector<HMCRequest*>> link_req_queues_;
-    std::vector<std::vector<HMCResponse*>> link_resp_queues_;
-    std::vector<std::vector<HMCRequest*>> quad_req_queues_;
-    std::vector<std::vector<HMCResponse*>> quad_resp_queues_;
+    std::vector<RingQueue<HMCRequest>> link_req_queues_;
+    std::vector<RingQueue<HMCResponse>> link_resp_queues_;
+    std::vector<RingQueue<HMCRequest>> quad_req_queues_;
+    std::vector<RingQueue<HMCResponse>> quad_resp_queues_;
 
     // input/output busy indicators, since each packet could be several
     // flits, as long as this != 0 then they're busy
     std::vector<int> link_busy_;
-    std::vector<int> quad_busy_ = {0, 0, 0, 0};
+    std::vector<int> quad_busy_;
     // used for arbitration
-    std::vector<int> link_age_counter_;
-    std::vector<int> quad_age_counter_ = {0, 0, 0, 0};
+    AgeArbiter link_arbiter_;
+    AgeArbiter quad_arbiter_;
 };
 
 }  // namespace dramsim3
@@ -0,0 +1,73 @@
+#ifndef __HMC_TYPES_H
+#define __HMC_TYPES_H
+
+namespace dramsim3 {
+
+// HMC request packets, submitted with MemorySystem::AddHMCTransaction
+enum class HMCReqType {
+    RD0,
+    RD16,
+    RD32,
+    RD48,
+    RD64,
+    RD80,
+    RD96,
+    RD112,
+    RD128,
+    RD256,
+    WR0,
+    WR16,
+    WR32,
+    WR48,
+    WR64,
+    WR80,
+    WR96,
+    WR112,
+    WR128,
+    WR256,
+    P_WR16,
+    P_WR32,
+    P_WR48,
+    P_WR64,
+    P_WR80,
+    P_WR96,
+    P_WR112,
+    P_WR128,
+    P_WR256,
+    // atomics are a read, the operation in the vault logic, then a write
+    // of the result (except EQ8/EQ16), the P_ ones have no response
+    ADD8,  // 2ADD8, cannot name it like that in c++...
+    ADD16,
+    P_2ADD8,  // 2 8Byte imm operands + 8 8Byte mem operands read then write
+    P_ADD16,
+    ADDS8R,  // 2ADD8, cannot name it like that...
+    ADDS16R,
+    INC8,  // read, return(the original), then write
+    P_INC8, // read, return(the original), then posted write
+    // boolean op on imm operand and mem operand, read update write
+    XOR16,  
+    OR16,
+    NOR16,
+    AND16,
+    NAND16,
+    // comparison instructions, the data is not modeled so the write is
+    // always done
+    CASGT8,
+    CASGT16,
+    CASLT8,
+    CASLT16,
+    CASEQ8,
+    CASZERO16,
+    // eq, only read
+    EQ8,
+    EQ16,
+    BWR,
+    P_BWR,  // bit write, 8B mask, 8B value, read update write
+    BWR8R,  // bit write with return
+    SWAP16,  // swap imm operand and mem operand, read then write
+    SIZE
+};
+
+}  // namespace dramsim3
+
+#endif
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "./../ext/headers/args.hxx"
+#include "common.h"
+#include "configuration.h"
+
+using namespace dramsim3;
+
+// Scores an address mapping against a request stream without any timing:
+// how evenly the requests spread over channels and banks, how often a
+// request finds its row left open by the previous access to the bank, and
+// how often it needs another row of a bank that was used in the last
+// `window` requests, i.e. would likely conflict in the controller
+class MappingScore {
+   public:
+    MappingScore(const std::string& name, std::unique_ptr<Config> config,
+                 int window)
+        : name_(name),
+          config_(std::move(config)),
+          window_(window),
+          channel_reqs_(config_->channels, 0),
+          bank_reqs_(config_->channels * config_->ranks * config_->banks, 0),
+          open_row_(bank_reqs_.size(), -1),
+          last_access_(bank_reqs_.size(), 0),
+          reqs_(0),
+          row_hits_(0),
+          conflicts_(0) {}
+
+    void Process(const std::vector<uint64_t>& addrs) {
+        for (auto hex_addr : addrs) {
+            auto addr = config_->AddressMapping(hex_addr);
+            int bank = ((addr.channel * config_->ranks + addr.rank) *
+                            config_->bankgroups +
+                        addr.bankgroup) *
+                           config_->banks_per_group +
+                       addr.bank;
+            channel_reqs_[addr.channel]++;
+            bank_reqs_[bank]++;
+            if (open_row_[bank] == addr.row) {
+                row_hits_++;
+            } else if (open_row_[bank] != -1 &&
+                       reqs_ - last_access_[bank] <=
+                           static_cast<uint64_t>(window_)) {
+                conflicts_++;
+            }
+            open_row_[bank] = addr.row;
+            last_access_[bank] = reqs_;
+            reqs_++;
+        }
+    }
+
+    // max over mean, 1.0 is perfectly balanced
+    static double Imbalance(const std::vector<uint64_t>& counts) {
+        uint64_t total = 0, max = 0;
+        for (auto count : counts) {
+            total += count;
+            max = std::max(max, count);
+        }
+        return total == 0 ? 0.0 : max * counts.size() / double(total);
+    }
+
+    std::string Name() const { return name_; }
+    double ChannelImbalance() const { return Imbalance(channel_reqs_); }
+    double BankImbalance() const { return Imbalance(bank_reqs_); }
+    double RowHitRate() const { return reqs_ ? row_hits_ / double(reqs_) : 0; }
+    double ConflictRate() const {
+        return reqs_ ? conflicts_ / double(reqs_) : 0;
+    }
+
+   private:
+    std::string name_;
+    std::unique_ptr<Config> config_;
+    int window_;
+
+    std::vector<uint64_t> channel_reqs_;
+    std::vector<uint64_t> bank_reqs_;
+    std::vector<int> open_row_;
+    std::vector<uint64_t> last_access_;
+    uint64_t reqs_;
+    uint64_t row_hits_;
+    uint64_t conflicts_;
+};
+
+std::unique_ptr<Config> LoadConfig(const std::string& config_file) {
+    // config parsing is chatty, which does not help with hundreds of them
+    std::ostringstream discard;
+    auto cout_buf = std::cout.rdbuf(discard.rdbuf());
+    std::unique_ptr<Config> config(new Config(config_file, "."));
+    std::cout.rdbuf(cout_buf);
+    return config;
+}
+
+int main(int argc, const char** argv) {
+    args::ArgumentParser parser(
+        "Address mapping evaluation, scores candidate mappings on a trace.",
+        "Examples: \n"
+        "./build/mappingeval configs/DDR4_8Gb_x8_3200.ini -t trace.txt -m "
+        "rorabgbachco -m robgrabachco\n"
+        "./build/mappingeval -t trace.txt candidates/*.ini");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::ValueFlag<std::string> trace_file_arg(
+        parser, "trace", "Trace file (mandatory)", {'t', "trace"});
+    args::ValueFlag<std::string> config_arg(
+        parser, "config", "Base config for the -m mappings", {'c', "config"});
+    args::ValueFlagList<std::string> mapping_arg(
+        parser, "mapping", "Candidate address_mapping string", {'m', "mapping"});
+    args::ValueFlag<int> window_arg(
+        parser, "window",
+        "Requests within which another row of a bank counts as a conflict",
+        {'w', "window"}, 32);
+    args::ValueFlag<int> threads_arg(parser, "threads", "Number of threads",
+                                     {'j', "threads"},
+                                     std::thread::hardware_concurrency());
+    args::ValueFlag<size_t> chunk_arg(parser, "chunk",
+                                      "Requests read from the trace at a time",
+                                      {"chunk"}, 1 << 20);
+    args::PositionalList<std::string> candidates_arg(
+        parser, "candidates", "Candidate config files");
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string trace_file = args::get(trace_file_arg);
+    std::string config_file = args::get(config_arg);
+    int window = args::get(window_arg);
+    int num_threads = std::max(1, args::get(threads_arg));
+    size_t chunk_size = std::max<size_t>(1, args::get(chunk_arg));
+
+    std::vector<MappingScore> scores;
+    for (const auto& candidate : args::get(candidates_arg)) {
+        scores.emplace_back(candidate, LoadConfig(candidate), window);
+    }
+    if (!args::get(mapping_arg).empty() && config_file.empty()) {
+        std::cerr << "-m needs a base config (-c)" << std::endl;
+        return 1;
+    }
+    for (const auto& mapping : args::get(mapping_arg)) {
+        auto config = LoadConfig(config_file);
+        config->SetAddressMapping(mapping);
+        scores.emplace_back(mapping, std::move(config), window);
+    }
+    if (trace_file.empty() || scores.empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::ifstream trace(trace_file);
+    if (!trace.is_open()) {
+        std::cerr << "Can't open trace file " << trace_file << std::endl;
+        return 1;
+    }
+
+    // stream the trace in chunks, every thread scores its share of the
+    // candidates on the chunk before the next one is read
+    std::vector<uint64_t> addrs;
+    addrs.reserve(chunk_size);
+    Transaction trans;
+    bool done = false;
+    while (!done) {
+        addrs.clear();
+        while (addrs.size() < chunk_size) {
+            if (!(trace >> trans)) {
+                done = true;
+                break;
+            }
+            addrs.push_back(trans.addr);
+        }
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&scores, &addrs, t, num_threads]() {
+                for (size_t i = t; i < scores.size(); i += num_threads) {
+                    scores[i].Process(addrs);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // fewest conflicts first, then the best row buffer locality
+    std::sort(scores.begin(), scores.end(),
+              [](const MappingScore& a, const MappingScore& b) {
+                  if (a.ConflictRate() != b.ConflictRate()) {
+                      return a.ConflictRate() < b.ConflictRate();
+                  }
+                  return a.RowHitRate() > b.RowHitRate();
+              });
+    std::cout << std::left << std::setw(32) << "mapping" << std::right
+              << std::setw(12) << "ch_imbal" << std::setw(12) << "bank_imbal"
+              << std::setw(12) << "row_hits" << std::setw(12) << "conflicts"
+              << std::endl;
+    std::cout << std::fixed << std::setprecision(4);
+    for (const auto& score : scores) {
+        std::cout << std::left << std::setw(32) << score.Name() << std::right
+                  << std::setw(12) << score.ChannelImbalance() << std::setw(12)
+                  << score.BankImbalance() << std::setw(12)
+                  << score.RowHitRate() << std::setw(12)
+                  << score.ConflictRate() << std::endl;
+    }
+    return 0;
+}
@@ -72,8 +72,18 @@ bool MemorySystem::WillAcceptTransactionByChannel(int channel_id,
 }
 
 bool MemorySystem::AddTransaction(uint64_t hex_addr, bool is_write,
-        bool priority) {
-    return dram_system_->AddTransaction(hex_addr, is_write, priority);
+        bool priority, int qos_class) {
+    return dram_system_->AddTransaction(hex_addr, is_write, priority,
+                                        qos_class);
+}
+
+bool MemorySystem::AddHMCTransaction(uint64_t hex_addr, HMCReqType req_type) {
+    if (!config_->IsHMC()) {
+        std::cerr << "HMC requests need an HMC config" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    return static_cast<HMCMemorySystem *>(dram_system_)
+        ->AddHMCTransaction(hex_addr, req_type);
 }
 
 void MemorySystem::PrintStats() const { dram_system_->PrintStats(); }
@@ -35,7 +35,11 @@ class MemorySystem {
 
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const;
     bool WillAcceptTransactionByChannel(int channel_id, bool is_write) const;
-    bool AddTransaction(uint64_t hex_addr, bool is_write, bool priority);
+    bool AddTransaction(uint64_t hex_addr, bool is_write,
+                        bool priority = false, int qos_class = 0);
+    // HMC only, any request type including atomics and posted writes,
+    // atomics returning data complete through the read callback
+    bool AddHMCTransaction(uint64_t hex_addr, HMCReqType req_type);
 
    private:
     // These have to be pointers because Gem5 will try to push this object
@@ -0,0 +1,134 @@
+#include "qos.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace dramsim3 {
+
+QoS::QoS(const Config& config, SimpleStats& simple_stats)
+    : config_(config),
+      simple_stats_(simple_stats),
+      num_classes_(config.qos_classes),
+      window_start_(0),
+      served_(num_classes_, 0),
+      vtime_(num_classes_, 0.0),
+      queued_reads_(num_classes_, 0),
+      queued_writes_(num_classes_, 0),
+      backlogged_(num_classes_, false),
+      pending_reads_(num_classes_),
+      urgency_(num_classes_, 0),
+      class_order_(num_classes_, 0),
+      urgent_mask_(0),
+      late_reads_(false) {
+    for (int i = 0; i < num_classes_; i++) {
+        latency_stat_names_.push_back("read_latency_qos" + std::to_string(i));
+        class_order_[i] = i;
+    }
+}
+
+void QoS::Update(bool reads, bool writes, uint64_t clk) {
+    if (clk - window_start_ >= static_cast<uint64_t>(config_.qos_window)) {
+        window_start_ = clk;
+        std::fill(served_.begin(), served_.end(), 0);
+        std::fill(vtime_.begin(), vtime_.end(), 0.0);
+    }
+
+    for (int i = 0; i < num_classes_; i++) {
+        backlogged_[i] = (reads && queued_reads_[i] > 0) ||
+                         (writes && queued_writes_[i] > 0);
+    }
+
+    // an idle class should not bank credit and then starve the others
+    // once it comes back, so it rejoins at the current virtual time
+    double min_vtime = std::numeric_limits<double>::max();
+    for (int i = 0; i < num_classes_; i++) {
+        if (backlogged_[i]) {
+            min_vtime = std::min(min_vtime, vtime_[i]);
+        }
+    }
+    urgent_mask_ = 0;
+    late_reads_ = false;
+    for (int i = 0; i < num_classes_; i++) {
+        urgency_[i] = 2;
+        int target = config_.qos_latency_targets[i];
+        if (target > 0 && !pending_reads_[i].empty() &&
+            clk - pending_reads_[i].front().first >=
+                static_cast<uint64_t>(target)) {
+            urgency_[i] = 0;
+            late_reads_ = true;
+        } else if (!backlogged_[i]) {
+            vtime_[i] = std::max(vtime_[i], min_vtime);
+        } else if (BelowGuarantee(i, clk)) {
+            urgency_[i] = 1;
+        }
+        if (urgency_[i] < 2) {
+            urgent_mask_ |= 1u << i;
+            simple_stats_.IncrementVec("qos_urgent_cycles", i);
+        }
+    }
+
+    // urgent classes first, then the one furthest behind its fair share
+    std::sort(class_order_.begin(), class_order_.end(), [this](int a, int b) {
+        if (urgency_[a] != urgency_[b]) {
+            return urgency_[a] < urgency_[b];
+        }
+        if (vtime_[a] != vtime_[b]) {
+            return vtime_[a] < vtime_[b];
+        }
+        return a < b;
+    });
+}
+
+void QoS::TransQueued(const Transaction& trans) {
+    auto& queued = trans.is_write ? queued_writes_ : queued_reads_;
+    queued[trans.qos_class]++;
+}
+
+void QoS::TransScheduled(const Transaction& trans) {
+    auto& queued = trans.is_write ? queued_writes_ : queued_reads_;
+    queued[trans.qos_class]--;
+    served_[trans.qos_class] += 1;
+    vtime_[trans.qos_class] += 1.0 / config_.qos_weights[trans.qos_class];
+}
+
+void QoS::ReadPending(const Transaction& trans) {
+    // reads arrive in cycle order
+    auto& reads = pending_reads_[trans.qos_class];
+    if (!reads.empty() && reads.back().first == trans.added_cycle) {
+        reads.back().second++;
+    } else {
+        reads.emplace_back(trans.added_cycle, 1);
+    }
+}
+
+void QoS::ReadIssued(const Transaction& trans) {
+    auto& reads = pending_reads_[trans.qos_class];
+    auto it = std::lower_bound(
+        reads.begin(), reads.end(), trans.added_cycle,
+        [](const std::pair<uint64_t, int>& entry, uint64_t cycle) {
+            return entry.first < cycle;
+        });
+    it->second--;
+    while (!reads.empty() && reads.front().second == 0) {
+        reads.pop_front();
+    }
+}
+
+void QoS::TransDone(const Transaction& trans, uint64_t clk) {
+    if (trans.is_write) {
+        simple_stats_.IncrementVec("qos_writes_done", trans.qos_class);
+    } else {
+        simple_stats_.IncrementVec("qos_reads_done", trans.qos_class);
+        simple_stats_.AddValue(latency_stat_names_[trans.qos_class],
+                               clk - trans.added_cycle);
+    }
+}
+
+bool QoS::BelowGuarantee(int qos, uint64_t clk) const {
+    // min bandwidth is in GB/s, i.e. bytes per ns
+    double guaranteed = config_.qos_min_bandwidth[qos] *
+                        (clk - window_start_) * config_.tCK;
+    return served_[qos] * config_.request_size_bytes < guaranteed;
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,65 @@
+#ifndef __QOS_H
+#define __QOS_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "configuration.h"
+#include "simple_stats.h"
+
+namespace dramsim3 {
+
+// Arbitrates between QoS classes (e.g. latency critical vs. batch tenants).
+// A class is urgent when its oldest outstanding read missed the latency target
+// or when it got less than its guaranteed bandwidth in the current window;
+// the rest is shared in proportion to the class weights.
+class QoS {
+   public:
+    QoS(const Config& config, SimpleStats& simple_stats);
+    bool IsEnabled() const { return num_classes_ > 1; }
+    // the controller schedules from the read queue, the write buffer or
+    // both (unified queue), only those transactions make a class backlogged
+    void Update(bool reads, bool writes, uint64_t clk);
+    const std::vector<int>& ClassOrder() const { return class_order_; }
+    // bit mask of urgent classes, used by the command queue arbitration
+    uint32_t UrgentMask() const { return urgent_mask_; }
+    bool HasLateReads() const { return late_reads_; }
+    // a transaction entered a transaction queue, and left it for the
+    // command queue
+    void TransQueued(const Transaction& trans);
+    void TransScheduled(const Transaction& trans);
+    // a read is outstanding from the time it is added until its READ
+    // command is issued
+    void ReadPending(const Transaction& trans);
+    void ReadIssued(const Transaction& trans);
+    void TransDone(const Transaction& trans, uint64_t clk);
+
+   private:
+    const Config& config_;
+    SimpleStats& simple_stats_;
+    int num_classes_;
+    uint64_t window_start_;
+
+    // per class bookkeeping
+    std::vector<uint64_t> served_;
+    std::vector<double> vtime_;
+    std::vector<int> queued_reads_;
+    std::vector<int> queued_writes_;
+    std::vector<bool> backlogged_;
+    // outstanding reads by arrival cycle, reads are issued out of order so
+    // each entry counts the reads left of that cycle and empty heads are
+    // dropped, the head is the oldest outstanding read
+    std::vector<std::deque<std::pair<uint64_t, int>>> pending_reads_;
+    std::vector<int> urgency_;
+    std::vector<std::string> latency_stat_names_;
+
+    std::vector<int> class_order_;
+    uint32_t urgent_mask_;
+    bool late_reads_;
+
+    bool BelowGuarantee(int qos, uint64_t clk) const;
+};
+
+}  // namespace dramsim3
+#endif
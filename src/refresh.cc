@@ -1,84 +1,168 @@
 #include "refresh.h"
 
+#include <assert.h>
+#include <algorithm>
+
 namespace dramsim3 {
-Refresh::Refresh(const Config &config, ChannelState &channel_state)
+Refresh::Refresh(const Config &config, ChannelState &channel_state,
+                 const CommandQueue &cmd_queue, SimpleStats &simple_stats)
     : clk_(0),
       config_(config),
       channel_state_(channel_state),
+      cmd_queue_(cmd_queue),
+      simple_stats_(simple_stats),
       refresh_policy_(config.refresh_policy),
-      next_rank_(0),
-      next_bg_(0),
-      next_bank_(0) {
+      next_refresh_(config.ranks, 0),
+      owed_(config.ranks, 0),
+      opportunistic_(config.refresh_max_postpone > 0 ||
+                     config.refresh_max_pull_in > 0),
+      refresh_scale_(config.ranks, 1),
+      // a same bank refresh covers a bank in every bankgroup
+      bank_refreshed_(
+          config.ranks,
+          std::vector<bool>(
+              refresh_policy_ == RefreshPolicy::SAME_BANK_STAGGERED
+                  ? config.banks_per_group
+                  : config.banks,
+              false)),
+      flexible_bank_order_(config.protocol == DRAMProtocol::LPDDR4 ||
+                           config.protocol == DRAMProtocol::LPDDR5 ||
+                           config.IsDDR5()) {
+    // staggered ranks take turns, one every refresh slot
+    int slot;
     if (refresh_policy_ == RefreshPolicy::RANK_LEVEL_SIMULTANEOUS) {
-        refresh_interval_ = config_.tREFI;
+        slot = config_.tREFI;
     } else if (refresh_policy_ == RefreshPolicy::BANK_LEVEL_STAGGERED) {
-        refresh_interval_ = config_.tREFIb;
+        slot = config_.tREFIb;
+    } else if (refresh_policy_ == RefreshPolicy::SAME_BANK_STAGGERED) {
+        slot = config_.tREFI / config_.banks_per_group / config_.ranks;
     } else {  // default refresh scheme: RANK STAGGERED
-        refresh_interval_ = config_.tREFI / config_.ranks;
+        slot = config_.tREFI / config_.ranks;
+    }
+    for (int i = 0; i < config_.ranks; i++) {
+        next_refresh_[i] =
+            refresh_policy_ == RefreshPolicy::RANK_LEVEL_SIMULTANEOUS
+                ? slot
+                : slot * (i + 1);
     }
+    refresh_interval_ =
+        refresh_policy_ == RefreshPolicy::RANK_LEVEL_SIMULTANEOUS
+            ? slot
+            : slot * config_.ranks;
+
+    // postpone/pull-in limits are in all bank refreshes, which is
+    // worth a whole round of per bank refreshes
+    int unit = refresh_policy_ == RefreshPolicy::BANK_LEVEL_STAGGERED ||
+                       refresh_policy_ == RefreshPolicy::SAME_BANK_STAGGERED
+                   ? static_cast<int>(bank_refreshed_[0].size())
+                   : 1;
+    max_owed_ = config_.refresh_max_postpone * unit;
+    max_pulled_in_ = config_.refresh_max_pull_in * unit;
+}
+
+void Refresh::SetRefreshScale(int rank, int scale) {
+    // a faster rate applies from the next refresh on, a slower one from
+    // the one after
+    assert(scale >= 1);
+    refresh_scale_[rank] = scale;
+    next_refresh_[rank] =
+        std::min(next_refresh_[rank], clk_ + refresh_interval_ / scale);
+    return;
 }
 
 void Refresh::ClockTick() {
-    if (clk_ % refresh_interval_ == 0 && clk_ > 0) {
-        InsertRefresh();
+    for (int i = 0; i < config_.ranks; i++) {
+        if (clk_ == next_refresh_[i]) {
+            // ranks in self-refresh take care of themselves
+            if (!channel_state_.IsRankSelfRefreshing(i)) {
+                owed_[i]++;
+            }
+            next_refresh_[i] += refresh_interval_ / refresh_scale_[i];
+        }
+    }
+    for (int i = 0; i < config_.ranks; i++) {
+        if (owed_[i] > max_owed_) {
+            QueueRefresh(i, true);
+        } else if (opportunistic_ && owed_[i] > -max_pulled_in_ &&
+                   !channel_state_.IsRefreshWaiting()) {
+            // catch up on postponed refreshes or pull in future ones
+            // while there is nothing queued up for the rank or bank
+            QueueRefresh(i, false);
+        }
     }
     clk_++;
     return;
 }
 
-void Refresh::InsertRefresh() {
-    switch (refresh_policy_) {
-        // Simultaneous all rank refresh
-        case RefreshPolicy::RANK_LEVEL_SIMULTANEOUS:
-            for (auto i = 0; i < config_.ranks; i++) {
-                if (!channel_state_.IsRankSelfRefreshing(i)) {
-                    channel_state_.RankNeedRefresh(i, true);
-                    break;
-                }
-            }
-            break;
-        // Staggered all rank refresh
-        case RefreshPolicy::RANK_LEVEL_STAGGERED:
-            if (!channel_state_.IsRankSelfRefreshing(next_rank_)) {
-                channel_state_.RankNeedRefresh(next_rank_, true);
-            }
-            IterateNext();
-            break;
-        // Fully staggered per bank refresh
-        case RefreshPolicy::BANK_LEVEL_STAGGERED:
-            if (!channel_state_.IsRankSelfRefreshing(next_rank_)) {
-                channel_state_.BankNeedRefresh(next_rank_, next_bg_, next_bank_,
-                                               true);
-            }
-            IterateNext();
-            break;
-        default:
-            AbruptExit(__FILE__, __LINE__);
+bool Refresh::QueueRefresh(int rank, bool forced) {
+    if (channel_state_.IsRankSelfRefreshing(rank)) {
+        return false;
+    }
+    if (refresh_policy_ == RefreshPolicy::BANK_LEVEL_STAGGERED ||
+        refresh_policy_ == RefreshPolicy::SAME_BANK_STAGGERED) {
+        int idx = NextBankToRefresh(rank, forced);
+        if (idx < 0) {
+            return false;
+        }
+        if (refresh_policy_ == RefreshPolicy::SAME_BANK_STAGGERED) {
+            channel_state_.SameBankNeedRefresh(rank, idx, true);
+        } else {
+            channel_state_.BankNeedRefresh(rank, idx % config_.bankgroups,
+                                           idx / config_.bankgroups, true);
+        }
+        auto &refreshed = bank_refreshed_[rank];
+        refreshed[idx] = true;
+        if (std::find(refreshed.begin(), refreshed.end(), false) ==
+            refreshed.end()) {
+            std::fill(refreshed.begin(), refreshed.end(), false);
+        }
+    } else {
+        if (!forced && !cmd_queue_.RankQueueEmpty(rank)) {
+            return false;
+        }
+        channel_state_.RankNeedRefresh(rank, true);
+    }
+    if (!forced) {
+        simple_stats_.Increment(owed_[rank] > 0 ? "num_opportunistic_refs"
+                                                : "num_pulled_in_refs");
+    }
+    owed_[rank] -= 1;
+    return true;
+}
+
+int Refresh::NextBankToRefresh(int rank, bool forced) const {
+    // every bank is refreshed once per round, in the fixed JEDEC order
+    // unless the protocol allows the controller to pick an idle bank
+    int first = -1;
+    const auto &refreshed = bank_refreshed_[rank];
+    for (int i = 0; i < static_cast<int>(refreshed.size()); i++) {
+        if (refreshed[i]) {
+            continue;
+        }
+        if (first < 0) {
+            first = i;
+        }
+        if (BanksIdle(rank, i)) {
+            return i;
+        }
+        if (!flexible_bank_order_) {
             break;
+        }
     }
-    return;
+    return forced ? first : -1;
 }
 
-void Refresh::IterateNext() {
-    switch (refresh_policy_) {
-        case RefreshPolicy::RANK_LEVEL_STAGGERED:
-            next_rank_ = (next_rank_ + 1) % config_.ranks;
-            return;
-        case RefreshPolicy::BANK_LEVEL_STAGGERED:
-            // Note - the order issuing bank refresh commands is static and
-            // non-configurable as per JEDEC standard
-            next_bg_ = (next_bg_ + 1) % config_.bankgroups;
-            if (next_bg_ == 0) {
-                next_bank_ = (next_bank_ + 1) % config_.banks_per_group;
-                if (next_bank_ == 0) {
-                    next_rank_ = (next_rank_ + 1) % config_.ranks;
-                }
+bool Refresh::BanksIdle(int rank, int idx) const {
+    if (refresh_policy_ == RefreshPolicy::SAME_BANK_STAGGERED) {
+        for (int j = 0; j < config_.bankgroups; j++) {
+            if (!cmd_queue_.BankQueueEmpty(rank, j, idx)) {
+                return false;
             }
-            return;
-        default:
-            AbruptExit(__FILE__, __LINE__);
-            return;
+        }
+        return true;
     }
+    return cmd_queue_.BankQueueEmpty(rank, idx % config_.bankgroups,
+                                     idx / config_.bankgroups);
 }
 
 }  // namespace dramsim3
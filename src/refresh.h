@@ -3,30 +3,53 @@
 
 #include <vector>
 #include "channel_state.h"
+#include "command_queue.h"
 #include "common.h"
 #include "configuration.h"
+#include "simple_stats.h"
 
 namespace dramsim3 {
 
 class Refresh {
    public:
-    Refresh(const Config& config, ChannelState& channel_state);
+    Refresh(const Config& config, ChannelState& channel_state,
+            const CommandQueue& cmd_queue, SimpleStats& simple_stats);
     void ClockTick();
+    // refresh a rank scale times as often, e.g. 2x above 85C
+    void SetRefreshScale(int rank, int scale);
 
    private:
     uint64_t clk_;
-    int refresh_interval_;
+    int refresh_interval_;  // of each rank
     const Config& config_;
     ChannelState& channel_state_;
+    const CommandQueue& cmd_queue_;
+    SimpleStats& simple_stats_;
     RefreshPolicy refresh_policy_;
 
-    int next_rank_, next_bg_, next_bank_;
-
-    void InsertRefresh();
-
-    void IterateNext();
+    // when the next refresh of each rank is due, every rank owes one
+    // refresh each refresh_interval_ / refresh_scale_ cycles
+    std::vector<uint64_t> next_refresh_;
+
+    // refreshes owed by each rank, negative when pulled in ahead of time,
+    // a refresh is only forced once more than max_owed_ are postponed
+    std::vector<int> owed_;
+    int max_owed_;
+    int max_pulled_in_;
+    bool opportunistic_;
+    std::vector<int> refresh_scale_;
+
+    // banks of each rank already refreshed in the current per bank round
+    std::vector<std::vector<bool> > bank_refreshed_;
+    // LPDDR4/5 and DDR5 let the controller pick the order of bank refreshes
+    bool flexible_bank_order_;
+
+    bool QueueRefresh(int rank, bool forced);
+    int NextBankToRefresh(int rank, bool forced) const;
+    // whether nothing is queued for the banks covered by a bank refresh
+    bool BanksIdle(int rank, int idx) const;
 };
 
 }  // namespace dramsim3
 
-#endif
\ No newline at end of file
+#endif
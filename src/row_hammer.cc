@@ -0,0 +1,157 @@
+#include "row_hammer.h"
+
+#include <algorithm>
+
+namespace dramsim3 {
+
+RowHammer::RowHammer(const Config& config, SimpleStats& simple_stats)
+    : config_(config),
+      simple_stats_(simple_stats),
+      mitigation_(config.row_hammer_mitigation),
+      enabled_(mitigation_ != RowHammerMitigation::NONE ||
+               config.hammer_threshold > 0),
+      refreshes_per_window_(8192 * config.fgr_mode),
+      para_dist_(config.para_probability) {
+    int num_banks = config_.ranks * config_.banks;
+    row_acts_.resize(num_banks);
+    trr_table_.resize(num_banks);
+    raa_.resize(num_banks, 0);
+    refreshes_.resize(num_banks, 0);
+    rfm_pending_.resize(num_banks, false);
+    victim_row_.resize(num_banks, -1);
+}
+
+void RowHammer::Activate(const Command& cmd) {
+    if (!enabled_) {
+        return;
+    }
+    int bank = BankIndex(cmd);
+    int row = cmd.Row();
+    int acts = ++row_acts_[bank][row];
+    if (acts == config_.hammer_threshold) {
+        simple_stats_.Increment("num_hammered_rows");
+    }
+
+    int target = -1;
+    switch (mitigation_) {
+        case RowHammerMitigation::PARA:
+            if (para_dist_(gen_)) {
+                target = row;
+            }
+            break;
+        case RowHammerMitigation::TRR:
+            if (TRRUpdate(bank, row)) {
+                target = row;
+            }
+            break;
+        case RowHammerMitigation::RFM:
+            raa_[bank]++;
+            if (raa_[bank] >= config_.rfm_raaimt) {
+                // the DRAM picks the victims, assume it tracks perfectly
+                target = MostActivatedRow(bank);
+            }
+            break;
+        default:
+            break;
+    }
+    // one outstanding RFM covers the bank until it is issued
+    if (target < 0 || rfm_pending_[bank]) {
+        return;
+    }
+    rfm_pending_[bank] = true;
+    victim_row_[bank] = target;
+}
+
+int RowHammer::Precharge(const Command& cmd) {
+    if (!enabled_) {
+        return -1;
+    }
+    int bank = BankIndex(cmd);
+    int row = victim_row_[bank];
+    victim_row_[bank] = -1;
+    return row;
+}
+
+void RowHammer::Refresh(const Command& cmd) {
+    if (!enabled_) {
+        return;
+    }
+    if (cmd.cmd_type == CommandType::REFRESH) {
+        int first = cmd.Rank() * config_.banks;
+        for (int i = first; i < first + config_.banks; i++) {
+            RefreshBank(i);
+        }
+    } else if (cmd.IsSameBankCMD()) {
+        for (int j = 0; j < config_.bankgroups; j++) {
+            RefreshBank((cmd.Rank() * config_.bankgroups + j) *
+                            config_.banks_per_group +
+                        cmd.Bank());
+        }
+    } else {
+        RefreshBank(BankIndex(cmd));
+    }
+}
+
+void RowHammer::TargetedRefresh(const Command& cmd) {
+    int bank = BankIndex(cmd);
+    rfm_pending_[bank] = false;
+    // the neighbors are restored so the aggressor starts over
+    row_acts_[bank].erase(cmd.Row());
+    if (mitigation_ == RowHammerMitigation::RFM) {
+        raa_[bank] = std::max(0, raa_[bank] - config_.rfm_raaimt);
+    }
+}
+
+bool RowHammer::TRRUpdate(int bank, int row) {
+    // space saving counters: an untracked row evicts the smallest entry and
+    // inherits its count, so no row can be undercounted
+    auto& table = trr_table_[bank];
+    auto it = std::find_if(
+        table.begin(), table.end(),
+        [row](const std::pair<int, int>& entry) { return entry.first == row; });
+    if (it != table.end()) {
+        it->second++;
+    } else if (static_cast<int>(table.size()) < config_.trr_table_size) {
+        table.emplace_back(row, 1);
+        it = table.end() - 1;
+    } else {
+        it = std::min_element(
+            table.begin(), table.end(),
+            [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+                return a.second < b.second;
+            });
+        it->first = row;
+        it->second++;
+    }
+    if (it->second >= config_.trr_threshold) {
+        it->second = 0;
+        return true;
+    }
+    return false;
+}
+
+int RowHammer::MostActivatedRow(int bank) const {
+    int row = -1;
+    int max_acts = 0;
+    for (const auto& it : row_acts_[bank]) {
+        if (it.second > max_acts) {
+            row = it.first;
+            max_acts = it.second;
+        }
+    }
+    return row;
+}
+
+void RowHammer::RefreshBank(int bank) {
+    if (mitigation_ == RowHammerMitigation::RFM) {
+        raa_[bank] = std::max(0, raa_[bank] - config_.rfm_raaimt);
+    }
+    refreshes_[bank]++;
+    if (refreshes_[bank] >= refreshes_per_window_) {
+        refreshes_[bank] = 0;
+        row_acts_[bank].clear();
+        trr_table_[bank].clear();
+    }
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,65 @@
+#ifndef __ROW_HAMMER_H
+#define __ROW_HAMMER_H
+
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "common.h"
+#include "configuration.h"
+#include "simple_stats.h"
+
+namespace dramsim3 {
+
+// Tracks row activations and decides when a bank needs a targeted refresh
+// of the neighbors of a hammered row, issued as an RFM command by all
+// mitigations but counted as num_trr_cmds for PARA and TRR.
+// PARA refreshes the neighbors of an activated row with a fixed probability,
+// TRR keeps a small table of frequently activated rows per bank and refreshes
+// a row's neighbors once its counter crosses the threshold, and RFM follows
+// DDR5 by counting rolling accumulated ACTs (RAA) per bank.
+class RowHammer {
+   public:
+    RowHammer(const Config& config, SimpleStats& simple_stats);
+    bool IsEnabled() const { return enabled_; }
+    void Activate(const Command& cmd);
+    // the victims are refreshed once the aggressor row is closed, so the
+    // accesses that opened it are not preempted, returns the row whose
+    // neighbors need to be refreshed, -1 if none
+    int Precharge(const Command& cmd);
+    void Refresh(const Command& cmd);
+    void TargetedRefresh(const Command& cmd);
+
+   private:
+    const Config& config_;
+    SimpleStats& simple_stats_;
+    RowHammerMitigation mitigation_;
+    bool enabled_;
+    // refreshes it takes to go through all rows, after which every victim
+    // has been restored and the activation counts start over
+    int refreshes_per_window_;
+
+    // per bank, indexed by BankIndex()
+    std::vector<std::unordered_map<int, int> > row_acts_;
+    std::vector<std::vector<std::pair<int, int> > > trr_table_;
+    std::vector<int> raa_;
+    std::vector<int> refreshes_;
+    std::vector<bool> rfm_pending_;
+    // aggressor row waiting for the bank to be precharged, -1 if none
+    std::vector<int> victim_row_;
+
+    std::mt19937_64 gen_;
+    std::bernoulli_distribution para_dist_;
+
+    int BankIndex(const Command& cmd) const {
+        return (cmd.Rank() * config_.bankgroups + cmd.Bankgroup()) *
+                   config_.banks_per_group +
+               cmd.Bank();
+    }
+    bool TRRUpdate(int bank, int row);
+    int MostActivatedRow(int bank) const;
+    void RefreshBank(int bank);
+};
+
+}  // namespace dramsim3
+#endif
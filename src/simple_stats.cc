@@ -23,7 +23,14 @@ SimpleStats::SimpleStats(const Config& config, int channel_id)
     InitStat("epoch_num", "counter", "Number of epochs");
     InitStat("num_reads_done", "counter", "Number of read requests issued");
     InitStat("num_writes_done", "counter", "Number of read requests issued");
-    InitStat("num_write_buf_hits", "counter", "Number of write buffer hits");
+    InitStat("num_write_buf_hits", "counter",
+             "Number of reads forwarded from write buffer");
+    InitStat("num_write_buf_partial_hits", "counter",
+             "Number of reads partially overlapping write buffer");
+    InitStat("num_coalesced_writes", "counter",
+             "Number of writes coalesced in write buffer");
+    InitStat("num_dropped_writes", "counter",
+             "Number of duplicate writes dropped in write buffer");
     InitStat("num_read_row_hits", "counter", "Number of read row buffer hits");
     InitStat("num_write_row_hits", "counter",
              "Number of write row buffer hits");
@@ -32,10 +39,18 @@ SimpleStats::SimpleStats(const Config& config, int channel_id)
     InitStat("num_act_cmds", "counter", "Number of ACT commands");
     InitStat("num_pre_cmds", "counter", "Number of PRE commands");
     InitStat("num_ondemand_pres", "counter", "Number of ondemend PRE commands");
+    InitStat("num_aggressive_pres", "counter",
+             "Number of aggressive PRE commands");
     InitStat("num_ref_cmds", "counter", "Number of REF commands");
     InitStat("num_refb_cmds", "counter", "Number of REFb commands");
+    InitStat("num_opportunistic_refs", "counter",
+             "Number of postponed refreshes issued while idle");
+    InitStat("num_pulled_in_refs", "counter",
+             "Number of refreshes pulled in while idle");
     InitStat("num_srefe_cmds", "counter", "Number of SREFE commands");
     InitStat("num_srefx_cmds", "counter", "Number of SREFX commands");
+    InitStat("dual_cmds", "counter", "Number of cycles dual cmds issued");
+    // the old name, still output for existing scripts
     InitStat("hbm_dual_cmds", "counter", "Number of cycles dual cmds issued");
 
     // double stats
@@ -52,6 +67,13 @@ SimpleStats::SimpleStats(const Config& config, int channel_id)
                 "rank", config_.ranks);
     InitVecStat("sref_cycles", "vec_counter", "Cyles of rank in SREF mode",
                 "rank", config_.ranks);
+#ifdef THERMAL
+    if (config_.temp_aware_refresh) {
+        InitVecStat("hot_rank_epochs", "vec_counter",
+                    "Epochs of rank above refresh temperature threshold",
+                    "rank", config_.ranks);
+    }
+#endif  // THERMAL
 
     // Vector of double stats
     InitVecStat("act_stb_energy", "vec_double", "Active standby energy", "rank",
@@ -75,6 +97,67 @@ SimpleStats::SimpleStats(const Config& config, int channel_id)
              "Average read request latency (cycles)");
     InitStat("average_interarrival", "calculated",
              "Average request interarrival latency (cycles)");
+
+    if (config_.refresh_policy == RefreshPolicy::SAME_BANK_STAGGERED) {
+        InitStat("num_refsb_cmds", "counter", "Number of REFsb commands");
+        InitStat("refsb_energy", "double", "Same bank refresh energy");
+    }
+
+    // row hammer mitigation overhead
+    if (config_.row_hammer_mitigation == RowHammerMitigation::RFM) {
+        InitStat("num_rfm_cmds", "counter",
+                 "Number of RFM (victim row refresh) commands");
+        InitStat("rfm_energy", "double", "RFM energy");
+    } else if (config_.row_hammer_mitigation != RowHammerMitigation::NONE) {
+        InitStat("num_trr_cmds", "counter",
+                 "Number of PARA/TRR neighbor row refreshes");
+        InitStat("trr_energy", "double", "PARA/TRR neighbor refresh energy");
+    }
+    if (config_.hammer_threshold > 0) {
+        InitStat("num_hammered_rows", "counter",
+                 "Number of rows activated hammer_threshold times");
+    }
+
+    // power down residency and energy
+    if (config_.enable_power_down) {
+        InitStat("num_pde_cmds", "counter", "Number of PDE commands");
+        InitStat("num_pdx_cmds", "counter", "Number of PDX commands");
+        InitVecStat("act_pd_cycles", "vec_counter",
+                    "Cyles of rank in active power down", "rank",
+                    config_.ranks);
+        InitVecStat("pre_pd_cycles", "vec_counter",
+                    "Cyles of rank in precharge power down", "rank",
+                    config_.ranks);
+        InitVecStat("act_pd_energy", "vec_double", "Active power down energy",
+                    "rank", config_.ranks);
+        InitVecStat("pre_pd_energy", "vec_double",
+                    "Precharge power down energy", "rank", config_.ranks);
+    }
+
+    // per QoS class stats, only when there is more than one class
+    if (config_.qos_classes > 1) {
+        InitVecStat("qos_reads_done", "vec_counter",
+                    "Number of read requests done", "class",
+                    config_.qos_classes);
+        InitVecStat("qos_writes_done", "vec_counter",
+                    "Number of write requests done", "class",
+                    config_.qos_classes);
+        InitVecStat("qos_urgent_cycles", "vec_counter",
+                    "Cycles of missed latency target or bandwidth guarantee",
+                    "class", config_.qos_classes);
+        for (int i = 0; i < config_.qos_classes; i++) {
+            auto suffix = "_qos" + std::to_string(i);
+            InitHistoStat("read_latency" + suffix,
+                          "Read request latency (cycles) of class " +
+                              std::to_string(i),
+                          0, 200, 10);
+            InitStat("average_bandwidth" + suffix, "calculated",
+                     "Average bandwidth of class " + std::to_string(i));
+            InitStat("average_read_latency" + suffix, "calculated",
+                     "Average read request latency (cycles) of class " +
+                         std::to_string(i));
+        }
+    }
 }
 
 void SimpleStats::AddValue(const std::string name, const int value) {
@@ -99,9 +182,14 @@ std::string SimpleStats::GetTextHeader(bool is_final) const {
 }
 
 double SimpleStats::RankBackgroundEnergy(const int rank) const{
-    return vec_doubles_.at("act_stb_energy")[rank] +
-           vec_doubles_.at("pre_stb_energy")[rank] +
-           vec_doubles_.at("sref_energy")[rank];
+    double energy = vec_doubles_.at("act_stb_energy")[rank] +
+                    vec_doubles_.at("pre_stb_energy")[rank] +
+                    vec_doubles_.at("sref_energy")[rank];
+    if (config_.enable_power_down) {
+        energy += vec_doubles_.at("act_pd_energy")[rank] +
+                  vec_doubles_.at("pre_pd_energy")[rank];
+    }
+    return energy;
 }
 
 void SimpleStats::PrintEpochStats() {
@@ -375,6 +463,22 @@ void SimpleStats::UpdateEpochStats() {
         epoch_counters_["num_ref_cmds"] * config_.ref_energy_inc;
     doubles_["refb_energy"] =
         epoch_counters_["num_refb_cmds"] * config_.refb_energy_inc;
+    double row_hammer_energy = 0.0;
+    if (config_.row_hammer_mitigation == RowHammerMitigation::RFM) {
+        row_hammer_energy =
+            epoch_counters_["num_rfm_cmds"] * config_.rfm_energy_inc;
+        doubles_["rfm_energy"] = row_hammer_energy;
+    } else if (config_.row_hammer_mitigation != RowHammerMitigation::NONE) {
+        row_hammer_energy =
+            epoch_counters_["num_trr_cmds"] * config_.trr_energy_inc;
+        doubles_["trr_energy"] = row_hammer_energy;
+    }
+    double refsb_energy = 0.0;
+    if (config_.refresh_policy == RefreshPolicy::SAME_BANK_STAGGERED) {
+        refsb_energy =
+            epoch_counters_["num_refsb_cmds"] * config_.refsb_energy_inc;
+        doubles_["refsb_energy"] = refsb_energy;
+    }
 
     // vector doubles, update first, then push
     double background_energy = 0.0;
@@ -389,6 +493,15 @@ void SimpleStats::UpdateEpochStats() {
         vec_doubles_["pre_stb_energy"][i] = pre_stb;
         vec_doubles_["sref_energy"][i] = sref_energy;
         background_energy += act_stb + pre_stb + sref_energy;
+        if (config_.enable_power_down) {
+            double act_pd = epoch_vec_counters_["act_pd_cycles"][i] *
+                            config_.act_pd_energy_inc;
+            double pre_pd = epoch_vec_counters_["pre_pd_cycles"][i] *
+                            config_.pre_pd_energy_inc;
+            vec_doubles_["act_pd_energy"][i] = act_pd;
+            vec_doubles_["pre_pd_energy"][i] = pre_pd;
+            background_energy += act_pd + pre_pd;
+        }
     }
 
     UpdateHistoBins();
@@ -402,13 +515,15 @@ void SimpleStats::UpdateEpochStats() {
 
     double total_energy = doubles_["act_energy"] + doubles_["read_energy"] +
                           doubles_["write_energy"] + doubles_["ref_energy"] +
-                          doubles_["refb_energy"] + background_energy;
+                          doubles_["refb_energy"] + row_hammer_energy +
+                          refsb_energy + background_energy;
     calculated_["total_energy"] = total_energy;
     calculated_["average_power"] = total_energy / epoch_counters_["num_cycles"];
     calculated_["average_read_latency"] =
         GetHistoAvg(epoch_histo_counts_.at("read_latency"));
     calculated_["average_interarrival"] =
         GetHistoAvg(epoch_histo_counts_.at("interarrival_latency"));
+    UpdateQoSStats(true);
 
     UpdatePrints(true);
     for (auto& it : epoch_counters_) {
@@ -435,6 +550,21 @@ void SimpleStats::UpdateFinalStats() {
     doubles_["ref_energy"] = counters_["num_ref_cmds"] * config_.ref_energy_inc;
     doubles_["refb_energy"] =
         counters_["num_refb_cmds"] * config_.refb_energy_inc;
+    double row_hammer_energy = 0.0;
+    if (config_.row_hammer_mitigation == RowHammerMitigation::RFM) {
+        row_hammer_energy =
+            counters_["num_rfm_cmds"] * config_.rfm_energy_inc;
+        doubles_["rfm_energy"] = row_hammer_energy;
+    } else if (config_.row_hammer_mitigation != RowHammerMitigation::NONE) {
+        row_hammer_energy =
+            counters_["num_trr_cmds"] * config_.trr_energy_inc;
+        doubles_["trr_energy"] = row_hammer_energy;
+    }
+    double refsb_energy = 0.0;
+    if (config_.refresh_policy == RefreshPolicy::SAME_BANK_STAGGERED) {
+        refsb_energy = counters_["num_refsb_cmds"] * config_.refsb_energy_inc;
+        doubles_["refsb_energy"] = refsb_energy;
+    }
 
     // vector doubles, update first, then push
     double background_energy = 0.0;
@@ -449,6 +579,15 @@ void SimpleStats::UpdateFinalStats() {
         vec_doubles_["pre_stb_energy"][i] = pre_stb;
         vec_doubles_["sref_energy"][i] = sref_energy;
         background_energy += act_stb + pre_stb + sref_energy;
+        if (config_.enable_power_down) {
+            double act_pd = vec_counters_["act_pd_cycles"][i] *
+                            config_.act_pd_energy_inc;
+            double pre_pd = vec_counters_["pre_pd_cycles"][i] *
+                            config_.pre_pd_energy_inc;
+            vec_doubles_["act_pd_energy"][i] = act_pd;
+            vec_doubles_["pre_pd_energy"][i] = pre_pd;
+            background_energy += act_pd + pre_pd;
+        }
     }
 
     // histograms
@@ -463,7 +602,8 @@ void SimpleStats::UpdateFinalStats() {
 
     double total_energy = doubles_["act_energy"] + doubles_["read_energy"] +
                           doubles_["write_energy"] + doubles_["ref_energy"] +
-                          doubles_["refb_energy"] + background_energy;
+                          doubles_["refb_energy"] + row_hammer_energy +
+                          refsb_energy + background_energy;
     calculated_["total_energy"] = total_energy;
     calculated_["average_power"] = total_energy / counters_["num_cycles"];
     // calculated_["average_read_latency"] = GetHistoAvg("read_latency");
@@ -471,9 +611,29 @@ void SimpleStats::UpdateFinalStats() {
         GetHistoAvg(histo_counts_.at("read_latency"));
     calculated_["average_interarrival"] =
         GetHistoAvg(histo_counts_.at("interarrival_latency"));
+    UpdateQoSStats(false);
 
     UpdatePrints(false);
     return;
 }
 
+void SimpleStats::UpdateQoSStats(bool epoch) {
+    if (config_.qos_classes <= 1) {
+        return;
+    }
+    auto& ref_counters = epoch ? epoch_counters_ : counters_;
+    auto& ref_vcounters = epoch ? epoch_vec_counters_ : vec_counters_;
+    auto& ref_histos = epoch ? epoch_histo_counts_ : histo_counts_;
+    double total_time = ref_counters["num_cycles"] * config_.tCK;
+    for (int i = 0; i < config_.qos_classes; i++) {
+        auto suffix = "_qos" + std::to_string(i);
+        uint64_t reqs = ref_vcounters["qos_reads_done"][i] +
+                        ref_vcounters["qos_writes_done"][i];
+        calculated_["average_bandwidth" + suffix] =
+            reqs * config_.request_size_bytes / total_time;
+        calculated_["average_read_latency" + suffix] =
+            GetHistoAvg(ref_histos.at("read_latency" + suffix));
+    }
+}
+
 }  // namespace dramsim3
\ No newline at end of file
@@ -17,13 +17,18 @@ class SimpleStats {
     // incrementing counter
     void Increment(const std::string name) { epoch_counters_[name] += 1; }
 
+    // increment counter by number
+    void IncrementBy(const std::string name, uint64_t num) {
+        epoch_counters_[name] += num;
+    }
+
     // incrementing for vec counter
     void IncrementVec(const std::string name, int pos) {
         epoch_vec_counters_[name][pos] += 1;
     }
 
     // increment vec counter by number
-    void IncrementVecBy(const std::string name, int pos, int num) {
+    void IncrementVecBy(const std::string name, int pos, uint64_t num) {
         epoch_vec_counters_[name][pos] += num;
     }
 
@@ -61,6 +66,7 @@ class SimpleStats {
     std::string GetTextHeader(bool is_final) const;
     void UpdateEpochStats();
     void UpdateFinalStats();
+    void UpdateQoSStats(bool epoch);
 
     const Config& config_;
     int channel_id_;
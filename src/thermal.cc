@@ -1,22 +1,43 @@
 #include "thermal.h"
 
-extern "C" double *steady_thermal_solver(double ***powerM, double W, double Lc,
-                                         int numP, int dimX, int dimZ,
-                                         double **Midx, int count,
-                                         double Tamb_);
-extern "C" double *transient_thermal_solver(double ***powerM, double W,
-                                            double L, int numP, int dimX,
-                                            int dimZ, double **Midx,
-                                            int MidxSize, double *Cap,
-                                            int CapSize, double time, int iter,
-                                            double *T_trans, double Tamb_);
+#ifdef THERMAL_SUPERLU
+extern "C" void *steady_thermal_factorize(int numP, int dimX, int dimZ,
+                                          double **Midx, int count);
+extern "C" void steady_thermal_free(void *lu);
+extern "C" void steady_thermal_solver(void *lu, const double *power, double W,
+                                      double Lc, int numP, int dimX, int dimZ,
+                                      double Tamb_, double *T);
+#endif  // THERMAL_SUPERLU
+extern "C" void *transient_thermal_operator(int numP, int dimX, int dimZ,
+                                            double **Midx, int MidxSize,
+                                            double *Cap, double time,
+                                            int iter);
+extern "C" void transient_thermal_free(void *op);
+extern "C" void transient_thermal_solver(void *op, const double *power,
+                                         double W, double L, int numP,
+                                         int dimX, int dimZ, int iter,
+                                         double *T_trans, double Tamb_,
+                                         double *work);
+extern "C" void *pcg_thermal_system(int numP, int dimX, int dimZ,
+                                    double **Midx, int MidxSize, double *Cap,
+                                    double dt, double tol);
+extern "C" void pcg_thermal_free(void *sys);
+extern "C" int pcg_steady_thermal_solver(void *sys, const double *power,
+                                         double W, double Lc, int numP,
+                                         int dimX, int dimZ,
+                                         const double *T_guess, double Tamb_,
+                                         double *T, double *work);
+extern "C" void pcg_transient_thermal_solver(void *sys, const double *power,
+                                             double W, double Lc, int numP,
+                                             int dimX, int dimZ, int iter,
+                                             double *T_trans, double Tamb_,
+                                             double *work);
+extern "C" int thermal_work_size(int numP, int dimX, int dimZ);
 extern "C" double **calculate_Midx_array(double W, double Lc, int numP,
                                          int dimX, int dimZ, int *MidxSize,
                                          double Tamb_);
 extern "C" double *calculate_Cap_array(double W, double Lc, int numP, int dimX,
                                        int dimZ, int *CapSize);
-extern "C" double *initialize_Temperature(double W, double Lc, int numP,
-                                          int dimX, int dimZ, double Tamb_);
 
 namespace dramsim3 {
 
@@ -26,6 +47,8 @@ ThermalCalculator::ThermalCalculator(const Config &config)
     : config_(config),
       time_iter0(10),
       sample_id(0),
+      trans_pending_(false),
+      epoch_clk_(0),
       background_energy_(config_.channels,
                          std::vector<double>(config_.ranks, 0)),
       avg_logic_power_(0.0) {
@@ -59,6 +82,8 @@ ThermalCalculator::ThermalCalculator(const Config &config)
         num_case = 1;
     } else {
         numP = 1;
+        vault_x = 1;
+        vault_y = 1;
         bank_x = determineXY(config_.bank_asr, 1.0, config_.banks);
         bank_y = config_.banks / bank_x;
 
@@ -86,21 +111,33 @@ ThermalCalculator::ThermalCalculator(const Config &config)
     SetPhyAddressMapping();
 
     // Initialize the vectors
-    accu_Pmap = std::vector<std::vector<double>>(
-        num_case, std::vector<double>(numP * dimX * dimY, 0));
-    cur_Pmap = std::vector<std::vector<double>>(
-        num_case, std::vector<double>(numP * dimX * dimY, 0));
+    accu_Pmap = ThermalMap(num_case, numP * dimX * dimY, 0);
+    cur_Pmap = ThermalMap(num_case, numP * dimX * dimY, 0);
+    epoch_Pmap = ThermalMap(num_case, numP * dimX * dimY, 0);
+    refresh_Pmap = ThermalMap(num_case, numP * dimX * dimY, 0);
+    epoch_power_ = std::vector<double>(num_case, 0);
+    final_power_ = std::vector<double>(num_case, 0);
+    solve_iters_ = std::vector<int>(num_case, 0);
     T_size = (numP * 3 + 1) * (dimX + num_dummy) * (dimY + num_dummy);
-    T_trans = new double *[num_case];
-    T_final = new double *[num_case];
-    for (int i = 0; i < num_case; i++) {
-        T_trans[i] = new double[T_size];
-    }
+    T_trans = ThermalMap(num_case, T_size, Tamb);
+    T_final = ThermalMap(num_case, T_size, 0);
+
+    // cases are independent, each solver thread has its own power map and
+    // scratch space and they share the read-only operators
+    num_threads_ = std::max(1, std::min(config_.thermal_threads, num_case));
+    powerM = ThermalMap(num_threads_,
+                        numP * (dimX + num_dummy) * (dimY + num_dummy), 0);
+    solver_work_ = ThermalMap(
+        num_threads_,
+        thermal_work_size(numP, dimX + num_dummy, dimY + num_dummy), 0);
 
     InitialParameters();
+    InitLocationTables();
 
     refresh_count = std::vector<std::vector<int>>(
         config_.channels * config_.ranks, std::vector<int>(config_.banks, 0));
+    max_temps_ = std::vector<std::vector<double>>(
+        num_case, std::vector<double>(numP, config_.amb_temp));
 
     if (config_.output_level >= 0) {
         // Initialize the output file
@@ -127,7 +164,20 @@ ThermalCalculator::ThermalCalculator(const Config &config)
     }
 }
 
-ThermalCalculator::~ThermalCalculator() {}
+ThermalCalculator::~ThermalCalculator() {
+    if (solver_.joinable()) {
+        solver_.join();
+    }
+#ifdef THERMAL_SUPERLU
+    steady_thermal_free(steady_lu_);
+#endif  // THERMAL_SUPERLU
+    transient_thermal_free(transient_op_);
+    pcg_thermal_free(steady_pcg_);
+    pcg_thermal_free(transient_pcg_);
+    for (int i = 0; i < MidxSize; i++) free(Midx[i]);
+    free(Midx);
+    free(Cap);
+}
 
 void ThermalCalculator::SetPhyAddressMapping() {
     std::string mapping_string = config_.loc_mapping;
@@ -249,7 +299,7 @@ std::pair<int, int> ThermalCalculator::MapToVault(int channel_id) {
             std::swap(vault_id_x, vault_id_y);
         }
     } else if (config_.IsHBM()) {
-        vault_id_y = channel_id % 2;
+        vault_id_y = (channel_id / config_.subchannels) % 2;
         vault_id_x = 0;
     }
     return std::make_pair(vault_id_x, vault_id_y);
@@ -299,7 +349,7 @@ std::pair<int, int> ThermalCalculator::MapToBank(int bankgroup_id,
     return std::make_pair(bank_id_x, bank_id_y);
 }
 
-int ThermalCalculator::MapToZ(int channel_id, int bank_id) {
+int ThermalCalculator::MapToZ(int channel_id, int bank_id) const {
     int z;
     if (config_.IsHMC()) {
         int num_bank_per_layer = config_.banks / config_.num_dies;
@@ -308,122 +358,126 @@ int ThermalCalculator::MapToZ(int channel_id, int bank_id) {
         else
             z = numP - bank_id / num_bank_per_layer - 2;
     } else if (config_.IsHBM()) {
-        z = channel_id / 2;
+        // pseudo channels share the banks area of their channel
+        z = (channel_id / config_.subchannels) / 2;
     } else {
         z = 0;
     }
+    if (z < 0 || z >= std::max(numP - 1, 1)) {
+        std::cerr << "Channel " << channel_id << " maps to layer " << z
+                  << " of " << numP << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
     return z;
 }
 
-std::pair<std::vector<int>, std::vector<int>> ThermalCalculator::MapToXY(
-    const Command &cmd, int vault_id_x, int vault_id_y, int bank_id_x,
-    int bank_id_y) {
-    std::vector<int> x;
-    std::vector<int> y;
-
-    int row_id = cmd.Row();
-    int col_tile_id = row_id / config_.tile_row_num;
-    int grid_id_x = row_id / config_.mat_dim_x / config_.row_tile;
+void ThermalCalculator::InitLocationTables() {
+    bank_cells_.resize(config_.channels * config_.banks);
+    for (int ch = 0; ch < config_.channels; ch++) {
+        int vault_id_x, vault_id_y;
+        std::tie(vault_id_x, vault_id_y) = MapToVault(ch);
+        for (int ib = 0; ib < config_.banks; ib++) {
+            int bankgroup_id = ib / config_.banks_per_group;
+            int bank_id = ib % config_.banks_per_group;
+            int bank_id_x, bank_id_y;
+            std::tie(bank_id_x, bank_id_y) = MapToBank(bankgroup_id, bank_id);
+            int x = (vault_id_x * bank_x + bank_id_x) * config_.num_x_grids;
+            int y = (vault_id_y * bank_y + bank_id_y) * config_.num_y_grids;
+            int z = MapToZ(ch, bank_id);
+            bank_cells_[ch * config_.banks + ib] = (z * dimY + y) * dimX + x;
+        }
+    }
 
-    Address temp_addr = Address(cmd.addr);
-    for (int i = 0; i < config_.BL; i++) {
-        Address phy_loc = GetPhyAddress(temp_addr);
-        int col_id = phy_loc.column * config_.device_width;
-        int bank_x_offset = bank_x * config_.num_x_grids;
-        int bank_y_offset = bank_y * config_.num_y_grids;
-        for (int j = 0; j < config_.device_width; j++) {
-            int grid_id_y =
-                col_id / config_.mat_dim_y +
-                col_tile_id * (config_.num_y_grids / config_.row_tile);
-            int temp_x = vault_id_x * bank_x_offset +
-                         bank_id_x * config_.num_x_grids + grid_id_x;
-            x.push_back(temp_x);
-            int temp_y = vault_id_y * bank_y_offset +
-                         bank_id_y * config_.num_y_grids + grid_id_y;
-            y.push_back(temp_y);
-            col_id++;
-        }
-        temp_addr.column++;
-    }
-    return std::make_pair(x, y);
-}
-
-void ThermalCalculator::LocationMappingANDaddEnergy(const int channel,
-                                                    const Command &cmd,
-                                                    int bank0, int row0,
-                                                    int caseID_,
-                                                    double add_energy) {
-    // get vault x y first
-    int vault_id_x, vault_id_y;
-    std::tie(vault_id_x, vault_id_y) = MapToVault(channel);
-
-    // get bank id x y
-    int bank_id_x, bank_id_y;
-    std::tie(bank_id_x, bank_id_y) = MapToBank(cmd.Bankgroup(), cmd.Bank());
+    // tile_row_num is a multiple of mat_dim_x so the rows of a mat always
+    // land on the same cells
+    int num_mats = (config_.rows + config_.mat_dim_x - 1) / config_.mat_dim_x;
+    row_cells_.resize(num_mats);
+    for (int i = 0; i < num_mats; i++) {
+        int row_id = i * config_.mat_dim_x;
+        int col_tile_id = row_id / config_.tile_row_num;
+        int grid_id_x = row_id / config_.mat_dim_x / config_.row_tile;
+        int grid_id_y = col_tile_id * (config_.num_y_grids / config_.row_tile);
+        row_cells_[i] = grid_id_y * dimX + grid_id_x;
+    }
 
-    // calculate x y z
-    auto xy = MapToXY(cmd, vault_id_x, vault_id_y, bank_id_x, bank_id_y);
-    auto &x = xy.first;
-    auto &y = xy.second;
-    int z = MapToZ(channel, cmd.Bank());
+    phy_rows_.resize(config_.rows);
+    for (int i = 0; i < config_.rows; i++) {
+        phy_rows_[i] = GetPhyAddress(Address(0, 0, 0, 0, i, 0)).row;
+    }
+    // an access covers BL columns starting from the addressed one
+    phy_cols_.resize(config_.columns + config_.BL);
+    for (size_t i = 0; i < phy_cols_.size(); i++) {
+        phy_cols_[i] = GetPhyAddress(Address(0, 0, 0, 0, 0, i)).column;
+    }
+}
 
-    int z_offset = z * dimX * dimY;
-    double energy = add_energy / config_.device_width;
-    // add energy to engergy map
-    // iterate x y (they have same size)
-    for (size_t i = 0; i < x.size(); i++) {
-        int y_offset = y[i] * dimX;
-        int idx = z_offset + y_offset + x[i];
-        accu_Pmap[caseID_][idx] += energy;
-        cur_Pmap[caseID_][idx] += energy;
-    }
-}
-
-void ThermalCalculator::LocationMappingANDaddEnergy_RF(const int channel,
-                                                       const Command &cmd,
-                                                       int bank0, int row0,
-                                                       int caseID_,
-                                                       double add_energy) {
-    // the caller will provide bank and row that needs to be refreshed
-    // so we get a new address and modify it to obtain the actual mapping
-    // bank0 passed here is the absolute bank index within a rank, need to
-    // reverse it
-    int bankgroup_id = bank0 / config_.banks_per_group;
-    int bank_id = bank0 % config_.banks_per_group;
+// refreshes the next num_row_refresh rows of a bank, bank is the absolute
+// bank index within the rank
+void ThermalCalculator::AddRefreshEnergy(const int channel, const Command &cmd,
+                                         int bank, int case_id,
+                                         double add_energy) {
+    int rank_idx = channel * config_.ranks + cmd.Rank();
+    int row_s = refresh_count[rank_idx][bank] * config_.num_row_refresh;
+    int row_e = std::min(row_s + config_.num_row_refresh, config_.rows);
+    refresh_count[rank_idx][bank]++;
+    if (row_e == config_.rows) refresh_count[rank_idx][bank] = 0;
+
+    // the bits the rest of the address maps into the row
     Address new_addr = Address(cmd.addr);
-    new_addr.row = row0;
-    new_addr.bankgroup = bankgroup_id;
-    new_addr.bank = bank_id;
-
-    int vault_id_x, vault_id_y;
-    std::tie(vault_id_x, vault_id_y) = MapToVault(channel);
-
-    // get bank id x y
-    int bank_id_x, bank_id_y;
-    std::tie(bank_id_x, bank_id_y) = MapToBank(bankgroup_id, bank_id);
+    new_addr.bankgroup = bank / config_.banks_per_group;
+    new_addr.bank = bank % config_.banks_per_group;
+    new_addr.row = 0;
+    int row_bits = GetPhyAddress(new_addr).row;
+
+    int cell = bank_cells_[channel * config_.banks + bank];
+    double *p_map = refresh_Pmap[case_id];
+    for (int ir = row_s; ir < row_e; ir++) {
+        int row_id = row_bits | phy_rows_[ir];  // actual row after mapping
+        p_map[cell + row_cells_[row_id / config_.mat_dim_x]] += add_energy;
+    }
+}
 
-    int z = MapToZ(channel, bank_id);
+void ThermalCalculator::AddAccessEnergy(const int channel, const Command &cmd,
+                                        int case_id, double add_energy) {
+    // only the columns go through the location mapping
+    int bank = cmd.Bankgroup() * config_.banks_per_group + cmd.Bank();
+    int cell = bank_cells_[channel * config_.banks + bank] +
+               row_cells_[cmd.Row() / config_.mat_dim_x];
+    Address new_addr = Address(cmd.addr);
+    new_addr.column = 0;
+    int col_bits = GetPhyAddress(new_addr).column;
 
-    Address phy_addr = GetPhyAddress(new_addr);  // actual row after mapping
-    // calculate x y z
-    int row_id = phy_addr.row;
-    int col_id = 0;  // refresh all units
-    int col_tile_id = row_id / config_.tile_row_num;
-    int grid_id_x = row_id / config_.mat_dim_x / config_.row_tile;
-    int grid_id_y = col_id / config_.mat_dim_y +
-                    col_tile_id * (config_.num_y_grids / config_.row_tile);
-    int x = vault_id_x * (bank_x * config_.num_x_grids) +
-            bank_id_x * config_.num_x_grids + grid_id_x;
-    int y = vault_id_y * (bank_y * config_.num_y_grids) +
-            bank_id_y * config_.num_y_grids + grid_id_y;
+    double energy = add_energy / config_.device_width;
+    double *p_map = cur_Pmap[case_id];
+    for (int i = 0; i < config_.BL; i++) {
+        int col_id = (col_bits | phy_cols_[cmd.Column() + i]) *
+                     config_.device_width;
+        for (int j = 0; j < config_.device_width; j++) {
+            p_map[cell + (col_id + j) / config_.mat_dim_y * dimX] += energy;
+        }
+    }
+}
 
-    int z_offset = z * (dimX * dimY);
-    for (int i = 0; i < config_.num_y_grids; i++) {
-        int y_offset = y * dimX;
-        int idx = z_offset + y_offset + x;
-        accu_Pmap[caseID_][idx] += add_energy;
-        cur_Pmap[caseID_][idx] += add_energy;
-        y++;
+// spreads the refreshed rows over their cells and adds the command energy
+// of the epoch to the accumulative power map, before any background energy
+// goes into cur_Pmap
+void ThermalCalculator::ScatterEpochEnergy() {
+    int map_size = numP * dimX * dimY;
+    for (int ir = 0; ir < num_case; ir++) {
+        double *refresh = refresh_Pmap[ir];
+        double *cur = cur_Pmap[ir];
+        double *accu = accu_Pmap[ir];
+        for (int i = 0; i < map_size; i++) {
+            if (refresh[i] != 0) {
+                for (int j = 0; j < config_.num_y_grids; j++) {
+                    cur[i + j * dimX] += refresh[i];
+                }
+                refresh[i] = 0;
+            }
+        }
+        for (int i = 0; i < map_size; i++) {
+            accu[i] += cur[i];
+        }
     }
 }
 
@@ -461,34 +515,35 @@ void ThermalCalculator::UpdateCMDPower(const int channel, const Command &cmd,
 
     double energy = 0.0;
     if (cmd.cmd_type == CommandType::REFRESH) {
-        int rank_idx = channel * config_.ranks + rank;
+        energy = config_.ref_energy_inc / config_.num_row_refresh /
+                 config_.banks / config_.num_y_grids;
         for (int ib = 0; ib < config_.banks; ib++) {
-            int row_s = refresh_count[rank_idx][ib] * config_.num_row_refresh;
-            refresh_count[rank_idx][ib]++;
-            if (refresh_count[rank_idx][ib] * config_.num_row_refresh ==
-                config_.rows)
-                refresh_count[rank_idx][ib] = 0;
-            energy = config_.ref_energy_inc / config_.num_row_refresh /
-                     config_.banks / config_.num_y_grids;
-            for (int ir = row_s; ir < row_s + config_.num_row_refresh; ir++) {
-                LocationMappingANDaddEnergy_RF(channel, cmd, ib, ir, case_id,
-                                               energy / 1000.0 / device_scale);
-            }
+            AddRefreshEnergy(channel, cmd, ib, case_id,
+                             energy / 1000.0 / device_scale);
+        }
+    } else if (cmd.cmd_type == CommandType::REFRESH_SAME_BANK) {
+        // the same bank of every bankgroup
+        energy = config_.refsb_energy_inc / config_.bankgroups /
+                 config_.num_row_refresh / config_.num_y_grids;
+        for (int j = 0; j < config_.bankgroups; j++) {
+            int ib = j * config_.banks_per_group + cmd.Bank();
+            AddRefreshEnergy(channel, cmd, ib, case_id,
+                             energy / 1000.0 / device_scale);
         }
     } else if (cmd.cmd_type == CommandType::REFRESH_BANK) {
-        int ib = cmd.Bank();
-        int rank_idx = channel * config_.ranks + rank;
-        int row_s = refresh_count[rank_idx][ib] * config_.num_row_refresh;
-        refresh_count[rank_idx][ib]++;
-        if (refresh_count[rank_idx][ib] * config_.num_row_refresh ==
-            config_.rows)
-            refresh_count[rank_idx][ib] = 0;
         energy = config_.refb_energy_inc / config_.num_row_refresh /
                  config_.num_y_grids;
-        for (int ir = row_s; ir < row_s + config_.num_row_refresh; ir++) {
-            LocationMappingANDaddEnergy_RF(channel, cmd, ib, ir, case_id,
-                                           energy / 1000.0 / device_scale);
-        }
+        AddRefreshEnergy(channel, cmd, cmd.Bank(), case_id,
+                         energy / 1000.0 / device_scale);
+    } else if (cmd.cmd_type == CommandType::RFM) {
+        // victim rows of the target bank are refreshed like a bank refresh
+        int ib = cmd.Bankgroup() * config_.banks_per_group + cmd.Bank();
+        energy = config_.row_hammer_mitigation == RowHammerMitigation::RFM
+                     ? config_.rfm_energy_inc
+                     : config_.trr_energy_inc;
+        energy = energy / config_.num_row_refresh / config_.num_y_grids;
+        AddRefreshEnergy(channel, cmd, ib, case_id,
+                         energy / 1000.0 / device_scale);
     } else {
         switch (cmd.cmd_type) {
             case CommandType::ACTIVATE:
@@ -508,8 +563,8 @@ void ThermalCalculator::UpdateCMDPower(const int channel, const Command &cmd,
         }
         if (energy > 0) {
             energy /= config_.BL;
-            LocationMappingANDaddEnergy(channel, cmd, -1, -1, case_id,
-                                        energy / 1000.0 / device_scale);
+            AddAccessEnergy(channel, cmd, case_id,
+                            energy / 1000.0 / device_scale);
         }
     }
     return;
@@ -538,7 +593,7 @@ void ThermalCalculator::UpdateEpoch(uint64_t clk) {
                 int case_id = i * config_.ranks + j;
                 double bg_energy =
                     background_energy_[i][j] / (dimX * dimY * numP);
-                for (int k = 0; k < dimX * dimY * numP; i++) {
+                for (int k = 0; k < dimX * dimY * numP; k++) {
                     cur_Pmap[case_id][k] += bg_energy / 1000 / num_devices;
                 }
             }
@@ -547,18 +602,82 @@ void ThermalCalculator::UpdateEpoch(uint64_t clk) {
     return;
 }
 
+double ThermalCalculator::GetRankTemperature(int channel, int rank) const {
+    if (config_.IsHBM()) {
+        // each HBM channel pair sits on its own die
+        return max_temps_[0][MapToZ(channel, 0)];
+    }
+    // HMC vaults span all dies, DDRx ranks are separate cases
+    int case_id = config_.IsHMC() ? 0 : channel * config_.ranks + rank;
+    const auto &temps = max_temps_[case_id];
+    return *std::max_element(temps.begin(), temps.end());
+}
+
 void ThermalCalculator::SetLogicPower(double logic_power) {
     avg_logic_power_ = logic_power;
 }
 
 void ThermalCalculator::PrintTransPT(uint64_t clk) {
+    // the previous epoch is reported first so the output stays in order
+    FinishTransT();
+    ScatterEpochEnergy();
     UpdateEpoch(clk);
-    double ms = clk * config_.tCK * 1e-6;
+    std::swap(cur_Pmap, epoch_Pmap);
+    cur_Pmap.Fill(0.0);
+    epoch_clk_ = clk;
+    trans_pending_ = true;
+    if (config_.async_solve) {
+        // only epoch_Pmap, powerM and T_trans are touched by the solve
+        solver_ = std::thread(&ThermalCalculator::SolveTransT, this);
+    } else {
+        SolveTransT();
+        FinishTransT();
+    }
+}
+
+void ThermalCalculator::SolveTransT() {
+    ForEachCase([this](int case_id, int thread_id) {
+        CalcTransT(case_id, thread_id);
+    });
+}
+
+void ThermalCalculator::ForEachCase(
+    const std::function<void(int case_id, int thread_id)> &calc) {
+    if (num_threads_ == 1) {
+        for (int ir = 0; ir < num_case; ir++) {
+            calc(ir, 0);
+        }
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads_; t++) {
+        threads.emplace_back([this, &calc, t]() {
+            for (int ir = t; ir < num_case; ir += num_threads_) {
+                calc(ir, t);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void ThermalCalculator::FinishTransT() {
+    if (solver_.joinable()) {
+        solver_.join();
+    }
+    if (!trans_pending_) {
+        return;
+    }
+    trans_pending_ = false;
+    double ms = epoch_clk_ * config_.tCK * 1e-6;
     for (int ir = 0; ir < num_case; ir++) {
-        CalcTransT(ir);
+        std::cout << "total trans power is " << epoch_power_[ir] * 1000
+                  << " [mW]" << std::endl;
         double maxT = 0;
         for (int layer = 0; layer < numP; layer++) {
             double maxT_layer = GetMaxTofCaseLayer(T_trans, ir, layer);
+            max_temps_[ir][layer] = maxT_layer;
             epoch_max_temp_file_csv_ << layer << "," << maxT_layer << "," << ms
                                      << std::endl;
             // << layer << "," << stats_.average_power.epoch_value << ","
@@ -571,17 +690,18 @@ void ThermalCalculator::PrintTransPT(uint64_t clk) {
                   << " ms\n";
         // only outputs full file when output level >= 2
         if (config_.output_level >= 2) {
-            PrintCSV_trans(epoch_temperature_file_csv_, cur_Pmap, T_trans, ir,
+            PrintCSV_trans(epoch_temperature_file_csv_, epoch_Pmap, T_trans, ir,
                            config_.epoch_period);
         }
     }
-    for (size_t i = 0; i < cur_Pmap.size(); i++) {
-        std::fill_n(cur_Pmap[i].begin(), numP * dimX * dimY, 0.0);
-    }
     sample_id += 1;
 }
 
 void ThermalCalculator::PrintFinalPT(uint64_t clk) {
+    // the steady solve starts from the last transient temperatures
+    FinishTransT();
+    ScatterEpochEnergy();
+    cur_Pmap.Fill(0.0);
     if (config_.IsHBM() || config_.IsHMC()) {
         double bg_energy = 0;
         for (const auto &vec_rank_energy : background_energy_) {
@@ -598,15 +718,30 @@ void ThermalCalculator::PrintFinalPT(uint64_t clk) {
                 int case_id = i * config_.ranks + j;
                 double bg_energy =
                     background_energy_[i][j] / (dimX * dimY * numP);
-                for (int k = 0; k < dimX * dimY * numP; i++) {
-                    accu_Pmap[case_id][i] += bg_energy / 1000 / num_devices;
+                for (int k = 0; k < dimX * dimY * numP; k++) {
+                    accu_Pmap[case_id][k] += bg_energy / 1000 / num_devices;
                 }
             }
         }
     }
     // calculate the final temperature for each case
+    if (config_.thermal_solver == ThermalSolver::PCG) {
+        ForEachCase([this, clk](int case_id, int thread_id) {
+            CalcFinalT(case_id, thread_id, clk);
+        });
+    } else {
+        // the SuperLU solves share the factors' statistics
+        for (int ir = 0; ir < num_case; ir++) {
+            CalcFinalT(ir, 0, clk);
+        }
+    }
     for (int ir = 0; ir < num_case; ir++) {
-        CalcFinalT(ir, clk);
+        std::cout << "total final power is " << final_power_[ir] * 1000
+                  << " [mW]" << std::endl;
+        if (config_.thermal_solver == ThermalSolver::PCG) {
+            std::cout << "PCG steady solve took " << solve_iters_[ir]
+                      << " iterations" << std::endl;
+        }
         double maxT = GetMaxTofCase(T_final, ir);
         std::cout << "MaxT of case " << ir << " is " << maxT << " [C]\n";
         // print to file
@@ -622,65 +757,68 @@ void ThermalCalculator::PrintFinalPT(uint64_t clk) {
     }
 }
 
-void ThermalCalculator::CalcTransT(int case_id) {
-    double time = config_.epoch_period * config_.tCK * 1e-9;
-    double ***powerM = InitPowerM(case_id, 0);
-    double totP = GetTotalPower(powerM);
-    std::cout << "total trans power is " << totP * 1000 << " [mW]" << std::endl;
-    T_trans[case_id] = transient_thermal_solver(
-        powerM, config_.chip_dim_x, config_.chip_dim_y, numP, dimX + num_dummy,
-        dimY + num_dummy, Midx, MidxSize, Cap, CapSize, time, time_iter,
-        T_trans[case_id], Tamb);
-}
-
-void ThermalCalculator::CalcFinalT(int case_id, uint64_t clk) {
-    double ***powerM = InitPowerM(case_id, clk);
-    double totP = GetTotalPower(powerM);
-    std::cout << "total final power is " << totP * 1000 << " [mW]" << std::endl;
-    double *T = steady_thermal_solver(
-        powerM, config_.chip_dim_x, config_.chip_dim_y, numP, dimX + num_dummy,
-        dimY + num_dummy, Midx, MidxSize, Tamb);
-    T_final[case_id] = T;
-}
-
-double ***ThermalCalculator::InitPowerM(int case_id, uint64_t clk) {
-    double ***powerM;
-    // assert in powerM
-    powerM = new double **[dimX + num_dummy];
-    for (int i = 0; i < dimX + num_dummy; i++) {
-        powerM[i] = new double *[dimY + num_dummy];
-        for (int j = 0; j < dimY + num_dummy; j++) {
-            powerM[i][j] = new double[numP];
-        }
-    }
-    // initialize powerM
-    for (int i = 0; i < dimX + num_dummy; i++)
-        for (int j = 0; j < dimY + num_dummy; j++)
-            std::fill_n(powerM[i][j], numP, 0.0);
+void ThermalCalculator::CalcTransT(int case_id, int thread_id) {
+    double *power = powerM[thread_id];
+    double *work = solver_work_[thread_id];
+    InitPowerM(case_id, 0, power);
+    epoch_power_[case_id] = GetTotalPower(power);
+    if (config_.thermal_solver == ThermalSolver::PCG) {
+        pcg_transient_thermal_solver(transient_pcg_, power, config_.chip_dim_x,
+                                     config_.chip_dim_y, numP, dimX + num_dummy,
+                                     dimY + num_dummy, time_iter,
+                                     T_trans[case_id], Tamb, work);
+        return;
+    }
+    transient_thermal_solver(transient_op_, power, config_.chip_dim_x,
+                             config_.chip_dim_y, numP, dimX + num_dummy,
+                             dimY + num_dummy, time_iter, T_trans[case_id],
+                             Tamb, work);
+}
 
+void ThermalCalculator::CalcFinalT(int case_id, int thread_id, uint64_t clk) {
+    double *power = powerM[thread_id];
+    InitPowerM(case_id, clk, power);
+    final_power_[case_id] = GetTotalPower(power);
+    if (config_.thermal_solver == ThermalSolver::PCG) {
+        // the last transient temperatures are a good first guess
+        solve_iters_[case_id] = pcg_steady_thermal_solver(
+            steady_pcg_, power, config_.chip_dim_x, config_.chip_dim_y, numP,
+            dimX + num_dummy, dimY + num_dummy, T_trans[case_id], Tamb,
+            T_final[case_id], solver_work_[thread_id]);
+        return;
+    }
+#ifdef THERMAL_SUPERLU
+    steady_thermal_solver(steady_lu_, power, config_.chip_dim_x,
+                          config_.chip_dim_y, numP, dimX + num_dummy,
+                          dimY + num_dummy, Tamb, T_final[case_id]);
+#endif  // THERMAL_SUPERLU
+}
+
+void ThermalCalculator::InitPowerM(int case_id, uint64_t clk,
+                                   double *power) const {
     // when clk is 0 then it's trans otherwise it's final
     double div = clk == 0 ? (double)config_.epoch_period : (double)clk;
-    auto &power_map = clk == 0 ? cur_Pmap : accu_Pmap;
-    // fill in powerM
-    for (int i = 0; i < dimX; i++) {
+    const double *power_map =
+        clk == 0 ? epoch_Pmap[case_id] : accu_Pmap[case_id];
+    // the dummy cells around the die stay 0
+    int pitch = dimX + num_dummy;
+    int layer_size = pitch * (dimY + num_dummy);
+    int offset = num_dummy / 2 * pitch + num_dummy / 2;
+    for (int l = 0; l < numP; l++) {
         for (int j = 0; j < dimY; j++) {
-            for (int l = 0; l < numP; l++) {
-                powerM[i + num_dummy / 2][j + num_dummy / 2][l] =
-                    power_map[case_id][l * (dimX * dimY) + j * dimX + i] / div;
+            double *row = &power[l * layer_size + j * pitch + offset];
+            const double *src = &power_map[l * (dimX * dimY) + j * dimX];
+            for (int i = 0; i < dimX; i++) {
+                row[i] = src[i] / div;
             }
         }
     }
-    return powerM;
 }
 
-double ThermalCalculator::GetTotalPower(double ***powerM) {
+double ThermalCalculator::GetTotalPower(const double *power) const {
     double total_power = 0.0;
-    for (int i = 0; i < dimX; i++) {
-        for (int j = 0; j < dimY; j++) {
-            for (int l = 0; l < numP; l++) {
-                total_power += powerM[i + num_dummy / 2][j + num_dummy / 2][l];
-            }
-        }
+    for (int i = 0; i < numP * (dimX + num_dummy) * (dimY + num_dummy); i++) {
+        total_power += power[i];
     }
     return total_power;
 }
@@ -693,14 +831,32 @@ void ThermalCalculator::InitialParameters() {
                                 Tamb);
     Cap = calculate_Cap_array(config_.chip_dim_x, config_.chip_dim_y, numP,
                               dimX + num_dummy, dimY + num_dummy, &CapSize);
-    calculate_time_step();
 
-    for (int ir = 0; ir < num_case; ir++) {
-        double *T =
-            initialize_Temperature(config_.chip_dim_x, config_.chip_dim_y, numP,
-                                   dimX + num_dummy, dimY + num_dummy, Tamb);
-        for (int i = 0; i < T_size; i++) T_trans[ir][i] = T[i];
-        free(T);
+    // the conductance matrix and the time step only depend on the geometry,
+    // so factorize / assemble them once and reuse them for every solve
+    double time = config_.epoch_period * config_.tCK * 1e-9;
+    steady_lu_ = nullptr;
+    transient_op_ = nullptr;
+    steady_pcg_ = nullptr;
+    transient_pcg_ = nullptr;
+    if (config_.thermal_solver == ThermalSolver::PCG) {
+        // backward Euler is stable for any step size
+        time_iter = time_iter0;
+        transient_pcg_ = pcg_thermal_system(
+            numP, dimX + num_dummy, dimY + num_dummy, Midx, MidxSize, Cap,
+            time / time_iter, config_.pcg_tolerance);
+        steady_pcg_ =
+            pcg_thermal_system(numP, dimX + num_dummy, dimY + num_dummy, Midx,
+                               MidxSize, Cap, 0, config_.pcg_tolerance);
+    } else {
+        calculate_time_step();
+        transient_op_ =
+            transient_thermal_operator(numP, dimX + num_dummy, dimY + num_dummy,
+                                       Midx, MidxSize, Cap, time, time_iter);
+#ifdef THERMAL_SUPERLU
+        steady_lu_ = steady_thermal_factorize(numP, dimX + num_dummy,
+                                              dimY + num_dummy, Midx, MidxSize);
+#endif  // THERMAL_SUPERLU
     }
 }
 
@@ -759,7 +915,8 @@ void ThermalCalculator::calculate_time_step() {
     std::cout << "time_iter = " << time_iter << std::endl;
 }
 
-double ThermalCalculator::GetMaxTofCase(double **temp_map, int case_id) {
+double ThermalCalculator::GetMaxTofCase(const ThermalMap &temp_map,
+                                        int case_id) const {
     double maxT = 0;
     for (int i = 0; i < T_size; i++) {
         if (temp_map[case_id][i] > maxT) {
@@ -769,8 +926,8 @@ double ThermalCalculator::GetMaxTofCase(double **temp_map, int case_id) {
     return maxT;
 }
 
-double ThermalCalculator::GetMaxTofCaseLayer(double **temp_map, int case_id,
-                                             int layer) {
+double ThermalCalculator::GetMaxTofCaseLayer(const ThermalMap &temp_map,
+                                             int case_id, int layer) const {
     double maxT = 0;
     int layer_pos_offset =
         (layerP[layer] + 1) * ((dimX + num_dummy) * (dimY + num_dummy));
@@ -786,8 +943,9 @@ double ThermalCalculator::GetMaxTofCaseLayer(double **temp_map, int case_id,
 }
 
 void ThermalCalculator::PrintCSV_trans(std::ofstream &csvfile,
-                                       std::vector<std::vector<double>> P_,
-                                       double **T_, int id, uint64_t scale) {
+                                       const ThermalMap &P_,
+                                       const ThermalMap &T_, int id,
+                                       uint64_t scale) {
     for (int l = 0; l < numP; l++) {
         for (int j = num_dummy / 2; j < dimY + num_dummy / 2; j++) {
             for (int i = num_dummy / 2; i < dimX + num_dummy / 2; i++) {
@@ -808,8 +966,9 @@ void ThermalCalculator::PrintCSV_trans(std::ofstream &csvfile,
 }
 
 void ThermalCalculator::PrintCSV_final(std::ofstream &csvfile,
-                                       std::vector<std::vector<double>> P_,
-                                       double **T_, int id, uint64_t scale) {
+                                       const ThermalMap &P_,
+                                       const ThermalMap &T_, int id,
+                                       uint64_t scale) {
     for (int l = 0; l < numP; l++) {
         for (int j = num_dummy / 2; j < dimY + num_dummy / 2; j++) {
             for (int i = num_dummy / 2; i < dimX + num_dummy / 2; i++) {
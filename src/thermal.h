@@ -2,10 +2,12 @@
 #define __THERMAL_H
 
 #include <time.h>
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include "bankstate.h"
 #include "common.h"
@@ -16,6 +18,25 @@ namespace dramsim3 {
 
 extern std::function<Address(const Address &addr)> GetPhyAddress;
 
+// the power or temperature map of every case in one contiguous block, each
+// case is a flat layer-major array with x changing fastest, which is what the
+// solvers read and write, so maps are reused across epochs without copies
+class ThermalMap {
+   public:
+    ThermalMap() : case_size_(0) {}
+    ThermalMap(int num_case, int case_size, double value)
+        : case_size_(case_size), data_(num_case * case_size, value) {}
+    double *operator[](int case_id) { return &data_[case_id * case_size_]; }
+    const double *operator[](int case_id) const {
+        return &data_[case_id * case_size_];
+    }
+    void Fill(double value) { std::fill(data_.begin(), data_.end(), value); }
+
+   private:
+    size_t case_size_;
+    std::vector<double> data_;
+};
+
 class ThermalCalculator {
    public:
     ThermalCalculator(const Config &config);
@@ -30,47 +51,47 @@ class ThermalCalculator {
     void PrintTransPT(uint64_t clk);
     void PrintFinalPT(uint64_t clk);
     void UpdateLogicPower(double logic_power);
+    // max temperature [C] of a rank in the last epoch
+    double GetRankTemperature(int channel, int rank) const;
 
    private:
     // Initialization
-    double ***InitPowerM(int case_id, uint64_t clk);
+    void InitPowerM(int case_id, uint64_t clk, double *power) const;
     void InitialParameters();
 
     // location mapping functions
     void SetPhyAddressMapping();
+    void InitLocationTables();
     std::pair<int, int> MapToVault(int channel_id);
     std::pair<int, int> MapToBank(int bankgroup_id, int bank_id);
-    int MapToZ(int channel_id, int bank_id);
-    std::pair<std::vector<int>, std::vector<int>> MapToXY(const Command &cmd,
-                                                          int vault_id_x,
-                                                          int vault_id_y,
-                                                          int bank_id_x,
-                                                          int bank_id_y);
-    void LocationMappingANDaddEnergy_RF(const int channel, const Command &cmd,
-                                        int bank0, int row0, int caseID_,
-                                        double add_energy);
-    void LocationMappingANDaddEnergy(const int channel, const Command &cmd,
-                                     int bank0, int row0, int caseID_,
-                                     double add_energy);
+    int MapToZ(int channel_id, int bank_id) const;
+    void AddRefreshEnergy(const int channel, const Command &cmd, int bank,
+                          int case_id, double add_energy);
+    void AddAccessEnergy(const int channel, const Command &cmd, int case_id,
+                         double add_energy);
+    void ScatterEpochEnergy();
     void UpdatePowerMaps(double add_energy, bool trans, uint64_t clk);
 
     // calculations
-    void CalcTransT(int case_id);
-    void CalcFinalT(int case_id, uint64_t clk);
-    double GetTotalPower(double ***powerM);
+    void SolveTransT();
+    void FinishTransT();
+    void ForEachCase(
+        const std::function<void(int case_id, int thread_id)> &calc);
+    void CalcTransT(int case_id, int thread_id);
+    void CalcFinalT(int case_id, int thread_id, uint64_t clk);
+    double GetTotalPower(const double *power) const;
     int square_array(int total_grids_);
     int determineXY(double xd, double yd, int total_grids_);
-    double GetMaxTofCase(double **temp_map, int case_id);
-    double GetMaxTofCaseLayer(double **temp_map, int case_id, int layer);
+    double GetMaxTofCase(const ThermalMap &temp_map, int case_id) const;
+    double GetMaxTofCaseLayer(const ThermalMap &temp_map, int case_id,
+                              int layer) const;
     void calculate_time_step();
 
     // print to csv-files
-    void PrintCSV_trans(std::ofstream &csvfile,
-                        std::vector<std::vector<double>> P_, double **T_,
-                        int id, uint64_t scale);
-    void PrintCSV_final(std::ofstream &csvfile,
-                        std::vector<std::vector<double>> P_, double **T_,
-                        int id, uint64_t scale);
+    void PrintCSV_trans(std::ofstream &csvfile, const ThermalMap &P_,
+                        const ThermalMap &T_, int id, uint64_t scale);
+    void PrintCSV_final(std::ofstream &csvfile, const ThermalMap &P_,
+                        const ThermalMap &T_, int id, uint64_t scale);
     void PrintCSVHeader_final(std::ofstream &csvfile);
     void PrintCSV_bank(std::ofstream &csvfile);
 
@@ -85,16 +106,52 @@ class ThermalCalculator {
     double **Midx;          // Midx storing thermal conductance
     double *Cap;            // Cap storing the thermal capacitance
     int MidxSize, CapSize;  // first dimension size of Midx and Cap
+    void *steady_lu_;       // LU factors of Midx for the steady solver
+    void *transient_op_;    // explicit update operator of the transient solver
+    void *steady_pcg_;      // G for the pcg steady solver
+    void *transient_pcg_;   // C/dt + G for the pcg transient solver
     int T_size;
-    double **T_trans, **T_final;
+    ThermalMap T_trans, T_final;  // [K] and [C]
+    // per solver thread: the input power, numP layers of the die plus the
+    // dummy cells around it, and the solver's scratch space
+    int num_threads_;
+    ThermalMap powerM;
+    ThermalMap solver_work_;
 
     int sample_id;  // index of the sampling power
 
-    std::vector<std::vector<double>> accu_Pmap;  // accumulative power map
-    std::vector<std::vector<double>> cur_Pmap;   // current power map
+    ThermalMap accu_Pmap;   // accumulative power map
+    ThermalMap cur_Pmap;    // current power map
+    ThermalMap epoch_Pmap;  // power map of the epoch being solved
+    // refresh energy of the current epoch, kept at the first cell of the
+    // num_y_grids cells a refreshed row covers and spread out once per epoch
+    ThermalMap refresh_Pmap;
+
+    // location mapping tables, built once so that a command only looks up
+    // the cells it heats:
+    // first cell of every bank, indexed by channel * banks + absolute bank
+    std::vector<int> bank_cells_;
+    // offset within a bank of every mat_dim_x rows
+    std::vector<int> row_cells_;
+    // row and column bits after loc_mapping, the other fields of the address
+    // are ORed in per command as the mapping only moves bits around
+    std::vector<int> phy_rows_;
+    std::vector<int> phy_cols_;
+
+    // with async_solve the transient solve of an epoch runs on solver_ while
+    // the simulation goes on and is reported at the next epoch
+    std::thread solver_;
+    bool trans_pending_;  // epoch_Pmap has been solved or is being solved
+    uint64_t epoch_clk_;  // end of the epoch in epoch_Pmap
+    std::vector<double> epoch_power_;  // total power of each case [W]
+    std::vector<double> final_power_;
+    std::vector<int> solve_iters_;  // pcg iterations of the final solves
 
     std::vector<std::vector<int>> refresh_count;
 
+    // max temperature [C] of each layer of each case in the last epoch
+    std::vector<std::vector<double>> max_temps_;
+
     // other intermediate parameters
     // not need to be defined here but it will be easy to use if it is defined
     int vault_x, vault_y, bank_x, bank_y;
@@ -1,15 +1,130 @@
 #include "thermal_replay.h"
+#include <string.h>
+#include <algorithm>
+#include <thread>
 #include "./../ext/headers/args.hxx"
 
 // this will not be used in a library file so it's ok to do this
 using namespace dramsim3;
 
+CommandTraceReader::CommandTraceReader(const std::string &trace_name)
+    : trace_name_(trace_name), binary_(false) {
+    file_ = fopen(trace_name.c_str(), "rb");
+    if (!file_) {
+        std::cerr << "cannot open trace file " << trace_name << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file_) == 1 &&
+        memcmp(header.magic, kTraceMagic, sizeof(header.magic)) == 0) {
+        if (header.version != kTraceVersion ||
+            header.record_size != sizeof(TraceRecord)) {
+            std::cerr << trace_name << " was written by another version"
+                      << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+        binary_ = true;
+        records_.resize(1 << 16);
+    }
+    for (int i = 0; i < static_cast<int>(CommandType::SIZE); i++) {
+        auto cmd_type = static_cast<CommandType>(i);
+        cmd_types_[CommandTypeString(cmd_type)] = cmd_type;
+    }
+    Rewind();
+}
+
+CommandTraceReader::~CommandTraceReader() { fclose(file_); }
+
+void CommandTraceReader::Rewind() {
+    fseek(file_, binary_ ? sizeof(TraceHeader) : 0, SEEK_SET);
+}
+
+bool CommandTraceReader::Read(TimedCommands &commands, size_t max_commands) {
+    commands.clear();
+    if (binary_) {
+        while (commands.size() < max_commands) {
+            size_t num_records =
+                fread(records_.data(), sizeof(TraceRecord),
+                      std::min(records_.size(), max_commands - commands.size()),
+                      file_);
+            if (num_records == 0) {
+                break;
+            }
+            for (size_t i = 0; i < num_records; i++) {
+                const auto &record = records_[i];
+                if (record.kind == TraceKind::COMMAND) {
+                    commands.emplace_back(
+                        record.clk,
+                        Command(static_cast<CommandType>(record.type),
+                                record.addr, record.hex_addr));
+                }
+            }
+        }
+    } else {
+        char line[256];
+        uint64_t clk;
+        Command cmd;
+        while (commands.size() < max_commands &&
+               fgets(line, sizeof(line), file_)) {
+            if (line[strspn(line, " \t\r\n")] == '\0') {
+                continue;
+            }
+            if (!ParseLine(line, clk, cmd)) {
+                std::cerr << "Check trace format! " << line << std::endl;
+                AbruptExit(__FILE__, __LINE__);
+            }
+            commands.emplace_back(clk, cmd);
+        }
+    }
+    return !commands.empty();
+}
+
+// clk command channel rank bankgroup bank row column, row and column are
+// printed in hex by tracedump
+bool CommandTraceReader::ParseLine(const char *line, uint64_t &clk,
+                                   Command &cmd) const {
+    char *end;
+    clk = strtoull(line, &end, 10);
+    if (end == line) {
+        return false;
+    }
+    const char *name = end + strspn(end, " \t");
+    size_t name_len = strcspn(name, " \t\r\n");
+    auto it = cmd_types_.find(std::string(name, name_len));
+    if (it == cmd_types_.end()) {
+        return false;
+    }
+    const char *pos = name + name_len;
+    int fields[6];
+    for (int i = 0; i < 6; i++) {
+        fields[i] = static_cast<int>(strtol(pos, &end, 0));
+        if (end == pos) {
+            return false;
+        }
+        pos = end;
+    }
+    cmd = Command(it->second,
+                  Address(fields[0], fields[1], fields[2], fields[3],
+                          fields[4], fields[5]),
+                  0);
+    return true;
+}
+
 ThermalReplay::ThermalReplay(std::string trace_name, std::string config_file,
-                             std::string output_dir, uint64_t repeat)
-    : config_(config_file, output_dir),
+                             std::string output_dir, uint64_t repeat,
+                             int num_threads, size_t chunk_size)
+    : reader_(trace_name),
+      config_(config_file, output_dir),
       thermal_calc_(config_),
       repeat_(repeat),
-      last_clk_(0) {
+      chunk_size_(chunk_size),
+      next_epoch_(config_.epoch_period),
+      num_epochs_(0),
+      last_clk_(config_.channels, 0) {
+    // channels only share the thermal maps, and on different cells except
+    // for pseudo channels, which stay on the thread of their channel
+    num_threads_ = std::max(
+        1, std::min(num_threads, config_.channels / config_.subchannels));
     for (int i = 0; i < config_.channels; i++) {
         channel_stats_.emplace_back(config_, i);
     }
@@ -28,43 +143,40 @@ ThermalReplay::ThermalReplay(std::string trace_name, std::string config_file,
         }
         bank_active_.push_back(chan_vec);
     }
-
-    // read commands into memory
-    std::ifstream trace_file(trace_name);
-    if (!trace_file) {
-        std::cout << "cannot open trace file " << trace_name << std::endl;
-        std::exit(1);
-    }
-
-    std::string line;
-    uint64_t clk = 0;
-    while (std::getline(trace_file, line)) {
-        Command cmd;
-        ParseLine(line, clk, cmd);
-        timed_commands_.push_back(std::pair<uint64_t, Command>(clk, cmd));
-    }
-    trace_file.close();
 }
 
 ThermalReplay::~ThermalReplay() {}
 
 void ThermalReplay::Run() {
+    TimedCommands commands;
+    commands.reserve(chunk_size_);
     uint64_t clk = 0;
     for (uint64_t i = 0; i < repeat_; i++) {
         uint64_t clk_offset = 0;
-        for (size_t j = 0; j < timed_commands_.size(); j++) {
-            // for (int j = 0; j < cmds_.size(); j++) {
-            // Command &cmd = cmds_[j];
-            // clk_offset = clks_[j];
-            clk_offset = timed_commands_[j].first;
-            Command &cmd = timed_commands_[j].second;
-            ProcessCMD(cmd, clk + clk_offset);
-            thermal_calc_.UpdateCMDPower(0, cmd, clk + clk_offset);
+        reader_.Rewind();
+        while (reader_.Read(commands, chunk_size_)) {
+            size_t begin = 0;
+            while (begin < commands.size()) {
+                // replay up to the end of the epoch
+                size_t end = begin;
+                while (end < commands.size() &&
+                       clk + commands[end].first < next_epoch_) {
+                    end++;
+                }
+                ProcessCommands(commands, begin, end, clk);
+                if (end < commands.size()) {
+                    PrintEpochStats(next_epoch_);
+                    next_epoch_ += config_.epoch_period;
+                }
+                begin = end;
+            }
+            clk_offset = commands.back().first;
         }
         clk += clk_offset;
 
         // reset bank states
         for (int c = 0; c < config_.channels; c++) {
+            UpdateBackgroundCycles(c, clk);
             for (int r = 0; r < config_.ranks; r++) {
                 for (int g = 0; g < config_.bankgroups; g++) {
                     for (int b = 0; b < config_.banks_per_group; b++) {
@@ -74,68 +186,116 @@ void ThermalReplay::Run() {
             }
         }
     }
-    for (int c = 0; c < config_.channels; c++) {
-        //channel_stats_[c].PrintFinalStats(clk, std::cout, std::cout, std::cout);
-        channel_stats_[c].PrintFinalStats();
-    }
-    thermal_calc_.PrintFinalPT(clk);
+    PrintFinalStats(clk);
 }
 
-// parsing line from trace file into a command
-void ThermalReplay::ParseLine(std::string line, uint64_t &clk, Command &cmd) {
-    std::map<std::string, CommandType> cmd_map = {
-        {"read", CommandType::READ},
-        {"read_p", CommandType::READ_PRECHARGE},
-        {"write", CommandType::WRITE},
-        {"write_p", CommandType::WRITE_PRECHARGE},
-        {"activate", CommandType::ACTIVATE},
-        {"precharge", CommandType::PRECHARGE},
-        {"refresh_bank", CommandType::REFRESH_BANK},  // verilog model doesn't
-                                                      // distinguish bank/rank
-                                                      // refresh
-        {"refresh", CommandType::REFRESH},
-        {"self_refresh_enter", CommandType::SREF_ENTER},
-        {"self_refresh_exit", CommandType::SREF_EXIT},
+// the power of a channel only depends on its own commands, so each thread
+// replays the commands of its share of the channels (with their subchannels)
+void ThermalReplay::ProcessCommands(const TimedCommands &commands,
+                                    size_t begin, size_t end, uint64_t clk) {
+    auto replay = [this, &commands, begin, end, clk](int t) {
+        for (size_t j = begin; j < end; j++) {
+            const Command &cmd = commands[j].second;
+            if (cmd.Channel() / config_.subchannels % num_threads_ == t) {
+                uint64_t cmd_clk = clk + commands[j].first;
+                ProcessCMD(cmd, cmd_clk);
+                thermal_calc_.UpdateCMDPower(cmd.Channel(), cmd, cmd_clk);
+            }
+        }
     };
-    std::vector<std::string> tokens = StringSplit(line, ' ');
-
-    // basic sanity check
-    if (tokens.size() != 8) {
-        std::cerr << "Check trace format!" << std::endl;
-        AbruptExit(__FILE__, __LINE__);
+    if (num_threads_ == 1) {
+        replay(0);
+        return;
     }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads_; t++) {
+        threads.emplace_back(replay, t);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
 
-    // converting clock
-    clk = stoull(tokens[0]);
-
-    // converting address
-    Address addr(std::stoi(tokens[2]), std::stoi(tokens[3]),
-                 std::stoi(tokens[4]), std::stoi(tokens[5]),
-                 std::stoi(tokens[6]), std::stoi(tokens[7]));
+void ThermalReplay::UpdateBackgroundCycles(int channel, uint64_t clk) {
+    // TODO add self-ref later
+    if (clk <= last_clk_[channel]) {
+        return;
+    }
+    uint64_t past_clks = clk - last_clk_[channel];
+    for (int j = 0; j < config_.ranks; j++) {
+        if (IsRankActive(channel, j)) {
+            channel_stats_[channel].IncrementVecBy("rank_active_cycles", j,
+                                                   past_clks);
+        } else {
+            channel_stats_[channel].IncrementVecBy("all_bank_idle_cycles", j,
+                                                   past_clks);
+        }
+    }
+    last_clk_[channel] = clk;
+}
 
-    // reassign cmd
-    cmd.addr = addr;
-    cmd.cmd_type = cmd_map[tokens[1]];
-    return;
+void ThermalReplay::PrintEpochStats(uint64_t clk) {
+    // same layout as BaseDRAMSystem::PrintEpochStats
+    if (num_epochs_ == 0) {
+        std::ofstream epoch_out(config_.json_epoch_name, std::ofstream::out);
+        epoch_out << "[";
+    }
+    for (int c = 0; c < config_.channels; c++) {
+        UpdateBackgroundCycles(c, clk);
+        channel_stats_[c].Increment("epoch_num");
+        channel_stats_[c].PrintEpochStats();
+        std::ofstream epoch_out(config_.json_epoch_name, std::ofstream::app);
+        epoch_out << "," << std::endl;
+        for (int r = 0; r < config_.ranks; r++) {
+            double bg_energy = channel_stats_[c].RankBackgroundEnergy(r);
+            thermal_calc_.UpdateBackgroundEnergy(c, r, bg_energy);
+        }
+    }
+    thermal_calc_.PrintTransPT(clk);
+    num_epochs_++;
 }
 
-void ThermalReplay::ProcessCMD(Command &cmd, uint64_t clk) {
-    // calculate background power
-    // TODO add self-ref later
-    uint64_t past_clks = clk - last_clk_;
-    for (int i = 0; i < config_.channels; i++) {
-        for (int j = 0; j < config_.ranks; j++) {
-            if (IsRankActive(i, j)) {
-                channel_stats_[i].IncrementVecBy("rank_active_cycles", j,
-                                                 past_clks);
-            } else {
-                channel_stats_[i].IncrementVecBy("all_bank_idle_cycles", j,
-                                                 past_clks);
-            }
+void ThermalReplay::PrintFinalStats(uint64_t clk) {
+    if (num_epochs_ > 0) {
+        // remove last comma and append ]
+        std::ofstream epoch_out(config_.json_epoch_name,
+                                std::ios_base::in | std::ios_base::out |
+                                    std::ios_base::ate);
+        epoch_out.seekp(-2, std::ios_base::cur);
+        epoch_out.write("]", 1);
+    }
+
+    std::ofstream json_out(config_.json_stats_name, std::ofstream::out);
+    json_out << "{";
+    json_out.close();
+    for (int c = 0; c < config_.channels; c++) {
+        UpdateBackgroundCycles(c, clk);
+        channel_stats_[c].PrintFinalStats();
+        if (c != config_.channels - 1) {
+            std::ofstream chan_out(config_.json_stats_name, std::ofstream::app);
+            chan_out << "," << std::endl;
+        }
+        for (int r = 0; r < config_.ranks; r++) {
+            double bg_energy = channel_stats_[c].RankBackgroundEnergy(r);
+            thermal_calc_.UpdateBackgroundEnergy(c, r, bg_energy);
         }
     }
+    json_out.open(config_.json_stats_name, std::ofstream::app);
+    json_out << "}";
+    json_out.close();
 
+    thermal_calc_.PrintFinalPT(clk);
+}
+
+void ThermalReplay::ProcessCMD(const Command &cmd, uint64_t clk) {
     int channel = cmd.Channel();
+    if (channel < 0 || channel >= config_.channels) {
+        std::cerr << "Command of unknown channel " << channel << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    // background power of the channel up to this command
+    UpdateBackgroundCycles(channel, clk);
+
     // update cmd count
     switch (cmd.cmd_type) {
         case CommandType::READ:
@@ -158,6 +318,18 @@ void ThermalReplay::ProcessCMD(Command &cmd, uint64_t clk) {
         case CommandType::REFRESH_BANK:
             channel_stats_[channel].Increment("num_refb_cmds");
             break;
+        case CommandType::REFRESH_SAME_BANK:
+            channel_stats_[channel].Increment("num_refsb_cmds");
+            break;
+        case CommandType::RFM:
+            channel_stats_[channel].Increment("num_rfm_cmds");
+            break;
+        case CommandType::PD_ENTER:
+            channel_stats_[channel].Increment("num_pde_cmds");
+            break;
+        case CommandType::PD_EXIT:
+            channel_stats_[channel].Increment("num_pdx_cmds");
+            break;
         case CommandType::SREF_ENTER:
             channel_stats_[channel].Increment("num_srefe_cmds");
             break;
@@ -184,18 +356,6 @@ void ThermalReplay::ProcessCMD(Command &cmd, uint64_t clk) {
             break;
     }
 
-    if (clk % config_.epoch_period) {
-        for (int c = 0; c < config_.channels; c++) {
-            // where to print isn't important here what we really need is the
-            // updated stats
-            channel_stats_[c].PrintEpochStats();
-            for (int r = 0; r < config_.ranks; r++) {
-                double bg_energy = channel_stats_[c].RankBackgroundEnergy(r);
-                thermal_calc_.UpdateBackgroundEnergy(c, r, bg_energy);
-            }
-        }
-    }
-    last_clk_ = clk;
     return;
 }
 
@@ -226,7 +386,15 @@ int main(int argc, const char **argv) {
         parser, "memory_type", "Type of memory system - default, hmc, ideal",
         {"memory-type"}, "default");
     args::ValueFlag<std::string> trace_file_arg(
-        parser, "trace", "The trace file", {'t', "trace-file"});
+        parser, "trace", "The text or binary command trace file",
+        {'t', "trace-file"});
+    args::ValueFlag<int> threads_arg(parser, "threads",
+                                     "Number of threads replaying channels",
+                                     {'j', "threads"},
+                                     std::thread::hardware_concurrency());
+    args::ValueFlag<size_t> chunk_arg(parser, "chunk",
+                                      "Commands read from the trace at a time",
+                                      {"chunk"}, 1 << 20);
 
     try {
         parser.ParseCLI(argc, argv);
@@ -245,8 +413,11 @@ int main(int argc, const char **argv) {
     output_dir = args::get(output_dir_arg);
     trace_file = args::get(trace_file_arg);
     memory_system_type = args::get(memory_type_arg);
+    int num_threads = std::max(1, args::get(threads_arg));
+    size_t chunk_size = std::max<size_t>(1, args::get(chunk_arg));
 
-    ThermalReplay thermal_replay(trace_file, config_file, output_dir, repeats);
+    ThermalReplay thermal_replay(trace_file, config_file, output_dir, repeats,
+                                 num_threads, chunk_size);
 
     thermal_replay.Run();
 
@@ -1,34 +1,69 @@
 #ifndef __THERMAL_REPLAY_H
 #define __THERMAL_REPLAY_H
 
-#include <fstream>
+#include <stdio.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "common.h"
 #include "configuration.h"
 #include "simple_stats.h"
 #include "thermal.h"
+#include "tracer.h"
 
 namespace dramsim3 {
 
+typedef std::vector<std::pair<uint64_t, Command>> TimedCommands;
+
+// Reads a command trace a chunk at a time, either the text trace printed by
+// tracedump or the binary trace written by the simulator, so the trace never
+// has to fit in memory
+class CommandTraceReader {
+   public:
+    CommandTraceReader(const std::string& trace_name);
+    ~CommandTraceReader();
+    // replaces commands with the next (at most) max_commands ones, returns
+    // false at the end of the trace
+    bool Read(TimedCommands& commands, size_t max_commands);
+    void Rewind();
+
+   private:
+    std::string trace_name_;
+    FILE* file_;
+    bool binary_;
+    std::vector<TraceRecord> records_;
+    std::unordered_map<std::string, CommandType> cmd_types_;
+    bool ParseLine(const char* line, uint64_t& clk, Command& cmd) const;
+};
+
 class ThermalReplay {
    public:
     ThermalReplay(std::string trace_name, std::string config_file,
-                  std::string output_dir, uint64_t repeat);
+                  std::string output_dir, uint64_t repeat, int num_threads,
+                  size_t chunk_size);
     ~ThermalReplay();
     void Run();
 
    private:
-    std::vector<std::pair<uint64_t, Command>> timed_commands_;
+    CommandTraceReader reader_;
     Config config_;
     ThermalCalculator thermal_calc_;
     uint64_t repeat_;
-    uint64_t last_clk_;
+    int num_threads_;
+    size_t chunk_size_;
+    uint64_t next_epoch_;
+    uint64_t num_epochs_;
+    // background cycles of each channel are counted up to here
+    std::vector<uint64_t> last_clk_;
     std::vector<SimpleStats> channel_stats_;
     std::vector<std::vector<std::vector<std::vector<bool>>>> bank_active_;
-    void ParseLine(std::string line, uint64_t &clk, Command &cmd);
-    void ProcessCMD(Command &cmd, uint64_t clk);
+    void ProcessCommands(const TimedCommands& commands, size_t begin,
+                         size_t end, uint64_t clk);
+    void ProcessCMD(const Command& cmd, uint64_t clk);
+    void UpdateBackgroundCycles(int channel, uint64_t clk);
+    void PrintEpochStats(uint64_t clk);
+    void PrintFinalStats(uint64_t clk);
     bool IsRankActive(int channel, int rank);
 };
 
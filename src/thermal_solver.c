@@ -3,11 +3,27 @@
  * zhiyuan yang
  */
 #include <math.h>
-#include <omp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <time.h>
+#ifdef THERMAL_SUPERLU
+#include <omp.h>
 #include "../ext/SuperLU_MT_3.1/SRC/slu_mt_ddefs.h"
+#else
+// only the pcg solver is built, provide the few SuperLU helpers used here
+#include <stdlib.h>
+#include <string.h>
+typedef long long int_t;  // same as the _LONGINT SuperLU build
+#define doubleMalloc(n) ((double *)malloc((size_t)(n) * sizeof(double)))
+#define intMalloc(n) ((int_t *)malloc((size_t)(n) * sizeof(int_t)))
+#define SUPERLU_FREE(p) free(p)
+#define SUPERLU_ABORT(s)                                   \
+    {                                                      \
+        fprintf(stderr, "%s at line %d in file %s\n", s, \
+                __LINE__, __FILE__);                       \
+        abort();                                           \
+    }
+#endif  // THERMAL_SUPERLU
 #include "thermal_config.h"
 
 //#define DEBUG
@@ -16,21 +32,6 @@
 
 double get_maxT(double *T, int Tsize);
 
-double *initialize_Temperature(double W, double Lc, int numP, int dimX,
-                               int dimZ, double Tamb) {
-    int numLayer, l;
-    double *T;
-
-    numLayer = numP * 3;
-
-    // define the temperature array
-    if (!(T = doubleMalloc(dimX * dimZ * (numLayer + 1))))
-        SUPERLU_ABORT("Malloc fails for K[].");
-    for (l = 0; l < dimX * dimZ * (numLayer + 1); l++) T[l] = Tamb;
-
-    return T;
-}
-
 double *calculate_Cap_array(double W, double Lc, int numP, int dimX, int dimZ,
                             int *CapSize) {
     double Wsink, Lsink, Hsink;
@@ -82,6 +83,7 @@ double *calculate_Cap_array(double W, double Lc, int numP, int dimX, int dimZ,
             C[i] = C[i] * H[i - 1] * gridX * gridZ;
     }
 
+    SUPERLU_FREE(H);
     *CapSize = numLayer + 1;
     return C;
 }
@@ -420,57 +422,64 @@ double **calculate_Midx_array(double W, double Lc, int numP, int dimX, int dimZ,
     return Midx;
 }
 
-double *steady_thermal_solver(double ***powerM, double W, double Lc, int numP,
-                              int dimX, int dimZ, double **Midx, int count,
-                              double Tamb) {
-    int numLayer = numP * 3;
-    int_t *layerP;
-    // define the active layer array
-    if (!(layerP = intMalloc(numP))) SUPERLU_ABORT("Malloc fails for numP[].");
-    for (int l = 0; l < numP; l++) layerP[l] = l * 3;
-
-    double Wsink = W;
-    double Lsink = Lc;
-    double Hsink = Hhs;
-    double Ksink = Khs;
-    double gridXsink = Wsink / dimX;
-    double gridZsink = Lsink / dimZ;
-    double Rsinky = Hsink / Ksink / gridXsink / gridZsink;  // y direction
+/* Right-hand side of G * T = P. The heat sink is tied to the ambient
+ * temperature through Ramb and every active layer gets its power map, which
+ * is numP layers of dimZ x dimX cells with x changing fastest. */
+void thermal_power_vector(double *P, const double *power, double W, double Lc,
+                          int numP, int dimX, int dimZ, double Tamb) {
+    double gridXsink = W / dimX;
+    double gridZsink = Lc / dimZ;
+    double Rsinky = Hhs / Khs / gridXsink / gridZsink;  // y direction
     double Ramb = Rsinky / 2;
+    int layer_size = dimX * dimZ;
+
+    memset(P, 0, layer_size * (numP * 3 + 1) * sizeof(*P));
+    for (int i = 0; i < layer_size; i++) P[i] = Tamb / Ramb;
+    for (int l = 0; l < numP; l++)
+        memcpy(P + layer_size * (l * 3 + 1), power + layer_size * l,
+               layer_size * sizeof(*P));
+}
+
+#ifdef THERMAL_SUPERLU
+/* LU factors of the conductance matrix, which only depends on the geometry,
+ * so it is factorized once per run and every steady solve only does the
+ * triangular solves for its power map */
+typedef struct {
+    SuperMatrix L, U;
+    int_t *perm_r, *perm_c;
+    Gstat_t Gstat;
+    int_t nprocs;
+} steady_lu_t;
+
+void *steady_thermal_factorize(int numP, int dimX, int dimZ, double **Midx,
+                               int count) {
+    int numLayer = numP * 3;
+    steady_lu_t *lu;
+    if (!(lu = (steady_lu_t *)malloc(sizeof(steady_lu_t))))
+        SUPERLU_ABORT("Malloc fails for lu.");
 
     // convert the values to the SuperMatrix format
-    SuperMatrix A, L, U, B;
+    SuperMatrix A, AC;
     double *a;
     int_t *asub, *xa;
-    int_t *perm_r; /* row permutations from partial pivoting */
-    int_t *perm_c; /* column permutation vector */
     SCPformat *Lstore;
     NCPformat *Ustore;
-    int_t nrhs, info, m, n, nnz, b;
-    int_t nprocs; /* maximum number of processors to use. */
-    int_t panel_size, relax, maxsup;
+    int_t info, m, n, nnz;
+    int_t panel_size, relax;
     int_t permc_spec;
-    trans_t trans;
-    double *rhs;
+    superlumt_options_t superlumt_options;
     superlu_memusage_t superlu_memusage;
 
-    nrhs = 1;
-    trans = NOTRANS;
-    nprocs = omp_get_max_threads();
-    b = 1;
+    lu->nprocs = omp_get_max_threads();
     panel_size = sp_ienv(1);
     relax = sp_ienv(2);
-    maxsup = sp_ienv(3);
 
     /* Initialize matrix A. */
     m = n = dimX * dimZ * (numLayer + 1);
     nnz = count;
-    if (!(a = doubleMalloc(nnz)))
-        SUPERLU_ABORT("Malloc fails for a[].");  // I cannot free the space
-    if (!(asub = intMalloc(nnz)))
-        SUPERLU_ABORT("Malloc fails for asub[].");  // I cannot free the space
-    if (!(xa = intMalloc(n + 1)))
-        SUPERLU_ABORT("Malloc fails for xa[].");  // I cannot free the space
+    if (!(a = doubleMalloc(nnz))) SUPERLU_ABORT("Malloc fails for a[].");
+    if (!(asub = intMalloc(nnz))) SUPERLU_ABORT("Malloc fails for asub[].");
+    if (!(xa = intMalloc(n + 1))) SUPERLU_ABORT("Malloc fails for xa[].");
 
     /* assign values to the arrays: a, asub and xa */
     int row = -1;
@@ -484,46 +493,19 @@ double *steady_thermal_solver(double ***powerM, double W, double Lc, int numP,
     }
     xa[row + 1] = count;
 
-    printf("Using %lld Cores to calculate\n", nprocs);
+    printf("Using %lld Cores to calculate\n", (long long)lu->nprocs);
     printf("Building the sparse matrix ...\n");
-    printf("Dimension of the G matrix is %lld x %lld\n", m, n);
-    printf("Number of non-zero entries is %lld\n", nnz);
+    printf("Dimension of the G matrix is %lld x %lld\n", (long long)m,
+           (long long)n);
+    printf("Number of non-zero entries is %lld\n", (long long)nnz);
 
     /* Create matrix A in the format expected by SuperLU. */
     dCreate_CompCol_Matrix(&A, m, n, nnz, a, asub, xa, SLU_NC, SLU_D, SLU_GE);
-    // dPrint_CompCol_Matrix("A", &A);
-    /* Create right-hand side matrix B. */
-    if (!(rhs = doubleMalloc(m * nrhs)))
-        SUPERLU_ABORT("Malloc fails for rhs[].");
-
-    // assign values to B
-    for (int i = 0; i < m; i++)  // initialize rhs to 0
-        rhs[i] = 0;
-    for (int i = 0; i < dimX * dimZ; i++) rhs[i] = Tamb / Ramb;
-    for (int l = 0; l < numP; l++)
-        for (int i = 0; i < dimX; i++)
-            for (int j = 0; j < dimZ; j++) {
-                rhs[dimX * dimZ * (layerP[l] + 1) + j * dimX + i] =
-                    powerM[i][j][l];
-                // rhs[dimX*dimZ*(layerP[l]+1) + i*dimZ + j] = powerM[i][j][l];
-                // printf("%.6f\n", powerM[i][j][l]);
-            }
 
-    // free the space
-    for (int i = 0; i < dimX; i++) {
-        for (int j = 0; j < dimZ; j++) {
-            free(powerM[i][j]);
-        }
-        free(powerM[i]);
-    }
-    free(powerM);
-
-    dCreate_Dense_Matrix(&B, m, nrhs, rhs, m, SLU_DN, SLU_D, SLU_GE);
-
-    // dPrint_Dense_Matrix("B", &B);
-
-    if (!(perm_r = intMalloc(m))) SUPERLU_ABORT("Malloc fails for perm_r[].");
-    if (!(perm_c = intMalloc(n))) SUPERLU_ABORT("Malloc fails for perm_c[].");
+    if (!(lu->perm_r = intMalloc(m)))
+        SUPERLU_ABORT("Malloc fails for perm_r[].");
+    if (!(lu->perm_c = intMalloc(n)))
+        SUPERLU_ABORT("Malloc fails for perm_c[].");
 
     /*
      * Get column permutation vector perm_c[], according to permc_spec:
@@ -533,150 +515,155 @@ double *steady_thermal_solver(double ***powerM, double W, double Lc, int numP,
      *   permc_spec = 3: approximate minimum degree for unsymmetric matrices
      */
     permc_spec = 1;
-    get_perm_c(permc_spec, &A, perm_c);
+    get_perm_c(permc_spec, &A, lu->perm_c);
 
     printf("Finish building the sparse matrix\n");
     printf("------------------------------------------------------------\n\n");
 
-    /* Solve the linear system. */
-    pdgssv(nprocs, &A, perm_c, perm_r, &L, &U, &B, &info);
-
-    printf("Finish solving the linear equation\n");
-
-    // dPrint_Dense_Matrix("B", &B);
-
-    // extract the Temperature from B
-    DNformat *Astore = (DNformat *)B.Store;
-    // double *Tt; // vector stores the temperature for all grids
-
-    double *Ttp, *Tt;
-    if (!(Tt = (double *)malloc(dimX * dimZ * (numP * 3 + 1) * sizeof(double))))
-        printf("Malloc fails for Tt\n");
-    Ttp = (double *)Astore->nzval;
-    printf("B.nrow is %lld\n", B.nrow);
-    for (int i = 0; i < B.nrow; ++i) {
-        Tt[i] = Ttp[i] - T0;
-        // printf("Tt[%d] = %.2f\n", i, Tt[i]);
+    /* Factorize, same options as pdgssv() */
+    StatAlloc(n, lu->nprocs, panel_size, relax, &lu->Gstat);
+    StatInit(n, lu->nprocs, &lu->Gstat);
+    pdgstrf_init(lu->nprocs, DOFACT, NOTRANS, NO, panel_size, relax, 1.0, NO,
+                 0.0, lu->perm_c, lu->perm_r, NULL, 0, &A, &AC,
+                 &superlumt_options, &lu->Gstat);
+    pdgstrf(&superlumt_options, &AC, lu->perm_r, &lu->L, &lu->U, &lu->Gstat,
+            &info);
+    pxgstrf_finalize(&superlumt_options, &AC);
+    Destroy_CompCol_Matrix(&A);
+    if (info != 0) {
+        printf("Factorization of the G matrix fails, info = %lld\n",
+               (long long)info);
+        SUPERLU_ABORT("G matrix is singular.");
     }
 
-    /*Tt = (double *) Astore->nzval;
-    printf("B.nrow is %d\n", B.nrow);
-    for (i = 0; i < B.nrow; ++i)
-    {
-        Tt[i] = Tt[i] - T0;
-        //printf("%.2f\n", T[i]);
-    }*/
-
-    printf("Finish converting the temperature matrix\n");
-    printf("Free the space...\n");
-
-    if (info == 0) {
-        // dinf_norm_error(nrhs, &B, xact); /* Inf. norm of the error */
-
-        Lstore = (SCPformat *)L.Store;
-        Ustore = (NCPformat *)U.Store;
-        printf("#NZ in factor L = " IFMT "\n", Lstore->nnz);
-        printf("#NZ in factor U = " IFMT "\n", Ustore->nnz);
-        printf("#NZ in L+U = " IFMT "\n", Lstore->nnz + Ustore->nnz - L.ncol);
-
-        superlu_dQuerySpace(nprocs, &L, &U, panel_size, &superlu_memusage);
-        printf("L\\U MB %.3f\ttotal MB needed %.3f\texpansions " IFMT "\n",
-               superlu_memusage.for_lu / 1024 / 1024,
-               superlu_memusage.total_needed / 1024 / 1024,
-               superlu_memusage.expansions);
-    }
+    Lstore = (SCPformat *)lu->L.Store;
+    Ustore = (NCPformat *)lu->U.Store;
+    printf("#NZ in factor L = " IFMT "\n", Lstore->nnz);
+    printf("#NZ in factor U = " IFMT "\n", Ustore->nnz);
+    printf("#NZ in L+U = " IFMT "\n", Lstore->nnz + Ustore->nnz - lu->L.ncol);
+    superlu_dQuerySpace(lu->nprocs, &lu->L, &lu->U, panel_size,
+                        &superlu_memusage);
+    printf("L\\U MB %.3f\ttotal MB needed %.3f\texpansions " IFMT "\n",
+           superlu_memusage.for_lu / 1024 / 1024,
+           superlu_memusage.total_needed / 1024 / 1024,
+           superlu_memusage.expansions);
+    printf("Finish factorizing the G matrix\n");
+    return lu;
+}
 
-    /* De-allocate storage */
-    // free the arrays defined by myself
-    SUPERLU_FREE(layerP);
-    SUPERLU_FREE(rhs);
-    SUPERLU_FREE(perm_r);
-    SUPERLU_FREE(perm_c);
-    printf("finish SUPERLU_FREE\n");
-    Destroy_CompCol_Matrix(&A);
+void steady_thermal_free(void *lu_) {
+    steady_lu_t *lu = (steady_lu_t *)lu_;
+    if (!lu) return;
+    SUPERLU_FREE(lu->perm_r);
+    SUPERLU_FREE(lu->perm_c);
+    Destroy_SuperNode_SCP(&lu->L);
+    Destroy_CompCol_NCP(&lu->U);
+    StatFree(&lu->Gstat);
+    free(lu);
+}
+
+void steady_thermal_solver(void *lu_, const double *power, double W,
+                           double Lc, int numP, int dimX, int dimZ, double Tamb,
+                           double *T) {
+    steady_lu_t *lu = (steady_lu_t *)lu_;
+    SuperMatrix B;
+    int_t nrhs = 1, info, m;
+
+    /* the right-hand side is solved in place in T */
+    m = dimX * dimZ * (numP * 3 + 1);
+    thermal_power_vector(T, power, W, Lc, numP, dimX, dimZ, Tamb);
+    dCreate_Dense_Matrix(&B, m, nrhs, T, m, SLU_DN, SLU_D, SLU_GE);
+    dgstrs(NOTRANS, &lu->L, &lu->U, lu->perm_r, lu->perm_c, &B, &lu->Gstat,
+           &info);
     Destroy_SuperMatrix_Store(&B);
-    Destroy_SuperNode_SCP(&L);
-    Destroy_CompCol_NCP(&U);
-    /* De-allocate other storage */
-    // free(K); free(H); free(layerP); free(Tt);
+
+    printf("Finish solving the linear equation\n");
+    for (int i = 0; i < m; ++i) T[i] -= T0;
 
     printf(
         "================= FINISH STEADY TEMPERATURE SOLVER "
         "===============\n\n");
-
-    return Tt;
 }
+#endif  // THERMAL_SUPERLU
+
+/* The transient solver steps T' = M * T + s .* P explicitly, where
+ * M = I - dt * G / C and s = dt / C. G, C and dt are fixed for a run so the
+ * operator is built once in CSR form instead of being re-derived from Midx
+ * on every step. */
+typedef struct {
+    int n;
+    int *row_ptr;
+    int *col;
+    double *val;
+    double *scale;
+} transient_op_t;
+
+void *transient_thermal_operator(int numP, int dimX, int dimZ, double **Midx,
+                                 int MidxSize, double *Cap, double time,
+                                 int iter) {
+    transient_op_t *op;
+    int n = dimX * dimZ * (numP * 3 + 1);
+    double dt = time / (double)iter;
 
-double *transient_thermal_solver(double ***powerM, double W, double Lc,
-                                 int numP, int dimX, int dimZ, double **Midx,
-                                 int MidxSize, double *Cap, int CapSize,
-                                 double time, int iter, double *T_trans,
-                                 double Tamb) {
-    int numLayer = numP * 3;
+    if (!(op = (transient_op_t *)malloc(sizeof(transient_op_t))))
+        SUPERLU_ABORT("Malloc fails for op.");
+    op->n = n;
+    op->row_ptr = (int *)calloc(n + 1, sizeof(int));
+    op->col = (int *)malloc(MidxSize * sizeof(int));
+    op->val = doubleMalloc(MidxSize);
+    op->scale = doubleMalloc(n);
+    if (!op->row_ptr || !op->col || !op->val || !op->scale)
+        SUPERLU_ABORT("Malloc fails for the transient operator.");
+
+    // Midx is sorted by row, so it only needs to be counted and copied
+    for (int b = 0; b < MidxSize; b++) {
+        int idx0 = (int)(Midx[b][0] + 0.01);
+        int idx1 = (int)(Midx[b][1] + 0.01);
+        double dt_c = dt / Cap[idx0 / (dimX * dimZ)];
+        op->row_ptr[idx0 + 1]++;
+        op->col[b] = idx1;
+        if (idx0 == idx1)
+            op->val[b] = 1 - Midx[b][2] * dt_c;
+        else
+            op->val[b] = -Midx[b][2] * dt_c;
+    }
+    for (int i = 0; i < n; i++) {
+        op->row_ptr[i + 1] += op->row_ptr[i];
+        op->scale[i] = dt / Cap[i / (dimX * dimZ)];
+    }
+    return op;
+}
 
-    // define the active layer array
-    int_t *layerP;
-    if (!(layerP = intMalloc(numP))) SUPERLU_ABORT("Malloc fails for numP[].");
-    for (int l = 0; l < numP; l++) layerP[l] = l * 3;
-
-    double Wsink = W;
-    double Lsink = Lc;
-    double Hsink = Hhs;
-    double Ksink = Khs;
-    double gridXsink = Wsink / dimX;
-    double gridZsink = Lsink / dimZ;
-    double Rsinky = Hsink / Ksink / gridXsink / gridZsink;  // y direction
-    double Ramb = Rsinky / 2;
+void transient_thermal_free(void *op_) {
+    transient_op_t *op = (transient_op_t *)op_;
+    if (!op) return;
+    free(op->row_ptr);
+    free(op->col);
+    SUPERLU_FREE(op->val);
+    SUPERLU_FREE(op->scale);
+    free(op);
+}
 
+void transient_thermal_solver(void *op_, const double *power, double W,
+                              double Lc, int numP, int dimX, int dimZ, int iter,
+                              double *T_trans, double Tamb, double *work) {
+    transient_op_t *op = (transient_op_t *)op_;
     double *Tp = T_trans;
-    double *T, *P;
-    int T_size = dimX * dimZ * (numLayer + 1);
-    if (!(T = doubleMalloc(T_size))) SUPERLU_ABORT("Malloc fails for rhs[].");
-    if (!(P = doubleMalloc(T_size))) SUPERLU_ABORT("Malloc fails for rhs[].");
+    double *T = work;
+    double *P = work + op->n;
 
-    // initialize T and P
-    memset(T, 0, T_size * sizeof(*T));
-    memset(P, 0, T_size * sizeof(*T));
-
-    for (int i = 0; i < dimX * dimZ; i++) P[i] = Tamb / Ramb;
-    for (int l = 0; l < numP; l++)
-        for (int j = 0; j < dimZ; j++)
-            for (int i = 0; i < dimX; i++) {
-                P[dimX * dimZ * (layerP[l] + 1) + i * dimZ + j] =
-                    powerM[i][j][l];
-                // printf("%.6f\n", powerM[i][j][l]);
-            }
-
-    double dt = time / (double)iter;
+    // P is pre-scaled by dt / C
+    thermal_power_vector(P, power, W, Lc, numP, dimX, dimZ, Tamb);
+    for (int i = 0; i < op->n; i++) P[i] *= op->scale[i];
 
     ////////////// iteratively update the temperature /////////////////
-
-    // tried to optimize the following code
-    // multi-threading won't work unless you figure out T[idx0] access patterns
-    // also tried a variety of loop tiling technique, on our server block_size=8
-    // or 4 yields best performance, so let it be...
-    const int block_size = 8;
     for (int iit = 0; iit < iter; iit++) {
-        // main calculation of the new T
-        for (int j = 0; j < MidxSize; j += block_size) {
-            int bound = j + block_size < MidxSize ? (j + block_size) : MidxSize;
-            for (int b = j; b < bound; b++) {
-                int idx0 = (int)(Midx[b][0] + 0.01);
-                int idx1 = (int)(Midx[b][1] + 0.01);
-                double tmp_c = Midx[b][2];
-                int idxC = idx0 / (dimX * dimZ);
-
-                if (idx0 == idx1) {
-                    // if (1-Midx[j][2]*dt/Cap[idxC] < 0)
-                    //    printf("NEGATIVE: idx0 = %d\n", idx0);
-                    double tmp_a = 1 - tmp_c * dt / Cap[idxC];
-                    double tmp_b = tmp_a * Tp[idx1] + P[idx0] * dt / Cap[idxC];
-                    T[idx0] += tmp_b;
-                } else {
-                    double tmp_a = tmp_c * Tp[idx1] * dt / Cap[idxC];
-                    T[idx0] -= tmp_a;
-                }
+        for (int r = 0; r < op->n; r++) {
+            double t = P[r];
+            for (int k = op->row_ptr[r]; k < op->row_ptr[r + 1]; k++) {
+                t += op->val[k] * Tp[op->col[k]];
             }
+            T[r] = t;
         }
 
         // give value for the next T
@@ -684,23 +671,158 @@ double *transient_thermal_solver(double ***powerM, double W, double Lc,
         Tt = Tp;
         Tp = T;
         T = Tt;  // exchange T, Tp
-        memset(T, 0, dimX * dimZ * (numLayer + 1) * sizeof(*T));
     }
+    if (Tp != T_trans) memcpy(T_trans, Tp, op->n * sizeof(*Tp));
+}
 
-    // free the space
-    for (int i = 0; i < dimX; i++) {
-        for (int j = 0; j < dimZ; j++) {
-            free(powerM[i][j]);
+/* Preconditioned conjugate gradient backend. It only needs the Midx
+ * entries, so it builds without SuperLU and BLAS, and the solves start from
+ * the previous temperatures, which are already close to the answer. The
+ * transient system is stepped with backward Euler,
+ * (C/dt + G) * T' = C/dt * T + P, so the step size is not bounded by the
+ * stability limit of the explicit solver. dt = 0 gives the steady system
+ * G * T = P. The matrix is symmetric positive definite and Jacobi
+ * preconditioned. */
+typedef struct {
+    int n;
+    int *row_ptr;
+    int *col;
+    double *val;
+    double *inv_diag;
+    double *mass;  // C/dt of each node, 0 for the steady system
+    double tol;    // relative residual to stop at
+} pcg_system_t;
+
+void *pcg_thermal_system(int numP, int dimX, int dimZ, double **Midx,
+                         int MidxSize, double *Cap, double dt, double tol) {
+    pcg_system_t *sys;
+    int n = dimX * dimZ * (numP * 3 + 1);
+
+    if (!(sys = (pcg_system_t *)malloc(sizeof(pcg_system_t))))
+        SUPERLU_ABORT("Malloc fails for sys.");
+    sys->n = n;
+    sys->tol = tol;
+    sys->row_ptr = (int *)calloc(n + 1, sizeof(int));
+    sys->col = (int *)malloc(MidxSize * sizeof(int));
+    sys->val = doubleMalloc(MidxSize);
+    sys->inv_diag = doubleMalloc(n);
+    sys->mass = doubleMalloc(n);
+    if (!sys->row_ptr || !sys->col || !sys->val || !sys->inv_diag ||
+        !sys->mass)
+        SUPERLU_ABORT("Malloc fails for the pcg system.");
+
+    for (int i = 0; i < n; i++)
+        sys->mass[i] = dt > 0 ? Cap[i / (dimX * dimZ)] / dt : 0;
+
+    // Midx is sorted by row, so it only needs to be counted and copied
+    for (int k = 0; k < MidxSize; k++) {
+        int idx0 = (int)(Midx[k][0] + 0.01);
+        int idx1 = (int)(Midx[k][1] + 0.01);
+        sys->row_ptr[idx0 + 1]++;
+        sys->col[k] = idx1;
+        sys->val[k] = Midx[k][2];
+        if (idx0 == idx1) {
+            sys->val[k] += sys->mass[idx0];
+            sys->inv_diag[idx0] = 1 / sys->val[k];
         }
-        free(powerM[i]);
     }
-    free(powerM);
+    for (int i = 0; i < n; i++) sys->row_ptr[i + 1] += sys->row_ptr[i];
+    return sys;
+}
 
-    SUPERLU_FREE(layerP);
-    SUPERLU_FREE(P);
-    SUPERLU_FREE(T);
+void pcg_thermal_free(void *sys_) {
+    pcg_system_t *sys = (pcg_system_t *)sys_;
+    if (!sys) return;
+    free(sys->row_ptr);
+    free(sys->col);
+    SUPERLU_FREE(sys->val);
+    SUPERLU_FREE(sys->inv_diag);
+    SUPERLU_FREE(sys->mass);
+    free(sys);
+}
+
+static void pcg_matvec(const pcg_system_t *sys, const double *x, double *y) {
+    for (int i = 0; i < sys->n; i++) {
+        double t = 0;
+        for (int k = sys->row_ptr[i]; k < sys->row_ptr[i + 1]; k++)
+            t += sys->val[k] * x[sys->col[k]];
+        y[i] = t;
+    }
+}
+
+static double pcg_dot(int n, const double *x, const double *y) {
+    double t = 0;
+    for (int i = 0; i < n; i++) t += x[i] * y[i];
+    return t;
+}
+
+/* solve A * x = b, x holds the initial guess and work the 4 vectors used
+ * on the way, returns the iterations */
+static int pcg_solve(const pcg_system_t *sys, const double *b, double *x,
+                     double *work) {
+    int n = sys->n;
+    double *r = work, *z = work + n, *p = work + 2 * n, *q = work + 3 * n;
+    double stop = sys->tol * sys->tol * pcg_dot(n, b, b);
+
+    pcg_matvec(sys, x, q);
+    for (int i = 0; i < n; i++) {
+        r[i] = b[i] - q[i];
+        z[i] = r[i] * sys->inv_diag[i];
+        p[i] = z[i];
+    }
+    double rz = pcg_dot(n, r, z);
+    int iter = 0;
+    while (pcg_dot(n, r, r) > stop && iter < n) {
+        pcg_matvec(sys, p, q);
+        double alpha = rz / pcg_dot(n, p, q);
+        for (int i = 0; i < n; i++) {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+            z[i] = r[i] * sys->inv_diag[i];
+        }
+        double rz_new = pcg_dot(n, r, z);
+        double beta = rz_new / rz;
+        rz = rz_new;
+        for (int i = 0; i < n; i++) p[i] = z[i] + beta * p[i];
+        iter++;
+    }
+    return iter;
+}
+
+int pcg_steady_thermal_solver(void *sys_, const double *power, double W,
+                              double Lc, int numP, int dimX, int dimZ,
+                              const double *T_guess, double Tamb, double *T,
+                              double *work) {
+    pcg_system_t *sys = (pcg_system_t *)sys_;
+    double *b = work;
+
+    thermal_power_vector(b, power, W, Lc, numP, dimX, dimZ, Tamb);
+    memcpy(T, T_guess, sys->n * sizeof(*T));
+    int iter = pcg_solve(sys, b, T, work + sys->n);
+
+    for (int i = 0; i < sys->n; i++) T[i] -= T0;
+    return iter;
+}
+
+void pcg_transient_thermal_solver(void *sys_, const double *power, double W,
+                                  double Lc, int numP, int dimX, int dimZ,
+                                  int iter, double *T_trans, double Tamb,
+                                  double *work) {
+    pcg_system_t *sys = (pcg_system_t *)sys_;
+    double *P = work, *b = work + sys->n;
+
+    thermal_power_vector(P, power, W, Lc, numP, dimX, dimZ, Tamb);
+    for (int iit = 0; iit < iter; iit++) {
+        for (int i = 0; i < sys->n; i++)
+            b[i] = sys->mass[i] * T_trans[i] + P[i];
+        pcg_solve(sys, b, T_trans, work + 2 * sys->n);
+    }
+}
 
-    return Tp;
+/* scratch space a solve needs, the solvers only read their operators so
+ * cases can be solved concurrently with one work array each */
+int thermal_work_size(int numP, int dimX, int dimZ) {
+    return 6 * dimX * dimZ * (numP * 3 + 1);
 }
 
 double get_maxT(double *T, int Tsize) {
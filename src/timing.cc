@@ -25,7 +25,7 @@ Timing::Timing(const Config& config)
     int write_to_read_s = config.write_delay + config.tWTR_S;
     int write_to_read_o = config.write_delay + config.burst_cycle +
                           config.tRTRS - config.read_delay;
-    int write_to_write_l = std::max(config.burst_cycle, config.tCCD_L);
+    int write_to_write_l = std::max(config.burst_cycle, config.tCCD_L_WR);
     int write_to_write_s = std::max(config.burst_cycle, config.tCCD_S);
     int write_to_write_o = config.burst_cycle;
     int write_to_precharge = config.WL + config.burst_cycle + config.tWR;
@@ -50,16 +50,21 @@ Timing::Timing(const Config& config)
     int activate_to_refresh =
         config.tRC;  // need to precharge before ref, so it's tRC
 
-    // TODO: deal with different refresh rate
-    int refresh_to_refresh =
-        config.tREFI;  // refresh intervals (per rank level)
     int refresh_to_activate = config.tRFC;  // tRFC is defined as ref to act
     int refresh_to_activate_bank = config.tRFCb;
+    int refresh_bank_to_refresh_bank = config.tPBR2PBR;
+    int rfm_to_activate = config.tRFM;
+    int refresh_to_activate_same_bank = config.tRFCsb;
+    int refresh_same_bank_to_other_bank = config.tREFSBRD;
 
     int self_refresh_entry_to_exit = config.tCKESR;
     int self_refresh_exit = config.tXS;
-    // int powerdown_to_exit = config.tCKE;
-    // int powerdown_exit = config.tXP;
+    int powerdown_entry_to_exit = config.tCKE;
+    int powerdown_exit = config.tXP;
+    // the data burst has to finish (and write recovery for writes) before
+    // power down entry, ACT/PRE/REF to entry only take a cycle or two
+    int read_to_powerdown = config.RL + config.burst_cycle + 1;
+    int write_to_powerdown = config.WL + config.burst_cycle + config.tWR;
 
     if (config.bankgroups == 1) {
         // for a bankgroup can be disabled, in that case
@@ -80,19 +85,22 @@ Timing::Timing(const Config& config)
             {CommandType::WRITE, read_to_write},
             {CommandType::READ_PRECHARGE, read_to_read_l},
             {CommandType::WRITE_PRECHARGE, read_to_write},
-            {CommandType::PRECHARGE, read_to_precharge}};
+            {CommandType::PRECHARGE, read_to_precharge},
+            {CommandType::PD_ENTER, read_to_powerdown}};
     other_banks_same_bankgroup[static_cast<int>(CommandType::READ)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, read_to_read_l},
             {CommandType::WRITE, read_to_write},
             {CommandType::READ_PRECHARGE, read_to_read_l},
-            {CommandType::WRITE_PRECHARGE, read_to_write}};
+            {CommandType::WRITE_PRECHARGE, read_to_write},
+            {CommandType::PD_ENTER, read_to_powerdown}};
     other_bankgroups_same_rank[static_cast<int>(CommandType::READ)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, read_to_read_s},
             {CommandType::WRITE, read_to_write},
             {CommandType::READ_PRECHARGE, read_to_read_s},
-            {CommandType::WRITE_PRECHARGE, read_to_write}};
+            {CommandType::WRITE_PRECHARGE, read_to_write},
+            {CommandType::PD_ENTER, read_to_powerdown}};
     other_ranks[static_cast<int>(CommandType::READ)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, read_to_read_o},
@@ -107,19 +115,22 @@ Timing::Timing(const Config& config)
             {CommandType::WRITE, write_to_write_l},
             {CommandType::READ_PRECHARGE, write_to_read_l},
             {CommandType::WRITE_PRECHARGE, write_to_write_l},
-            {CommandType::PRECHARGE, write_to_precharge}};
+            {CommandType::PRECHARGE, write_to_precharge},
+            {CommandType::PD_ENTER, write_to_powerdown}};
     other_banks_same_bankgroup[static_cast<int>(CommandType::WRITE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, write_to_read_l},
             {CommandType::WRITE, write_to_write_l},
             {CommandType::READ_PRECHARGE, write_to_read_l},
-            {CommandType::WRITE_PRECHARGE, write_to_write_l}};
+            {CommandType::WRITE_PRECHARGE, write_to_write_l},
+            {CommandType::PD_ENTER, write_to_powerdown}};
     other_bankgroups_same_rank[static_cast<int>(CommandType::WRITE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, write_to_read_s},
             {CommandType::WRITE, write_to_write_s},
             {CommandType::READ_PRECHARGE, write_to_read_s},
-            {CommandType::WRITE_PRECHARGE, write_to_write_s}};
+            {CommandType::WRITE_PRECHARGE, write_to_write_s},
+            {CommandType::PD_ENTER, write_to_powerdown}};
     other_ranks[static_cast<int>(CommandType::WRITE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, write_to_read_o},
@@ -133,19 +144,24 @@ Timing::Timing(const Config& config)
             {CommandType::ACTIVATE, readp_to_act},
             {CommandType::REFRESH, read_to_activate},
             {CommandType::REFRESH_BANK, read_to_activate},
-            {CommandType::SREF_ENTER, read_to_activate}};
+            {CommandType::REFRESH_SAME_BANK, read_to_activate},
+            {CommandType::RFM, read_to_activate},
+            {CommandType::SREF_ENTER, read_to_activate},
+            {CommandType::PD_ENTER, read_to_powerdown}};
     other_banks_same_bankgroup[static_cast<int>(CommandType::READ_PRECHARGE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, read_to_read_l},
             {CommandType::WRITE, read_to_write},
             {CommandType::READ_PRECHARGE, read_to_read_l},
-            {CommandType::WRITE_PRECHARGE, read_to_write}};
+            {CommandType::WRITE_PRECHARGE, read_to_write},
+            {CommandType::PD_ENTER, read_to_powerdown}};
     other_bankgroups_same_rank[static_cast<int>(CommandType::READ_PRECHARGE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, read_to_read_s},
             {CommandType::WRITE, read_to_write},
             {CommandType::READ_PRECHARGE, read_to_read_s},
-            {CommandType::WRITE_PRECHARGE, read_to_write}};
+            {CommandType::WRITE_PRECHARGE, read_to_write},
+            {CommandType::PD_ENTER, read_to_powerdown}};
     other_ranks[static_cast<int>(CommandType::READ_PRECHARGE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, read_to_read_o},
@@ -159,19 +175,24 @@ Timing::Timing(const Config& config)
             {CommandType::ACTIVATE, write_to_activate},
             {CommandType::REFRESH, write_to_activate},
             {CommandType::REFRESH_BANK, write_to_activate},
-            {CommandType::SREF_ENTER, write_to_activate}};
+            {CommandType::REFRESH_SAME_BANK, write_to_activate},
+            {CommandType::RFM, write_to_activate},
+            {CommandType::SREF_ENTER, write_to_activate},
+            {CommandType::PD_ENTER, write_to_powerdown}};
     other_banks_same_bankgroup[static_cast<int>(CommandType::WRITE_PRECHARGE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, write_to_read_l},
             {CommandType::WRITE, write_to_write_l},
             {CommandType::READ_PRECHARGE, write_to_read_l},
-            {CommandType::WRITE_PRECHARGE, write_to_write_l}};
+            {CommandType::WRITE_PRECHARGE, write_to_write_l},
+            {CommandType::PD_ENTER, write_to_powerdown}};
     other_bankgroups_same_rank[static_cast<int>(CommandType::WRITE_PRECHARGE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, write_to_read_s},
             {CommandType::WRITE, write_to_write_s},
             {CommandType::READ_PRECHARGE, write_to_read_s},
-            {CommandType::WRITE_PRECHARGE, write_to_write_s}};
+            {CommandType::WRITE_PRECHARGE, write_to_write_s},
+            {CommandType::PD_ENTER, write_to_powerdown}};
     other_ranks[static_cast<int>(CommandType::WRITE_PRECHARGE)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::READ, write_to_read_o},
@@ -206,10 +227,13 @@ Timing::Timing(const Config& config)
             {CommandType::ACTIVATE, precharge_to_activate},
             {CommandType::REFRESH, precharge_to_activate},
             {CommandType::REFRESH_BANK, precharge_to_activate},
+            {CommandType::REFRESH_SAME_BANK, precharge_to_activate},
+            {CommandType::RFM, precharge_to_activate},
             {CommandType::SREF_ENTER, precharge_to_activate}};
 
     // for those who need tPPD
-    if (config.IsGDDR() || config.protocol == DRAMProtocol::LPDDR4) {
+    if (config.IsGDDR() || config.protocol == DRAMProtocol::LPDDR4 ||
+        config.protocol == DRAMProtocol::LPDDR5 || config.IsDDR5()) {
         other_banks_same_bankgroup[static_cast<int>(CommandType::PRECHARGE)] =
             std::vector<std::pair<CommandType, int> >{
                 {CommandType::PRECHARGE, precharge_to_precharge},
@@ -221,36 +245,101 @@ Timing::Timing(const Config& config)
             };
     }
 
-    // command REFRESH_BANK
-    same_rank[static_cast<int>(CommandType::REFRESH_BANK)] =
+    // command REFRESH_BANK, only the refreshed bank is busy for tRFCb,
+    // the other banks can keep serving requests
+    same_bank[static_cast<int>(CommandType::REFRESH_BANK)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::ACTIVATE, refresh_to_activate_bank},
             {CommandType::REFRESH, refresh_to_activate_bank},
             {CommandType::REFRESH_BANK, refresh_to_activate_bank},
+            {CommandType::REFRESH_SAME_BANK, refresh_to_activate_bank},
+            {CommandType::RFM, refresh_to_activate_bank},
             {CommandType::SREF_ENTER, refresh_to_activate_bank}};
 
     other_banks_same_bankgroup[static_cast<int>(CommandType::REFRESH_BANK)] =
         std::vector<std::pair<CommandType, int> >{
-            {CommandType::ACTIVATE, refresh_to_activate},
-            {CommandType::REFRESH_BANK, refresh_to_refresh},
-        };
+            {CommandType::ACTIVATE, activate_to_activate_l},
+            {CommandType::REFRESH, refresh_to_activate_bank},
+            {CommandType::REFRESH_BANK, refresh_bank_to_refresh_bank},
+            {CommandType::SREF_ENTER, refresh_to_activate_bank}};
 
     other_bankgroups_same_rank[static_cast<int>(CommandType::REFRESH_BANK)] =
         std::vector<std::pair<CommandType, int> >{
-            {CommandType::ACTIVATE, refresh_to_activate},
-            {CommandType::REFRESH_BANK, refresh_to_refresh},
-        };
+            {CommandType::ACTIVATE, activate_to_activate_s},
+            {CommandType::REFRESH, refresh_to_activate_bank},
+            {CommandType::REFRESH_BANK, refresh_bank_to_refresh_bank},
+            {CommandType::SREF_ENTER, refresh_to_activate_bank}};
+
+    // command REFRESH_SAME_BANK, the same bank list applies to the refreshed
+    // bank of every bankgroup and the other banks list to all the rest
+    same_bank[static_cast<int>(CommandType::REFRESH_SAME_BANK)] =
+        std::vector<std::pair<CommandType, int> >{
+            {CommandType::ACTIVATE, refresh_to_activate_same_bank},
+            {CommandType::REFRESH, refresh_to_activate_same_bank},
+            {CommandType::REFRESH_BANK, refresh_to_activate_same_bank},
+            {CommandType::REFRESH_SAME_BANK, refresh_to_activate_same_bank},
+            {CommandType::RFM, refresh_to_activate_same_bank},
+            {CommandType::SREF_ENTER, refresh_to_activate_same_bank}};
+
+    other_banks_same_bankgroup[static_cast<int>(
+        CommandType::REFRESH_SAME_BANK)] =
+        std::vector<std::pair<CommandType, int> >{
+            {CommandType::ACTIVATE, refresh_same_bank_to_other_bank},
+            {CommandType::REFRESH, refresh_to_activate_same_bank},
+            {CommandType::REFRESH_SAME_BANK, refresh_same_bank_to_other_bank},
+            {CommandType::SREF_ENTER, refresh_to_activate_same_bank}};
+
+    // command RFM, the bank refreshes the victims of its most
+    // activated rows and is busy for tRFM
+    same_bank[static_cast<int>(CommandType::RFM)] =
+        std::vector<std::pair<CommandType, int> >{
+            {CommandType::ACTIVATE, rfm_to_activate},
+            {CommandType::REFRESH, rfm_to_activate},
+            {CommandType::REFRESH_BANK, rfm_to_activate},
+            {CommandType::REFRESH_SAME_BANK, rfm_to_activate},
+            {CommandType::RFM, rfm_to_activate},
+            {CommandType::SREF_ENTER, rfm_to_activate}};
 
-    // REFRESH, SREF_ENTER and SREF_EXIT are isued to the entire
-    // rank  command REFRESH
+    other_banks_same_bankgroup[static_cast<int>(CommandType::RFM)] =
+        std::vector<std::pair<CommandType, int> >{
+            {CommandType::ACTIVATE, activate_to_activate_l}};
+
+    other_bankgroups_same_rank[static_cast<int>(CommandType::RFM)] =
+        std::vector<std::pair<CommandType, int> >{
+            {CommandType::ACTIVATE, activate_to_activate_s}};
+
+    // REFRESH, PD_ENTER, PD_EXIT, SREF_ENTER and SREF_EXIT are isued to the
+    // entire rank  command REFRESH
     same_rank[static_cast<int>(CommandType::REFRESH)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::ACTIVATE, refresh_to_activate},
             {CommandType::REFRESH, refresh_to_activate},
+            {CommandType::REFRESH_SAME_BANK, refresh_to_activate},
+            {CommandType::RFM, refresh_to_activate},
             {CommandType::SREF_ENTER, refresh_to_activate}};
 
+    // command PD_ENTER
+    same_rank[static_cast<int>(CommandType::PD_ENTER)] =
+        std::vector<std::pair<CommandType, int> >{
+            {CommandType::PD_EXIT, powerdown_entry_to_exit}};
+
+    // command PD_EXIT
+    same_rank[static_cast<int>(CommandType::PD_EXIT)] =
+        std::vector<std::pair<CommandType, int> >{
+            {CommandType::READ, powerdown_exit},
+            {CommandType::READ_PRECHARGE, powerdown_exit},
+            {CommandType::WRITE, powerdown_exit},
+            {CommandType::WRITE_PRECHARGE, powerdown_exit},
+            {CommandType::ACTIVATE, powerdown_exit},
+            {CommandType::PRECHARGE, powerdown_exit},
+            {CommandType::REFRESH, powerdown_exit},
+            {CommandType::REFRESH_BANK, powerdown_exit},
+            {CommandType::REFRESH_SAME_BANK, powerdown_exit},
+            {CommandType::RFM, powerdown_exit},
+            {CommandType::PD_ENTER, powerdown_exit},
+            {CommandType::SREF_ENTER, powerdown_exit}};
+
     // command SREF_ENTER
-    // TODO: add power down commands
     same_rank[static_cast<int>(CommandType::SREF_ENTER)] =
         std::vector<std::pair<CommandType, int> >{
             {CommandType::SREF_EXIT, self_refresh_entry_to_exit}};
@@ -261,6 +350,8 @@ Timing::Timing(const Config& config)
             {CommandType::ACTIVATE, self_refresh_exit},
             {CommandType::REFRESH, self_refresh_exit},
             {CommandType::REFRESH_BANK, self_refresh_exit},
+            {CommandType::REFRESH_SAME_BANK, self_refresh_exit},
+            {CommandType::RFM, self_refresh_exit},
             {CommandType::SREF_ENTER, self_refresh_exit}};
 }
 
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "./../ext/headers/args.hxx"
+#include "common.h"
+#include "tracer.h"
+
+using namespace dramsim3;
+
+// Prints a binary trace written by the simulator as text. Commands come out
+// in the old command trace format that scripts/validation.py reads, and
+// transactions in the trace format that dramsim3main replays.
+int main(int argc, const char** argv) {
+    args::ArgumentParser parser(
+        "Dumps a DRAMsim3 binary trace as text.",
+        "Examples: \n"
+        "./build/tracedump output/dramsim3.trace -c 0 > ch_0cmd.trace\n"
+        "./build/tracedump output/dramsim3.trace -k transaction > addr.trace");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::Positional<std::string> trace_file_arg(parser, "trace",
+                                                 "Binary trace file");
+    args::ValueFlag<std::string> kind_arg(
+        parser, "kind", "Records to print, command or transaction",
+        {'k', "kind"}, "command");
+    args::ValueFlag<int> channel_arg(parser, "channel",
+                                     "Only print this channel, -1 for all",
+                                     {'c', "channel"}, -1);
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string trace_file = args::get(trace_file_arg);
+    std::string kind_str = args::get(kind_arg);
+    int channel = args::get(channel_arg);
+    if (trace_file.empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+    TraceKind kind;
+    if (kind_str == "command") {
+        kind = TraceKind::COMMAND;
+    } else if (kind_str == "transaction") {
+        kind = TraceKind::TRANSACTION;
+    } else {
+        std::cerr << "Unknown record kind " << kind_str << std::endl;
+        return 1;
+    }
+
+    FILE* file = fopen(trace_file.c_str(), "rb");
+    if (!file) {
+        std::cerr << "Can't open trace file " << trace_file << std::endl;
+        return 1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0) {
+        std::cerr << trace_file << " is not a DRAMsim3 trace" << std::endl;
+        return 1;
+    }
+    if (header.version != kTraceVersion ||
+        header.record_size != sizeof(TraceRecord)) {
+        std::cerr << trace_file << " was written by another version"
+                  << std::endl;
+        return 1;
+    }
+
+    std::vector<TraceRecord> records(1 << 16);
+    size_t num_records;
+    while ((num_records = fread(records.data(), sizeof(TraceRecord),
+                                records.size(), file)) > 0) {
+        for (size_t i = 0; i < num_records; i++) {
+            const auto& record = records[i];
+            if (record.kind != kind ||
+                (channel >= 0 && record.addr.channel != channel)) {
+                continue;
+            }
+            if (kind == TraceKind::COMMAND) {
+                Command cmd(static_cast<CommandType>(record.type), record.addr,
+                            record.hex_addr);
+                std::cout << std::left << std::setw(18) << record.clk << " "
+                          << cmd << "\n";
+            } else {
+                std::cout << std::hex << record.hex_addr << std::dec << " "
+                          << (record.type ? "WRITE " : "READ ") << record.clk
+                          << "\n";
+            }
+        }
+    }
+    fclose(file);
+    return 0;
+}
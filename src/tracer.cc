@@ -0,0 +1,96 @@
+#include "tracer.h"
+
+#include <string.h>
+
+namespace dramsim3 {
+
+Tracer::Tracer(const Config& config)
+    : config_(config),
+      enabled_(config.trace_commands || config.trace_transactions),
+      file_(nullptr),
+      head_(0),
+      tail_(0),
+      pending_(0),
+      done_(false) {
+    if (!enabled_) {
+        return;
+    }
+    file_ = fopen(config_.trace_file_name.c_str(), "wb");
+    if (!file_) {
+        std::cerr << "Can't open trace file " << config_.trace_file_name
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    std::cout << "Trace write to " << config_.trace_file_name << std::endl;
+
+    TraceHeader header;
+    memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+    header.version = kTraceVersion;
+    header.record_size = sizeof(TraceRecord);
+    fwrite(&header, sizeof(header), 1, file_);
+
+    // a few buffers are enough for the writer to keep up, if it does not
+    // the simulation waits rather than dropping records
+    buffers_.resize(4);
+    for (auto& buffer : buffers_) {
+        buffer.reserve(config_.trace_buffer_records);
+    }
+    writer_ = std::thread(&Tracer::WriterLoop, this);
+}
+
+Tracer::~Tracer() {
+    if (!enabled_) {
+        return;
+    }
+    if (!buffers_[head_].empty()) {
+        HandOff();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+    fclose(file_);
+}
+
+void Tracer::Flush() {
+    if (!enabled_) {
+        return;
+    }
+    if (!buffers_[head_].empty()) {
+        HandOff();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return pending_ == 0; });
+    fflush(file_);
+}
+
+void Tracer::HandOff() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_++;
+    head_ = (head_ + 1) % buffers_.size();
+    cv_.notify_all();
+    // the next buffer to fill is still being written out
+    cv_.wait(lock, [this] { return pending_ < buffers_.size(); });
+}
+
+void Tracer::WriterLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return pending_ > 0 || done_; });
+        if (pending_ == 0) {
+            break;
+        }
+        auto& buffer = buffers_[tail_];
+        lock.unlock();
+        fwrite(buffer.data(), sizeof(TraceRecord), buffer.size(), file_);
+        buffer.clear();
+        lock.lock();
+        tail_ = (tail_ + 1) % buffers_.size();
+        pending_--;
+        cv_.notify_all();
+    }
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,109 @@
+#ifndef __TRACER_H
+#define __TRACER_H
+
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "configuration.h"
+
+namespace dramsim3 {
+
+enum class TraceKind : uint8_t { COMMAND, TRANSACTION, SIZE };
+
+// fixed size binary record, the text is only produced by tracedump
+struct TraceRecord {
+    uint64_t clk;
+    uint64_t hex_addr;
+    Address addr;
+    TraceKind kind;
+    uint8_t type;  // CommandType of a command, is_write of a transaction
+    uint8_t padding[6];
+};
+
+static_assert(sizeof(TraceRecord) == 40, "Trace records are 40 bytes");
+
+// the trace file starts with this header followed by the records
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+const char kTraceMagic[8] = {'D', 'R', 'S', 'M', '3', 'T', 'R', 'C'};
+const uint32_t kTraceVersion = 1;
+
+// Records issued commands and incoming transactions that pass the filters
+// in the [trace] config section. Records are collected in a ring of
+// buffers and a writer thread drains the full ones to the trace file, so
+// the simulation only pays for a copy per record. Nothing is allocated and
+// no thread is started when tracing is disabled.
+class Tracer {
+   public:
+    Tracer(const Config& config);
+    ~Tracer();
+    bool IsEnabled() const { return enabled_; }
+
+    // refresh and power commands leave the channel out of their address,
+    // so the controller passes its own
+    void RecordCommand(const Command& cmd, int channel, uint64_t clk) {
+        if (config_.trace_commands &&
+            config_.trace_cmd_types[static_cast<int>(cmd.cmd_type)] &&
+            Selected(channel, cmd.Rank(), clk)) {
+            Record(TraceKind::COMMAND, static_cast<uint8_t>(cmd.cmd_type),
+                   cmd.hex_addr, cmd.addr, channel, clk);
+        }
+    }
+
+    void RecordTransaction(const Transaction& trans, int channel,
+                           uint64_t clk) {
+        if (config_.trace_transactions &&
+            Selected(channel, trans.dram_addr.rank, clk)) {
+            Record(TraceKind::TRANSACTION, trans.is_write, trans.addr,
+                   trans.dram_addr, channel, clk);
+        }
+    }
+
+    // hand the partially filled buffer to the writer and wait until
+    // everything recorded so far is in the file
+    void Flush();
+
+   private:
+    const Config& config_;
+    bool enabled_;
+    FILE* file_;
+
+    // ring of buffers, head_ is being filled by the simulation and the
+    // pending_ ones after tail_ are waiting for the writer
+    std::vector<std::vector<TraceRecord>> buffers_;
+    size_t head_;
+    size_t tail_;
+    size_t pending_;
+    bool done_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread writer_;
+
+    bool Selected(int channel, int rank, uint64_t clk) const {
+        return clk >= config_.trace_start_cycle &&
+               clk < config_.trace_end_cycle &&
+               config_.trace_channels[channel] &&
+               (rank < 0 || config_.trace_ranks[rank]);
+    }
+    void Record(TraceKind kind, uint8_t type, uint64_t hex_addr,
+                const Address& addr, int channel, uint64_t clk) {
+        auto& buffer = buffers_[head_];
+        buffer.push_back(TraceRecord{clk, hex_addr, addr, kind, type, {0}});
+        buffer.back().addr.channel = channel;
+        if (buffer.size() == buffer.capacity()) {
+            HandOff();
+        }
+    }
+    void HandOff();
+    void WriterLoop();
+};
+
+}  // namespace dramsim3
+#endif
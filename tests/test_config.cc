@@ -91,5 +91,55 @@ TEST_CASE("Address Mapping", "[config]") {
         addr = config.AddressMapping(hex_addr);
         REQUIRE(addr.row == 0b10000000000000);
     }
-}
 
+    SECTION("Test bit list address mapping") {
+        // ch, ra, bg, ba, ro, co with the channel hashed with the row
+        std::vector<std::string> lists = {"13:11^20:18", "",      "17:16",
+                                          "15:14",       "31:18", "10:6"};
+        std::vector<std::vector<uint64_t>> field_bits(lists.size());
+        for (size_t i = 0; i < lists.size(); i++) {
+            REQUIRE(config.ParseBitList(lists[i], field_bits[i]));
+        }
+        REQUIRE(field_bits[0].size() == 3);
+        REQUIRE(field_bits[0][0] == ((1ull << 5) | (1ull << 12)));
+        REQUIRE(field_bits[1].empty());
+        REQUIRE(config.CompileAddressMapping(field_bits));
+
+        // every address comes back from its fields
+        for (uint64_t hex_addr = 0; hex_addr < (1ull << 32);
+             hex_addr += 0x12345ull << 6) {
+            auto addr = config.AddressMapping(hex_addr);
+            uint64_t ch = addr.channel ^ (addr.row & 0x7);
+            uint64_t back = (static_cast<uint64_t>(addr.row) << 18) |
+                            (static_cast<uint64_t>(addr.bankgroup) << 16) |
+                            (static_cast<uint64_t>(addr.bank) << 14) |
+                            (ch << 11) |
+                            (static_cast<uint64_t>(addr.column) << 6);
+            REQUIRE(back == hex_addr);
+        }
+    }
+
+    SECTION("Test malformed bit lists") {
+        std::vector<uint64_t> bits;
+        REQUIRE(config.ParseBitList("10:6-5", bits) == false);  // below burst
+        REQUIRE(config.ParseBitList("64", bits) == false);
+        REQUIRE(config.ParseBitList("13:11^19:18", bits) == false);
+        REQUIRE(config.ParseBitList("13:", bits) == false);
+        REQUIRE(config.ParseBitList("a:b", bits) == false);
+        REQUIRE(config.ParseBitList("13:11^", bits));
+        REQUIRE(bits.size() == 3);
+    }
+
+    SECTION("Test non invertible bit list mapping") {
+        // the channel repeats row bits and bits 13:11 are left out
+        std::vector<std::string> lists = {"20:18", "",      "17:16",
+                                          "15:14", "31:18", "10:6"};
+        std::vector<std::vector<uint64_t>> field_bits(lists.size());
+        for (size_t i = 0; i < lists.size(); i++) {
+            REQUIRE(config.ParseBitList(lists[i], field_bits[i]));
+        }
+        REQUIRE(config.CompileAddressMapping(field_bits) == false);
+        // the old mapping stays in place
+        REQUIRE(config.AddressMapping(0b000011111111111111).channel == 7);
+    }
+}
@@ -1,6 +1,18 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
 #include "catch.hpp"
 #include "configuration.h"
 #include "dram_system.h"
+#include "json.hpp"
+#include "refresh.h"
+#include "tracer.h"
 
 bool call_back_called = false;
 void dummy_call_back(uint64_t addr) {
@@ -30,3 +42,1003 @@ TEST_CASE("Jedec DRAMSystem Testing", "[dramsim3]") {
         REQUIRE(clk == tRC);
     }
 }
+
+TEST_CASE("Transaction trace parsing", "[dramsim3]") {
+    // trace lines only carry the address, type and cycle
+    dramsim3::Transaction trans;
+    std::istringstream line("0x1f40 WRITE 25");
+    line >> trans;
+    REQUIRE(trans.addr == 0x1f40);
+    REQUIRE(trans.is_write);
+    REQUIRE(trans.added_cycle == 25);
+    REQUIRE(trans.complete_cycle == 0);
+    REQUIRE(!trans.priority);
+    REQUIRE(trans.qos_class == 0);
+    REQUIRE(trans.dram_addr.channel == -1);
+}
+
+TEST_CASE("Refresh Testing", "[dramsim3][refresh]") {
+    // 2 ranks, staggered, each rank refreshes every tREFI
+    dramsim3::Config config("configs/DDR4_8Gb_x8_2400.ini", ".");
+    dramsim3::Timing timing(config);
+    dramsim3::SimpleStats stats(config, 0);
+    dramsim3::ChannelState channel_state(config, timing, stats);
+    dramsim3::CommandQueue cmd_queue(0, config, channel_state, stats);
+    dramsim3::Refresh refresh(config, channel_state, cmd_queue, stats);
+
+    SECTION("TEST refresh spacing at scale 2") {
+        refresh.SetRefreshScale(0, 2);
+        std::vector<std::vector<uint64_t>> refresh_clks(config.ranks);
+        for (uint64_t clk = 0; clk < 10 * config.tREFI; clk++) {
+            refresh.ClockTick();
+            while (channel_state.IsRefreshWaiting()) {
+                int rank = channel_state.PendingRefCommand().Rank();
+                refresh_clks[rank].push_back(clk);
+                channel_state.RankNeedRefresh(rank, false);
+            }
+        }
+        // one refresh per interval, never several back to back
+        for (int r = 0; r < config.ranks; r++) {
+            int interval = r == 0 ? config.tREFI / 2 : config.tREFI;
+            REQUIRE(refresh_clks[r].size() > 2);
+            for (size_t i = 1; i < refresh_clks[r].size(); i++) {
+                REQUIRE(refresh_clks[r][i] - refresh_clks[r][i - 1] ==
+                        static_cast<uint64_t>(interval));
+            }
+        }
+    }
+}
+
+// final stats of every channel, as written by PrintStats
+nlohmann::json ReadStats(const dramsim3::Config& config) {
+    std::ifstream stats_file(config.json_stats_name);
+    nlohmann::json stats;
+    stats_file >> stats;
+    return stats;
+}
+
+// records of the binary trace, PrintStats flushes it
+std::vector<dramsim3::TraceRecord> ReadTrace(const dramsim3::Config& config) {
+    std::vector<dramsim3::TraceRecord> records;
+    FILE* file = fopen(config.trace_file_name.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    dramsim3::TraceHeader header;
+    REQUIRE(fread(&header, sizeof(header), 1, file) == 1);
+    REQUIRE(memcmp(header.magic, dramsim3::kTraceMagic,
+                   sizeof(header.magic)) == 0);
+    REQUIRE(header.version == dramsim3::kTraceVersion);
+    REQUIRE(header.record_size == sizeof(dramsim3::TraceRecord));
+    dramsim3::TraceRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        records.push_back(record);
+    }
+    fclose(file);
+    std::remove(config.trace_file_name.c_str());
+    return records;
+}
+
+// writes a shipped config with the keys in overrides replaced, e.g.
+// "[system]\nenable_power_down = true\n", the caller removes the file
+std::string WriteTestIni(const std::string& base_ini,
+                         const std::string& overrides) {
+    auto key_of = [](const std::string& line) {
+        return line.substr(0, line.find_first_of(" \t="));
+    };
+    std::set<std::string> keys;
+    std::istringstream override_lines(overrides);
+    std::string line;
+    while (std::getline(override_lines, line)) {
+        if (line.find('=') != std::string::npos) {
+            keys.insert(key_of(line));
+        }
+    }
+    std::string ini_name = "dramsim3_test.ini";
+    std::ifstream base(base_ini);
+    std::ofstream ini(ini_name);
+    while (std::getline(base, line)) {
+        if (line.find('=') == std::string::npos || !keys.count(key_of(line))) {
+            ini << line << "\n";
+        }
+    }
+    ini << overrides;
+    return ini_name;
+}
+
+int ddr5_reads_done = 0;
+void ddr5_call_back(uint64_t addr) {
+    ddr5_reads_done++;
+    return;
+}
+
+TEST_CASE("DDR5 subchannel smoke test", "[dramsim3][ddr5]") {
+    // one 64 bit DIMM channel runs as two 32 bit subchannels
+    dramsim3::Config config("configs/DDR5_16Gb_x8_4800.ini", ".");
+    REQUIRE(config.subchannels == 2);
+    REQUIRE(config.channels == 2);
+    REQUIRE(config.bus_width == 32);
+
+    dramsim3::JedecDRAMSystem dramsys(config, ".", ddr5_call_back,
+                                      ddr5_call_back);
+    uint64_t addr = 0;
+    for (int clk = 0; clk < 20000; clk++) {
+        if (dramsys.WillAcceptTransaction(addr, false)) {
+            dramsys.AddTransaction(addr, false);
+            addr += 64;
+        }
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    REQUIRE(ddr5_reads_done > 0);
+
+    auto stats = ReadStats(config);
+    REQUIRE(stats.size() == 2);
+    for (int i = 0; i < config.channels; i++) {
+        auto& channel_stats = stats[std::to_string(i)];
+        REQUIRE(channel_stats["num_reads_done"].get<int>() > 0);
+        REQUIRE(channel_stats["num_refsb_cmds"].get<int>() > 0);
+    }
+}
+
+// REFRESH commands to rank 0 while streaming reads keep the rank busy
+// for the first busy_trefis of the run, after that it is left idle, both
+// are in multiples of the normal (1x) tREFI
+struct RefreshRun {
+    int tREFI;
+    int tRFC;
+    std::vector<uint64_t> clks;
+};
+
+RefreshRun RunRankRefreshes(const std::string& system_settings,
+                            int busy_trefis, int trefis) {
+    auto ini_name = WriteTestIni(
+        "configs/DDR4_8Gb_x8_2400.ini",
+        "[system]\n" + system_settings + "[trace]\ncommands = true\n");
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    int busy_cycles = busy_trefis * config.tREFI * config.fgr_mode;
+    int cycles = trefis * config.tREFI * config.fgr_mode;
+    uint64_t addr = 0;
+    for (int clk = 0; clk < cycles; clk++) {
+        while (clk < busy_cycles && dramsys.WillAcceptTransaction(addr, false)) {
+            if (config.AddressMapping(addr).rank == 0) {
+                dramsys.AddTransaction(addr, false);
+            }
+            addr += 64;
+        }
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    RefreshRun run{config.tREFI, config.tRFC, {}};
+    for (const auto& record : ReadTrace(config)) {
+        if (static_cast<dramsim3::CommandType>(record.type) ==
+                dramsim3::CommandType::REFRESH &&
+            record.addr.rank == 0) {
+            run.clks.push_back(record.clk);
+        }
+    }
+    return run;
+}
+
+TEST_CASE("Refresh postponement and pull-in", "[dramsim3][refresh]") {
+    // 2 staggered ranks, rank 0 is due at tREFI / 2 and every tREFI after
+    SECTION("TEST postponed refreshes are issued back to back") {
+        auto run = RunRankRefreshes("refresh_max_postpone = 4\n", 4, 6);
+        // 4 owed at the end of the busy phase, none issued before
+        REQUIRE(run.clks.size() == 6);
+        REQUIRE(run.clks[0] >= static_cast<uint64_t>(4 * run.tREFI));
+        for (int i = 1; i < 4; i++) {
+            REQUIRE(run.clks[i] - run.clks[i - 1] ==
+                    static_cast<uint64_t>(run.tRFC));
+        }
+        // then back on schedule
+        REQUIRE(run.clks[4] == static_cast<uint64_t>(run.tREFI / 2 +
+                                                     4 * run.tREFI));
+    }
+
+    SECTION("TEST busy rank is refreshed once the postponement is used up") {
+        auto run = RunRankRefreshes("refresh_max_postpone = 2\n", 6, 6);
+        // due at 0.5, 1.5 and 2.5 tREFI, the third one is forced
+        REQUIRE(run.clks.size() >= 3);
+        REQUIRE(run.clks[0] >= static_cast<uint64_t>(run.tREFI / 2 +
+                                                     2 * run.tREFI));
+        REQUIRE(run.clks[0] < static_cast<uint64_t>(run.tREFI * 3));
+    }
+
+    SECTION("TEST idle rank pulls in refreshes") {
+        auto run = RunRankRefreshes("refresh_max_pull_in = 2\n", 0, 3);
+        // due at 0.5, 1.5 and 2.5 tREFI plus 2 ahead of time
+        REQUIRE(run.clks.size() == 5);
+        REQUIRE(run.clks[0] < static_cast<uint64_t>(run.tREFI / 2));
+        REQUIRE(run.clks[1] - run.clks[0] == static_cast<uint64_t>(run.tRFC));
+    }
+
+    SECTION("TEST fine granularity refresh") {
+        auto normal = RunRankRefreshes("", 0, 4);
+        auto fgr2 = RunRankRefreshes("fgr_mode = 2\n", 0, 4);
+        REQUIRE(fgr2.tREFI == normal.tREFI / 2);
+        REQUIRE(fgr2.clks.size() == 2 * normal.clks.size());
+        for (size_t i = 1; i < fgr2.clks.size(); i++) {
+            REQUIRE(fgr2.clks[i] - fgr2.clks[i - 1] ==
+                    static_cast<uint64_t>(fgr2.tREFI));
+        }
+
+        // pulled in refreshes are only tRFC2/tRFC4 apart
+        dramsim3::Config config("configs/DDR4_8Gb_x8_2400.ini", ".");
+        auto fgr4 = RunRankRefreshes(
+            "fgr_mode = 4\nrefresh_max_pull_in = 2\n", 0, 1);
+        REQUIRE(fgr2.tRFC == config.tRFC2);
+        REQUIRE(fgr4.tRFC == config.tRFC4);
+        REQUIRE(fgr4.tREFI == normal.tREFI / 4);
+        REQUIRE(fgr4.clks.size() > 2);
+        REQUIRE(fgr4.clks[1] - fgr4.clks[0] ==
+                static_cast<uint64_t>(config.tRFC4));
+    }
+}
+
+// row misses to rank 0 bank 0, one at a time so each one is an ACT
+std::vector<dramsim3::TraceRecord> RunRowMisses(
+    const std::string& row_hammer_settings, int rows, nlohmann::json& stats) {
+    auto ini_name = WriteTestIni("configs/DDR4_8Gb_x8_2400.ini",
+                                 "[row_hammer]\n" + row_hammer_settings +
+                                     "[trace]\ncommands = true\n");
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    for (int row = 0; row < rows; row++) {
+        uint64_t addr = static_cast<uint64_t>(row)
+                        << (config.ro_pos + config.shift_bits);
+        auto dram_addr = config.AddressMapping(addr);
+        REQUIRE(dram_addr.row == row);
+        REQUIRE(dram_addr.rank + dram_addr.bankgroup + dram_addr.bank == 0);
+        dramsys.AddTransaction(addr, false);
+        for (int clk = 0; clk < 200; clk++) {
+            dramsys.ClockTick();
+        }
+    }
+    dramsys.PrintStats();
+    stats = ReadStats(config)["0"];
+    return ReadTrace(config);
+}
+
+TEST_CASE("Row hammer mitigation", "[dramsim3][row_hammer]") {
+    nlohmann::json stats;
+    SECTION("TEST PARA refreshes the neighbors of an activated row") {
+        auto records = RunRowMisses(
+            "mitigation = PARA\npara_probability = 1\n", 2, stats);
+        REQUIRE(stats["num_act_cmds"].get<int>() == 2);
+        REQUIRE(stats["num_read_cmds"].get<int>() == 2);
+        REQUIRE(stats["num_trr_cmds"].get<int>() == 1);
+        REQUIRE(stats["trr_energy"].get<double>() > 0);
+        REQUIRE(stats.count("num_rfm_cmds") == 0);
+        // the neighbors of the first row are refreshed once it is closed
+        std::vector<uint64_t> act_clks;
+        uint64_t pre_clk = 0, rfm_clk = 0;
+        for (const auto& record : records) {
+            auto cmd_type = static_cast<dramsim3::CommandType>(record.type);
+            if (cmd_type == dramsim3::CommandType::ACTIVATE) {
+                act_clks.push_back(record.clk);
+            } else if (cmd_type == dramsim3::CommandType::PRECHARGE) {
+                pre_clk = record.clk;
+            } else if (cmd_type == dramsim3::CommandType::RFM) {
+                REQUIRE(record.addr.rank + record.addr.bankgroup +
+                            record.addr.bank ==
+                        0);
+                rfm_clk = record.clk;
+            }
+        }
+        REQUIRE(act_clks.size() == 2);
+        REQUIRE(rfm_clk > pre_clk);
+        REQUIRE(pre_clk > act_clks[0]);
+        REQUIRE(act_clks[1] > rfm_clk);
+    }
+
+    SECTION("TEST RFM is issued every rfm_raaimt ACTs") {
+        // the RFM follows once the row of the last counted ACT is closed
+        RunRowMisses("mitigation = RFM\nrfm_raaimt = 4\n", 4, stats);
+        REQUIRE(stats["num_act_cmds"].get<int>() == 4);
+        REQUIRE(stats["num_rfm_cmds"].get<int>() == 0);
+
+        RunRowMisses("mitigation = RFM\nrfm_raaimt = 4\n", 5, stats);
+        REQUIRE(stats["num_rfm_cmds"].get<int>() == 1);
+        REQUIRE(stats["rfm_energy"].get<double>() > 0);
+        REQUIRE(stats.count("num_trr_cmds") == 0);
+
+        RunRowMisses("mitigation = RFM\nrfm_raaimt = 4\n", 9, stats);
+        REQUIRE(stats["num_act_cmds"].get<int>() == 9);
+        REQUIRE(stats["num_read_cmds"].get<int>() == 9);
+        REQUIRE(stats["num_rfm_cmds"].get<int>() == 2);
+    }
+}
+
+TEST_CASE("Aggressive precharge", "[dramsim3][precharge]") {
+    auto ini_name = WriteTestIni(
+        "configs/DDR4_8Gb_x8_2400.ini",
+        "[system]\naggressive_precharging_enabled = true\n");
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    // two columns of the same row
+    uint64_t read_addr = 0, write_addr = 64;
+    auto read_dram_addr = config.AddressMapping(read_addr);
+    auto write_dram_addr = config.AddressMapping(write_addr);
+    REQUIRE(read_dram_addr.rank == write_dram_addr.rank);
+    REQUIRE(read_dram_addr.bankgroup == write_dram_addr.bankgroup);
+    REQUIRE(read_dram_addr.bank == write_dram_addr.bank);
+    REQUIRE(read_dram_addr.row == write_dram_addr.row);
+    REQUIRE(read_dram_addr.column != write_dram_addr.column);
+
+    SECTION("TEST idle open row is precharged") {
+        dramsys.AddTransaction(read_addr, false);
+        for (int clk = 0; clk < 1000; clk++) {
+            dramsys.ClockTick();
+        }
+        dramsys.PrintStats();
+        auto stats = ReadStats(config)["0"];
+        REQUIRE(stats["num_read_cmds"].get<int>() == 1);
+        REQUIRE(stats["num_aggressive_pres"].get<int>() == 1);
+    }
+
+    SECTION("TEST row of a buffered write is kept open") {
+        dramsys.AddTransaction(read_addr, false);
+        dramsys.AddTransaction(write_addr, true);
+        for (int clk = 0; clk < 1000; clk++) {
+            dramsys.ClockTick();
+        }
+        dramsys.PrintStats();
+        // one write is below the drain threshold, it stays buffered
+        auto stats = ReadStats(config)["0"];
+        REQUIRE(stats["num_read_cmds"].get<int>() == 1);
+        REQUIRE(stats["num_write_cmds"].get<int>() == 0);
+        REQUIRE(stats["num_aggressive_pres"].get<int>() == 0);
+    }
+}
+
+TEST_CASE("Write buffer", "[dramsim3][write_buffer]") {
+    auto ini_name = WriteTestIni("configs/DDR4_8Gb_x8_2400.ini",
+                                 "[system]\nwrite_coalescing = true\n"
+                                 "[trace]\ncommands = true\n");
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    uint64_t clk = 0;
+    std::map<uint64_t, uint64_t> read_done_clk;
+    dramsim3::JedecDRAMSystem dramsys(
+        config, ".", [&](uint64_t addr) { read_done_clk[addr] = clk; },
+        dummy_call_back);
+    // 0 and 8 are different bytes of the same burst
+    REQUIRE(config.request_size_bytes == 64);
+
+    SECTION("TEST dropped and coalesced writes") {
+        dramsys.AddTransaction(0, true);
+        dramsys.AddTransaction(0, true);
+        dramsys.AddTransaction(8, true);
+        dramsys.AddTransaction(64, true);
+        for (clk = 0; clk < 100; clk++) {
+            dramsys.ClockTick();
+        }
+        dramsys.PrintStats();
+        ReadTrace(config);
+        auto stats = ReadStats(config)["0"];
+        REQUIRE(stats["num_dropped_writes"].get<int>() == 1);
+        REQUIRE(stats["num_coalesced_writes"].get<int>() == 1);
+    }
+
+    SECTION("TEST reads served from the write buffer") {
+        dramsys.AddTransaction(0, true);
+        dramsys.AddTransaction(0, false);
+        dramsys.AddTransaction(8, false);
+        for (clk = 0; clk < 1000; clk++) {
+            dramsys.ClockTick();
+        }
+        dramsys.PrintStats();
+        ReadTrace(config);
+        auto stats = ReadStats(config)["0"];
+        REQUIRE(stats["num_write_buf_hits"].get<int>() == 1);
+        REQUIRE(stats["num_write_buf_partial_hits"].get<int>() == 1);
+        // only the partial hit goes to DRAM
+        REQUIRE(stats["num_read_cmds"].get<int>() == 1);
+        REQUIRE(read_done_clk.size() == 2);
+        REQUIRE(read_done_clk[0] <=
+                static_cast<uint64_t>(config.write_forward_latency));
+        REQUIRE(read_done_clk[8] >=
+                static_cast<uint64_t>(config.tRCD + config.CL));
+    }
+
+    SECTION("TEST coalesced write waits for reads to its burst") {
+        dramsys.AddTransaction(8, false);
+        dramsys.AddTransaction(0, true);
+        // enough writes to start a drain right away
+        int drain_writes = config.trans_queue_size * config.high_thres + 1;
+        for (int i = 1; i < drain_writes; i++) {
+            dramsys.AddTransaction(i * 64, true);
+        }
+        for (clk = 0; clk < 2000; clk++) {
+            dramsys.ClockTick();
+        }
+        dramsys.PrintStats();
+        uint64_t read_clk = 0, write_clk = 0;
+        for (const auto& record : ReadTrace(config)) {
+            auto cmd_type = static_cast<dramsim3::CommandType>(record.type);
+            if (record.hex_addr == 8 &&
+                cmd_type == dramsim3::CommandType::READ) {
+                read_clk = record.clk;
+            } else if (record.hex_addr == 0 &&
+                       cmd_type == dramsim3::CommandType::WRITE) {
+                write_clk = record.clk;
+            }
+        }
+        REQUIRE(read_clk > 0);
+        REQUIRE(write_clk > read_clk);
+    }
+}
+
+TEST_CASE("Write buffer without coalescing", "[dramsim3][write_buffer]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_2400.ini", ".");
+    REQUIRE(!config.write_coalescing);
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    dramsys.AddTransaction(0, true);
+    dramsys.AddTransaction(0, true);
+    dramsys.AddTransaction(8, true);
+    dramsys.AddTransaction(8, false);
+    dramsys.AddTransaction(16, false);
+    for (int clk = 0; clk < 1000; clk++) {
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    // only writes to the same address merge and forward
+    auto stats = ReadStats(config)["0"];
+    REQUIRE(stats["num_dropped_writes"].get<int>() == 1);
+    REQUIRE(stats["num_coalesced_writes"].get<int>() == 0);
+    REQUIRE(stats["num_write_buf_hits"].get<int>() == 1);
+    REQUIRE(stats["num_write_buf_partial_hits"].get<int>() == 0);
+    REQUIRE(stats["num_read_cmds"].get<int>() == 1);
+}
+
+// two QoS classes keep a number of reads each outstanding to a single
+// bank, so the transactions wait for the class arbitration
+nlohmann::json RunQoSReads(const std::string& qos_settings, int outstanding,
+                           int cycles) {
+    auto ini_name = WriteTestIni("configs/DDR4_8Gb_x8_2400.ini",
+                                 "[qos]\nnum_classes = 2\n" + qos_settings);
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    std::map<uint64_t, int> addr_class;
+    std::vector<int> in_flight(2, 0);
+    dramsim3::JedecDRAMSystem dramsys(
+        config, ".",
+        [&](uint64_t addr) {
+            in_flight[addr_class[addr]]--;
+            addr_class.erase(addr);
+        },
+        dummy_call_back);
+    // columns of one row, even ones for class 0 and odd ones for class 1
+    int columns = config.columns / config.BL;
+    std::vector<int> next_column = {0, 1};
+    for (int clk = 0; clk < cycles; clk++) {
+        for (int qos_class = 0; qos_class < 2; qos_class++) {
+            while (in_flight[qos_class] < outstanding) {
+                uint64_t addr = static_cast<uint64_t>(next_column[qos_class])
+                                << config.shift_bits;
+                next_column[qos_class] = (next_column[qos_class] + 2) % columns;
+                addr_class[addr] = qos_class;
+                in_flight[qos_class]++;
+                dramsys.AddTransaction(addr, false, false, qos_class);
+            }
+        }
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    return ReadStats(config)["0"];
+}
+
+// writes issued before a late class 0 read to another bank gets its turn
+int WritesBeforeLateRead(const std::string& latency_targets) {
+    auto ini_name = WriteTestIni("configs/DDR4_8Gb_x8_2400.ini",
+                                 "[qos]\nnum_classes = 2\n" +
+                                     latency_targets + "[trace]\n" +
+                                     "commands = true\n");
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    // a bank group bit above the column bits
+    uint64_t read_addr = static_cast<uint64_t>(config.columns / config.BL)
+                         << config.shift_bits;
+    REQUIRE(config.AddressMapping(read_addr).bankgroup !=
+            config.AddressMapping(0).bankgroup);
+    dramsys.AddTransaction(read_addr, false, false, 0);
+    // enough writes to start a drain right away
+    int drain_writes = config.trans_queue_size * config.high_thres + 1;
+    for (int i = 0; i < drain_writes; i++) {
+        dramsys.AddTransaction(i * 64, true, false, 1);
+    }
+    for (int clk = 0; clk < 2000; clk++) {
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    int writes = 0;
+    for (const auto& record : ReadTrace(config)) {
+        auto cmd_type = static_cast<dramsim3::CommandType>(record.type);
+        if (cmd_type == dramsim3::CommandType::READ) {
+            return writes;
+        } else if (cmd_type == dramsim3::CommandType::WRITE) {
+            writes++;
+        }
+    }
+    return -1;
+}
+
+TEST_CASE("QoS arbitration", "[dramsim3][qos]") {
+    SECTION("TEST bandwidth is shared by weight") {
+        auto stats = RunQoSReads("weights = 3,1\n", 16, 20000);
+        double class0 = stats["qos_reads_done"]["0"].get<double>();
+        double class1 = stats["qos_reads_done"]["1"].get<double>();
+        INFO("class 0 reads " << class0 << ", class 1 reads " << class1);
+        REQUIRE(class1 > 0);
+        REQUIRE(class0 / class1 > 2.5);
+        REQUIRE(class0 / class1 < 3.5);
+    }
+
+    SECTION("TEST latency target makes a class urgent") {
+        auto no_target = RunQoSReads("weights = 100,1\n", 16, 20000);
+        auto target = RunQoSReads(
+            "weights = 100,1\nlatency_targets = 0,200\n", 16, 20000);
+        double no_target_latency =
+            no_target["average_read_latency_qos1"].get<double>();
+        double target_latency =
+            target["average_read_latency_qos1"].get<double>();
+        INFO("class 1 latency " << no_target_latency << " without target, "
+                                << target_latency << " with target");
+        REQUIRE(no_target["qos_urgent_cycles"]["1"].get<int>() == 0);
+        REQUIRE(target["qos_urgent_cycles"]["1"].get<int>() > 0);
+        REQUIRE(target["qos_urgent_cycles"]["0"].get<int>() == 0);
+        REQUIRE(target_latency < no_target_latency / 2);
+    }
+
+    SECTION("TEST late reads cut a write drain short") {
+        int no_target = WritesBeforeLateRead("latency_targets = 0,0\n");
+        int target = WritesBeforeLateRead("latency_targets = 50,0\n");
+        INFO(no_target << " writes without target, " << target << " with");
+        REQUIRE(target >= 0);
+        REQUIRE(target < no_target);
+    }
+}
+
+// field by field, Address has tail padding that is copied as is
+bool SameRecord(const dramsim3::TraceRecord& a,
+                const dramsim3::TraceRecord& b) {
+    return a.clk == b.clk && a.hex_addr == b.hex_addr && a.kind == b.kind &&
+           a.type == b.type && a.addr.channel == b.addr.channel &&
+           a.addr.rank == b.addr.rank && a.addr.bankgroup == b.addr.bankgroup &&
+           a.addr.bank == b.addr.bank && a.addr.row == b.addr.row &&
+           a.addr.column == b.addr.column;
+}
+
+// a two channel DDR4 system under scattered traffic, traced with the given
+// [trace] settings
+std::vector<dramsim3::TraceRecord> RunTraced(const std::string& trace_settings,
+                                             nlohmann::json& stats) {
+    auto ini_name = WriteTestIni("configs/DDR4_8Gb_x8_2400.ini",
+                                 "[system]\nchannels = 2\n[trace]\n" +
+                                     trace_settings);
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    uint64_t addr = 0;
+    for (int clk = 0; clk < 20000; clk++) {
+        if (dramsys.WillAcceptTransaction(addr, clk % 3 == 0)) {
+            dramsys.AddTransaction(addr, clk % 3 == 0);
+            addr = (addr * 6364136223846793005ull + 1442695040888963407ull) &
+                   ((1ull << 34) - 64);
+        }
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    stats = ReadStats(config);
+    return ReadTrace(config);
+}
+
+TEST_CASE("Binary tracing", "[dramsim3][trace]") {
+    SECTION("TEST records cross buffer boundaries in order") {
+        // a tiny ring hands a buffer to the writer every 3 records
+        auto ini_name = WriteTestIni(
+            "configs/DDR4_8Gb_x8_2400.ini",
+            "[trace]\ncommands = true\nbuffer_records = 3\n");
+        dramsim3::Config tiny_config(ini_name, ".");
+        std::remove(ini_name.c_str());
+        uint64_t num_records = 0;
+        {
+            dramsim3::Tracer tracer(tiny_config);
+            REQUIRE(tracer.IsEnabled());
+            for (; num_records < 100; num_records++) {
+                dramsim3::Address addr(-1, num_records % 2, 0, 0,
+                                       num_records, 0);
+                dramsim3::Command cmd(dramsim3::CommandType::ACTIVATE, addr,
+                                      num_records);
+                tracer.RecordCommand(cmd, 0, num_records);
+            }
+            // everything so far is in the file after a flush, including
+            // a partially filled buffer
+            tracer.Flush();
+            auto records = ReadTrace(tiny_config);
+            REQUIRE(records.size() == num_records);
+            bool in_order = true;
+            for (uint64_t i = 0; i < num_records; i++) {
+                in_order = in_order && records[i].clk == i &&
+                           records[i].hex_addr == i &&
+                           records[i].addr.row == static_cast<int>(i) &&
+                           records[i].addr.rank == static_cast<int>(i % 2) &&
+                           records[i].addr.channel == 0 &&
+                           records[i].kind == dramsim3::TraceKind::COMMAND;
+            }
+            REQUIRE(in_order);
+        }
+    }
+
+    SECTION("TEST ring size does not change the trace") {
+        nlohmann::json stats;
+        auto records = RunTraced("commands = true\ntransactions = true\n",
+                                 stats);
+        auto tiny_records = RunTraced(
+            "commands = true\ntransactions = true\nbuffer_records = 5\n",
+            stats);
+        REQUIRE(records.size() == tiny_records.size());
+        REQUIRE(std::equal(records.begin(), records.end(),
+                           tiny_records.begin(), SameRecord));
+
+        // every command issued and every transaction added is there, the
+        // channels are ticked in turn so the cycles never go back
+        std::map<std::string, int> counts;
+        int transactions = 0;
+        REQUIRE(std::is_sorted(
+            records.begin(), records.end(),
+            [](const dramsim3::TraceRecord& a, const dramsim3::TraceRecord& b) {
+                return a.clk < b.clk;
+            }));
+        for (size_t i = 0; i < records.size(); i++) {
+            if (records[i].kind == dramsim3::TraceKind::TRANSACTION) {
+                transactions++;
+            } else {
+                auto cmd_type =
+                    static_cast<dramsim3::CommandType>(records[i].type);
+                counts[dramsim3::CommandTypeString(cmd_type)]++;
+            }
+        }
+        int acts = 0, reads = 0, writes = 0, refs = 0, added = 0;
+        for (const auto& channel_stats : stats) {
+            acts += channel_stats["num_act_cmds"].get<int>();
+            reads += channel_stats["num_read_cmds"].get<int>();
+            writes += channel_stats["num_write_cmds"].get<int>();
+            refs += channel_stats["num_ref_cmds"].get<int>();
+            added += channel_stats["num_reads_done"].get<int>() +
+                     channel_stats["num_writes_done"].get<int>();
+        }
+        REQUIRE(acts > 0);
+        REQUIRE(counts["activate"] == acts);
+        REQUIRE(counts["read"] == reads);
+        REQUIRE(counts["write"] == writes);
+        REQUIRE(counts["refresh"] == refs);
+        // the ones still in flight were added but are not done
+        REQUIRE(transactions >= added);
+    }
+
+    SECTION("TEST channel, rank, cycle and type filters") {
+        nlohmann::json stats;
+        auto all = RunTraced("commands = true\ntransactions = true\n",
+                             stats);
+        auto filtered = RunTraced(
+            "commands = true\ntransactions = true\nchannels = 1\n"
+            "ranks = 0\nstart_cycle = 1000\nend_cycle = 5000\n"
+            "command_types = activate,read\n",
+            stats);
+        auto selected = [](const dramsim3::TraceRecord& record) {
+            auto cmd_type = static_cast<dramsim3::CommandType>(record.type);
+            return record.addr.channel == 1 && record.addr.rank == 0 &&
+                   record.clk >= 1000 && record.clk < 5000 &&
+                   (record.kind == dramsim3::TraceKind::TRANSACTION ||
+                    cmd_type == dramsim3::CommandType::ACTIVATE ||
+                    cmd_type == dramsim3::CommandType::READ);
+        };
+        std::vector<dramsim3::TraceRecord> expected;
+        std::copy_if(all.begin(), all.end(), std::back_inserter(expected),
+                     selected);
+        REQUIRE(!expected.empty());
+        REQUIRE(filtered.size() == expected.size());
+        REQUIRE(std::equal(filtered.begin(), filtered.end(), expected.begin(),
+                           SameRecord));
+    }
+}
+
+// rank power state residency from the stats and, for reference, counted
+// cycle by cycle from the command trace
+void CheckResidency(const std::string& system_settings) {
+    auto ini_name = WriteTestIni(
+        "configs/DDR4_8Gb_x8_2400.ini",
+        "[system]\nrow_buf_policy = CLOSE_PAGE\nenable_self_refresh = true\n" +
+            system_settings + "[trace]\ncommands = true\n");
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    // rank 0 is busy at the start and woken up again later, rank 1 idles,
+    // all before the first refresh
+    int cycles = 4000;
+    REQUIRE(cycles < config.tREFI / config.ranks);
+    for (int clk = 0; clk < cycles; clk++) {
+        if (clk < 8 || clk == 2400) {
+            dramsys.AddTransaction((clk % 8) * 64, false);
+        }
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    auto stats = ReadStats(config)["0"];
+    auto records = ReadTrace(config);
+    REQUIRE(stats["num_cycles"].get<int>() == cycles);
+
+    const std::vector<std::string> state_stats = {
+        "rank_active_cycles", "all_bank_idle_cycles", "act_pd_cycles",
+        "pre_pd_cycles", "sref_cycles"};
+    for (int rank = 0; rank < config.ranks; rank++) {
+        std::set<std::pair<int, int>> open_banks;
+        bool sref = false, pd = false;
+        std::vector<uint64_t> counted(state_stats.size(), 0);
+        std::vector<uint64_t> sref_enter_clks;
+        uint64_t idle_since = 0, pd_exit_clk = 0;
+        size_t next = 0;
+        for (uint64_t clk = 0; clk < static_cast<uint64_t>(cycles); clk++) {
+            // a command changes the state from its own cycle on
+            for (; next < records.size() && records[next].clk == clk; next++) {
+                const auto& record = records[next];
+                if (record.kind != dramsim3::TraceKind::COMMAND ||
+                    record.addr.rank != rank) {
+                    continue;
+                }
+                auto bank = std::make_pair<int, int>(record.addr.bankgroup,
+                                                     record.addr.bank);
+                switch (static_cast<dramsim3::CommandType>(record.type)) {
+                    case dramsim3::CommandType::ACTIVATE:
+                        open_banks.insert(bank);
+                        break;
+                    case dramsim3::CommandType::PRECHARGE:
+                    case dramsim3::CommandType::READ_PRECHARGE:
+                    case dramsim3::CommandType::WRITE_PRECHARGE:
+                        open_banks.erase(bank);
+                        if (open_banks.empty()) {
+                            idle_since = clk;
+                        }
+                        break;
+                    case dramsim3::CommandType::SREF_ENTER:
+                        // a powered down rank has to exit first, which
+                        // then is what happens at the threshold
+                        REQUIRE((pd_exit_clk > idle_since ? pd_exit_clk : clk) -
+                                    idle_since + 1 ==
+                                static_cast<uint64_t>(config.sref_threshold));
+                        sref_enter_clks.push_back(clk);
+                        sref = true;
+                        break;
+                    case dramsim3::CommandType::SREF_EXIT:
+                        sref = false;
+                        break;
+                    case dramsim3::CommandType::PD_ENTER:
+                        pd = true;
+                        break;
+                    case dramsim3::CommandType::PD_EXIT:
+                        pd = false;
+                        pd_exit_clk = clk;
+                        break;
+                    default:
+                        break;
+                }
+                if (record.type != static_cast<uint8_t>(
+                                       dramsim3::CommandType::PD_EXIT)) {
+                    pd_exit_clk = 0;
+                }
+            }
+            bool idle = open_banks.empty();
+            int state = sref ? 4 : pd ? (idle ? 3 : 2) : (idle ? 1 : 0);
+            counted[state]++;
+        }
+        // rank 0 enters twice, rank 1 once
+        REQUIRE(sref_enter_clks.size() == (rank == 0 ? 2 : 1));
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < state_stats.size(); i++) {
+            uint64_t residency = 0;
+            if (stats.count(state_stats[i])) {
+                residency =
+                    stats[state_stats[i]][std::to_string(rank)].get<uint64_t>();
+            }
+            INFO("rank " << rank << " " << state_stats[i]);
+            REQUIRE(residency == counted[i]);
+            total += residency;
+        }
+        REQUIRE(total == static_cast<uint64_t>(cycles));
+    }
+}
+
+TEST_CASE("Rank power state residency", "[dramsim3][power]") {
+    SECTION("TEST active, idle and self-refresh") { CheckResidency(""); }
+
+    SECTION("TEST with power down") {
+        CheckResidency("enable_power_down = true\n");
+    }
+}
+
+TEST_CASE("Power down smoke test", "[dramsim3][power]") {
+    // DDR4 with power down enabled, otherwise as shipped
+    auto ini_name = WriteTestIni("configs/DDR4_8Gb_x8_2400.ini",
+                                 "[system]\nenable_power_down = true\n");
+    dramsim3::Config config(ini_name, ".");
+    std::remove(ini_name.c_str());
+    REQUIRE(config.enable_power_down);
+
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+    // a few reads, then idle long enough for every rank to power down
+    for (uint64_t addr = 0; addr < 8 * 64; addr += 64) {
+        dramsys.AddTransaction(addr, false);
+    }
+    for (int clk = 0; clk < 20000; clk++) {
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+
+    auto stats = ReadStats(config)["0"];
+    REQUIRE(stats["num_reads_done"].get<int>() == 8);
+    REQUIRE(stats["num_pde_cmds"].get<int>() > 0);
+    uint64_t pd_cycles = 0;
+    for (int r = 0; r < config.ranks; r++) {
+        pd_cycles += stats["act_pd_cycles"][std::to_string(r)].get<uint64_t>();
+        pd_cycles += stats["pre_pd_cycles"][std::to_string(r)].get<uint64_t>();
+    }
+    REQUIRE(pd_cycles > 0);
+}
+
+#ifdef THERMAL
+int thermal_reads_done = 0;
+void thermal_call_back(uint64_t addr) {
+    thermal_reads_done++;
+    return;
+}
+
+TEST_CASE("Thermal smoke test", "[dramsim3][thermal]") {
+    // the protocols lay out channels, pseudo channels and dies differently
+    std::vector<std::string> config_files = {"configs/DDR4_8Gb_x8_2400.ini",
+                                             "configs/HBM2_8Gb_x128.ini",
+                                             "configs/HBM3_16Gb_x64.ini"};
+    for (const auto& config_file : config_files) {
+        dramsim3::Config config(config_file, ".");
+        dramsim3::JedecDRAMSystem dramsys(config, ".", thermal_call_back,
+                                          thermal_call_back);
+        thermal_reads_done = 0;
+        uint64_t addr = 0;
+        for (int clk = 0; clk < 20000; clk++) {
+            if (dramsys.WillAcceptTransaction(addr, false)) {
+                dramsys.AddTransaction(addr, false);
+                addr += 4096 + 64;
+            }
+            dramsys.ClockTick();
+        }
+        REQUIRE(thermal_reads_done > 0);
+    }
+}
+
+extern "C" double **calculate_Midx_array(double W, double Lc, int numP,
+                                         int dimX, int dimZ, int *MidxSize,
+                                         double Tamb_);
+extern "C" double *calculate_Cap_array(double W, double Lc, int numP, int dimX,
+                                       int dimZ, int *CapSize);
+extern "C" void *pcg_thermal_system(int numP, int dimX, int dimZ,
+                                    double **Midx, int MidxSize, double *Cap,
+                                    double dt, double tol);
+extern "C" void pcg_thermal_free(void *sys);
+extern "C" int pcg_steady_thermal_solver(void *sys, const double *power,
+                                         double W, double Lc, int numP,
+                                         int dimX, int dimZ,
+                                         const double *T_guess, double Tamb_,
+                                         double *T, double *work);
+extern "C" void pcg_transient_thermal_solver(void *sys, const double *power,
+                                             double W, double Lc, int numP,
+                                             int dimX, int dimZ, int iter,
+                                             double *T_trans, double Tamb_,
+                                             double *work);
+extern "C" int thermal_work_size(int numP, int dimX, int dimZ);
+
+TEST_CASE("PCG thermal solver", "[thermal]") {
+    // a 4x4 grid of 2 dies is small enough to check against directly
+    const int numP = 2, dimX = 4, dimZ = 4;
+    const double W = 0.01, Lc = 0.01, amb_temp = 40, tol = 1e-10;
+    const double Tamb = amb_temp + T0;
+    const int n = dimX * dimZ * (numP * 3 + 1);
+    int MidxSize, CapSize;
+    double** Midx =
+        calculate_Midx_array(W, Lc, numP, dimX, dimZ, &MidxSize, Tamb);
+    double* Cap = calculate_Cap_array(W, Lc, numP, dimX, dimZ, &CapSize);
+    void* steady = pcg_thermal_system(numP, dimX, dimZ, Midx, MidxSize, Cap,
+                                      0, tol);
+    std::vector<double> work(thermal_work_size(numP, dimX, dimZ));
+    std::vector<double> guess(n, Tamb), T(n);
+    std::vector<double> power(numP * dimX * dimZ, 0);
+
+    SECTION("TEST no power stays at the ambient temperature") {
+        std::vector<double> cold(n, T0);
+        pcg_steady_thermal_solver(steady, power.data(), W, Lc, numP, dimX,
+                                  dimZ, cold.data(), Tamb, T.data(),
+                                  work.data());
+        for (int i = 0; i < n; i++) {
+            REQUIRE(T[i] == Approx(amb_temp).epsilon(1e-8));
+        }
+    }
+
+    SECTION("TEST steady solve against its residual and a transient run") {
+        // one hot spot on the lower and a spread load on the upper die
+        power[5] = 0.2;
+        for (int i = dimX * dimZ; i < numP * dimX * dimZ; i++) {
+            power[i] = 0.01;
+        }
+        int iters = pcg_steady_thermal_solver(
+            steady, power.data(), W, Lc, numP, dimX, dimZ, guess.data(), Tamb,
+            T.data(), work.data());
+        REQUIRE(iters > 0);
+        REQUIRE(iters < n);
+
+        // G * T = P within the tolerance, recomputed from the Midx triplets,
+        // the heat sink layer is tied to the ambient temperature
+        std::vector<double> b(n, 0), r(n, 0);
+        double Ramb = Hhs / Khs / (W / dimX) / (Lc / dimZ) / 2;
+        for (int i = 0; i < dimX * dimZ; i++) {
+            b[i] = Tamb / Ramb;
+        }
+        for (int l = 0; l < numP; l++) {
+            for (int i = 0; i < dimX * dimZ; i++) {
+                b[(l * 3 + 1) * dimX * dimZ + i] = power[l * dimX * dimZ + i];
+            }
+        }
+        r = b;
+        for (int k = 0; k < MidxSize; k++) {
+            int row = static_cast<int>(Midx[k][0] + 0.01);
+            int col = static_cast<int>(Midx[k][1] + 0.01);
+            r[row] -= Midx[k][2] * (T[col] + T0);
+        }
+        double rr = 0, bb = 0;
+        for (int i = 0; i < n; i++) {
+            rr += r[i] * r[i];
+            bb += b[i] * b[i];
+        }
+        REQUIRE(std::sqrt(rr / bb) <= tol);
+        REQUIRE(*std::max_element(T.begin(), T.end()) > amb_temp + 1);
+
+        // backward Euler settles at the same temperatures
+        void* transient = pcg_thermal_system(numP, dimX, dimZ, Midx, MidxSize,
+                                             Cap, 1.0, tol);
+        std::vector<double> T_trans(n, Tamb);
+        pcg_transient_thermal_solver(transient, power.data(), W, Lc, numP,
+                                     dimX, dimZ, 200, T_trans.data(), Tamb,
+                                     work.data());
+        pcg_thermal_free(transient);
+        for (int i = 0; i < n; i++) {
+            REQUIRE(T_trans[i] - T0 == Approx(T[i]).epsilon(1e-6));
+        }
+
+        // a looser tolerance takes fewer iterations
+        void* loose = pcg_thermal_system(numP, dimX, dimZ, Midx, MidxSize, Cap,
+                                         0, 1e-4);
+        std::vector<double> T_loose(n);
+        int loose_iters = pcg_steady_thermal_solver(
+            loose, power.data(), W, Lc, numP, dimX, dimZ, guess.data(), Tamb,
+            T_loose.data(), work.data());
+        pcg_thermal_free(loose);
+        REQUIRE(loose_iters < iters);
+    }
+
+    pcg_thermal_free(steady);
+    for (int i = 0; i < MidxSize; i++) free(Midx[i]);
+    free(Midx);
+    free(Cap);
+}
+#endif  // THERMAL
@@ -1,7 +1,15 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
 #include "catch.hpp"
 #include "configuration.h"
+#include "hmc.h"
 #include "memory_system.h"
 
+// from test_dramsys.cc
+std::string WriteTestIni(const std::string& base_ini,
+                         const std::string& overrides);
+
 bool hmc_called = false;
 
 void hmc_callback(uint64_t addr) {
@@ -38,4 +46,213 @@ TEST_CASE("HMC System Testing", "[dramsim3][hmc]") {
         int idle_lat = 52;
         REQUIRE(clk == idle_lat);
     }
+
+    SECTION("TEST HMC atomic and posted requests") {
+        hmc_called = false;
+        hmc.AddHMCTransaction(1, dramsim3::HMCReqType::ADDS8R);
+        int clk = 0;
+        while (!hmc_called && clk < 1000) {
+            hmc.ClockTick();
+            clk++;
+        }
+        REQUIRE(hmc_called);
+
+        // no response for posted writes
+        hmc_called = false;
+        hmc.AddHMCTransaction(64, dramsim3::HMCReqType::P_WR64);
+        for (clk = 0; clk < 1000; clk++) {
+            hmc.ClockTick();
+        }
+        REQUIRE(!hmc_called);
+    }
+}
+
+std::vector<size_t> LinkQueueSizes(const dramsim3::HMCMemorySystem& hmc,
+                                   int links) {
+    std::vector<size_t> sizes;
+    for (int i = 0; i < links; i++) {
+        sizes.push_back(hmc.LinkQueueSize(i));
+    }
+    return sizes;
+}
+
+// the link that got one more request, -1 if not exactly one did
+int GrownLink(const std::vector<size_t>& before,
+              const std::vector<size_t>& after) {
+    int link = -1;
+    for (size_t i = 0; i < before.size(); i++) {
+        if (after[i] == before[i] + 1 && link < 0) {
+            link = i;
+        } else if (after[i] != before[i]) {
+            return -1;
+        }
+    }
+    return link;
+}
+
+TEST_CASE("HMC link selection", "[dramsim3][hmc]") {
+    SECTION("TEST address selection sticks to a link") {
+        auto ini_name = WriteTestIni("configs/HMC_2GB_4Lx16.ini",
+                                     "[hmc]\nlink_select = address\n");
+        dramsim3::Config config(ini_name, ".");
+        std::remove(ini_name.c_str());
+        dramsim3::HMCMemorySystem hmc(config, ".", hmc_callback, hmc_callback);
+        int links = config.num_links;
+        size_t depth = static_cast<size_t>(config.xbar_queue_depth);
+
+        // a block only ever fills its own link
+        uint64_t addr = 0x12340;
+        size_t added = 0;
+        while (hmc.WillAcceptTransaction(addr, false)) {
+            REQUIRE(hmc.AddTransaction(addr, false));
+            added++;
+            REQUIRE(added <= depth);
+        }
+        REQUIRE(added == depth);
+        REQUIRE(!hmc.AddTransaction(addr, false));
+        auto sizes = LinkQueueSizes(hmc, links);
+        auto sticky = std::find(sizes.begin(), sizes.end(), depth);
+        REQUIRE(sticky != sizes.end());
+        int link = sticky - sizes.begin();
+        REQUIRE(std::count(sizes.begin(), sizes.end(), 0) == links - 1);
+
+        // other blocks still get in on the other links
+        bool other_added = false;
+        for (uint64_t other = 0; other < 64 * 64 && !other_added;
+             other += 64) {
+            other_added = hmc.AddTransaction(other, false);
+        }
+        REQUIRE(other_added);
+        REQUIRE(hmc.LinkQueueSize(link) == depth);
+
+        // and the block comes back to its link once there is room again
+        for (int clk = 0; clk < 1000 && hmc.LinkQueueSize(link) == depth;
+             clk++) {
+            hmc.ClockTick();
+        }
+        auto before = LinkQueueSizes(hmc, links);
+        REQUIRE(hmc.AddTransaction(addr, false));
+        REQUIRE(GrownLink(before, LinkQueueSizes(hmc, links)) == link);
+    }
+
+    SECTION("TEST least loaded selection") {
+        auto ini_name = WriteTestIni("configs/HMC_2GB_4Lx16.ini",
+                                     "[hmc]\nlink_select = least_loaded\n");
+        dramsim3::Config config(ini_name, ".");
+        std::remove(ini_name.c_str());
+        dramsim3::HMCMemorySystem hmc(config, ".", hmc_callback, hmc_callback);
+        int links = config.num_links;
+        REQUIRE(links == 4);
+
+        // load the links unevenly, 3, 1, 2 and 0 requests
+        std::vector<int> preload = {3, 1, 2, 0};
+        for (int i = 0; i < links; i++) {
+            for (int j = 0; j < preload[i]; j++) {
+                uint64_t addr = (i * 8 + j) * 64;
+                int vault = hmc.GetChannel(addr);
+                REQUIRE(hmc.InsertReqToLink(
+                    dramsim3::HMCRequest(dramsim3::HMCReqType::RD64, addr,
+                                         vault, vault % config.num_quads),
+                    i));
+            }
+        }
+
+        // every request goes to a link with the shortest queue, ties go to
+        // the first one from the round robin pointer, which starts at link 0
+        // and moves on by one with every request
+        std::vector<int> expected = {3, 1, 3, 3, 1, 2};
+        for (size_t i = 0; i < expected.size(); i++) {
+            auto before = LinkQueueSizes(hmc, links);
+            REQUIRE(hmc.AddTransaction(i * 4096, false));
+            auto after = LinkQueueSizes(hmc, links);
+            int link = GrownLink(before, after);
+            REQUIRE(link >= 0);
+            REQUIRE(before[link] ==
+                    *std::min_element(before.begin(), before.end()));
+            REQUIRE(link == expected[i]);
+        }
+        REQUIRE(LinkQueueSizes(hmc, links) == std::vector<size_t>(links, 3));
+    }
+}
+
+TEST_CASE("HMC age arbiter", "[dramsim3][hmc]") {
+    SECTION("TEST ports keep their age order") {
+        dramsim3::AgeArbiter arbiter(4);
+        REQUIRE(arbiter.Front() == -1);
+        arbiter.Join(2);
+        arbiter.Join(0);
+        arbiter.Join(3);
+        arbiter.Join(2);  // already waiting, keeps its place
+        REQUIRE(arbiter.Front() == 2);
+        REQUIRE(arbiter.Next(2) == 0);
+        REQUIRE(arbiter.Next(0) == 3);
+        REQUIRE(arbiter.Back() == 3);
+
+        // a granted port with more to send goes to the back
+        arbiter.Leave(0);
+        arbiter.Join(0);
+        REQUIRE(arbiter.Front() == 2);
+        REQUIRE(arbiter.Next(2) == 3);
+        REQUIRE(arbiter.Next(3) == 0);
+        REQUIRE(arbiter.Back() == 0);
+        arbiter.Leave(2);
+        arbiter.Leave(0);
+        REQUIRE(arbiter.Front() == 3);
+        REQUIRE(arbiter.Back() == 3);
+        arbiter.Leave(3);
+        REQUIRE(arbiter.Front() == -1);
+        REQUIRE(arbiter.Back() == -1);
+    }
+
+    SECTION("TEST oldest link first under a stalled quad") {
+        // one flit per cycle through the xbar keeps a quad busy for a while
+        auto ini_name = WriteTestIni("configs/HMC_2GB_4Lx16.ini",
+                                     "[hmc]\nxbar_bandwidth = 1\n");
+        dramsim3::Config config(ini_name, ".");
+        std::remove(ini_name.c_str());
+        dramsim3::HMCMemorySystem hmc(config, ".", hmc_callback, hmc_callback);
+        int links = config.num_links;
+        REQUIRE(links == 4);
+
+        // the first address of each quad
+        std::vector<uint64_t> quad_addr(config.num_quads, 0);
+        std::vector<bool> found(config.num_quads, false);
+        for (uint64_t addr = 0; std::count(found.begin(), found.end(), false);
+             addr += 64) {
+            int quad = hmc.GetChannel(addr) % config.num_quads;
+            if (!found[quad]) {
+                quad_addr[quad] = addr;
+                found[quad] = true;
+            }
+        }
+        auto insert = [&](int link, int quad) {
+            uint64_t addr = quad_addr[quad];
+            int vault = hmc.GetChannel(addr);
+            REQUIRE(hmc.InsertReqToLink(
+                dramsim3::HMCRequest(dramsim3::HMCReqType::WR256, addr, vault,
+                                     quad),
+                link));
+        };
+        // links 3, 0 and 2 wait for quad 0 in this order, link 1 comes last
+        // but has quad 1 to itself
+        insert(3, 0);
+        insert(0, 0);
+        insert(2, 0);
+        insert(1, 1);
+
+        std::vector<int> drained;
+        for (int clk = 0; clk < 1000 && drained.size() < 4; clk++) {
+            hmc.ClockTick();
+            for (int link = 0; link < links; link++) {
+                if (hmc.LinkQueueSize(link) == 0 &&
+                    std::find(drained.begin(), drained.end(), link) ==
+                        drained.end()) {
+                    drained.push_back(link);
+                }
+            }
+        }
+        REQUIRE(drained.size() == 4);
+        // links 3 and 1 go in the first cycle, in link order here
+        REQUIRE(drained == std::vector<int>({1, 3, 0, 2}));
+    }
 }